@@ -0,0 +1,113 @@
+// arena.c
+// Bump-pointer allocator used for symbol names and parse trees
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/// Bytes reserved at the start of each block for its header
+#define ARENA_HDR ((sizeof(arena_block_t) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/// Start of the usable memory in a block
+static unsigned char *block_data(arena_block_t *b)
+{
+    return (unsigned char *)b + ARENA_HDR;
+}
+
+/// Initialize an empty arena
+/// @param arena arena to initialize
+/// @param block_size bytes per block (0 selects ARENA_BLOCK)
+void arena_init(arena_t *arena, size_t block_size)
+{
+    arena->first = NULL;
+    arena->cur = NULL;
+    arena->block_size = block_size ? block_size : ARENA_BLOCK;
+#ifndef NO_STATS
+    arena->allocs = 0;
+    arena->blocks = 0;
+#endif
+}
+
+/// Allocate a fresh block and link it in after the current one
+/// @param arena target arena
+/// @param min_size smallest usable size the block must have
+/// @return the new block, exits on allocation failure
+static arena_block_t *new_block(arena_t *arena, size_t min_size)
+{
+    size_t size = arena->block_size > min_size ? arena->block_size : min_size;
+    arena_block_t *b = malloc(ARENA_HDR + size);
+    if (!b) {
+        perror("malloc arena block");
+        exit(EXIT_FAILURE);
+    }
+    b->size = size;
+    b->used = 0;
+#ifndef NO_STATS
+    arena->blocks++;
+#endif
+
+    if (!arena->cur) {
+        b->next = arena->first;
+        arena->first = b;
+    } else {
+        b->next = arena->cur->next;
+        arena->cur->next = b;
+    }
+    return b;
+}
+
+/// Bump-allocate aligned memory
+/// Blocks after cur are always empty, so they are reused before
+/// any new block is requested from malloc()
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (size == 0) size = ARENA_ALIGN;
+
+    arena_block_t *b = arena->cur ? arena->cur : arena->first;
+    while (b && b->size - b->used < size) {
+        b = b->next;
+    }
+    if (!b) b = new_block(arena, size);
+    arena->cur = b;
+#ifndef NO_STATS
+    arena->allocs++;
+#endif
+
+    void *p = block_data(b) + b->used;
+    b->used += size;
+    return p;
+}
+
+/// Copy a (possibly unterminated) string into the arena
+char *arena_strndup(arena_t *arena, const char *str, size_t len)
+{
+    char *copy = arena_alloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/// Mark every block empty again without returning memory
+void arena_reset(arena_t *arena)
+{
+    for (arena_block_t *b = arena->first; b != NULL; b = b->next) {
+        b->used = 0;
+    }
+    arena->cur = arena->first;
+}
+
+/// Free all blocks owned by the arena
+void arena_free(arena_t *arena)
+{
+    arena_block_t *b = arena->first;
+    while (b != NULL) {
+        arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+    arena->first = NULL;
+    arena->cur = NULL;
+}
@@ -0,0 +1,60 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_ALIGN 16              // alignment of every arena allocation
+#define ARENA_BLOCK 65536           // default block size in bytes
+
+// One contiguous block of arena memory
+typedef struct arena_block_s {
+    struct arena_block_s *next;     // the next block in the chain
+    size_t size;                    // usable bytes in this block
+    size_t used;                    // bytes handed out so far
+} arena_block_t;
+
+// A bump-pointer allocator.  Individual allocations are never freed;
+// the whole arena is released at once by arena_reset() or arena_free().
+typedef struct arena_s {
+    arena_block_t *first;           // first block in the chain
+    arena_block_t *cur;             // block currently being filled
+    size_t block_size;              // size of newly allocated blocks
+#ifndef NO_STATS
+    size_t allocs;                  // arena_alloc() calls (for --stats)
+    size_t blocks;                  // blocks requested from malloc()
+#endif
+} arena_t;
+
+/// Initializes an empty arena.  No memory is allocated until the
+/// first call to arena_alloc().
+/// @param arena  the arena to initialize
+/// @param block_size  size of each block, or 0 for ARENA_BLOCK
+void arena_init(arena_t *arena, size_t block_size);
+
+/// Allocates size bytes aligned to ARENA_ALIGN.
+/// @param arena  the arena to allocate from
+/// @param size  the number of bytes requested
+/// @return pointer to the memory
+/// @exception exits with EXIT_FAILURE if memory is exhausted
+void *arena_alloc(arena_t *arena, size_t size);
+
+/// Copies len bytes of str into the arena and null-terminates the copy.
+/// @param arena  the arena to allocate from
+/// @param str  the characters to copy (need not be null-terminated)
+/// @param len  the number of characters to copy
+/// @return the null-terminated copy
+char *arena_strndup(arena_t *arena, const char *str, size_t len);
+
+/// Releases every allocation at once but keeps the blocks, so an
+/// arena that is reset and refilled stops calling malloc() once it
+/// has grown to its working size.
+/// @param arena  the arena to reset
+void arena_reset(arena_t *arena);
+
+/// Returns all blocks to the heap.  The arena may be reused afterwards.
+/// @param arena  the arena to free
+void arena_free(arena_t *arena);
+
+#endif
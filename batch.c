@@ -0,0 +1,620 @@
+// batch.c
+// Parallel batch evaluation: script lines are parsed and compiled in
+// order, scheduled as a DAG over the symbols they read and write, run
+// on a work-stealing thread pool started once per script, and printed
+// back in input order
+// @author: Munkh-Orgil Jargalsaikhan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "batch.h"
+#include "parser.h"
+#include "bytecode.h"
+#include "symtab.h"
+#include "line_reader.h"
+#include "outbuf.h"
+#include "interp_ctx.h"
+#include "util.h"
+
+#define NO_TASK ((size_t)-1)
+
+/// One non-blank line of the chunk
+typedef struct batch_line_s {
+    tree_node_t *root;          ///< parse tree, NULL if the line did not parse
+    size_t err_start;           ///< its held-back messages in err_text
+    size_t err_end;
+    size_t code;                ///< first instruction in the chunk's code
+    size_t code_len;            ///< 0 if there is nothing to run
+    size_t max_depth;           ///< operand stack the code needs
+    size_t memo_slots;          ///< memo slots the code uses
+    int value;                  ///< result
+    eval_error_t err;           ///< evaluation error
+} batch_line_t;
+
+/// A run of consecutive lines, scheduled as a unit
+typedef struct batch_task_s {
+    size_t first;               ///< first line
+    size_t count;               ///< number of lines
+    int pending;                ///< predecessors that have not finished
+    size_t succ;                ///< first successor in succs
+    size_t nsucc;               ///< number of successors
+    size_t seen;                ///< last task given an edge from this one
+    size_t worker;              ///< worker that ran it
+    size_t def_start;           ///< its first definitions in that worker's log
+    size_t def_len;
+} batch_task_t;
+
+/// A dependency: task to may not start before task from finishes
+typedef struct edge_s {
+    size_t from;
+    size_t to;
+} edge_t;
+
+/// Scheduling state of one symbol within a chunk
+typedef struct sym_state_s {
+    symbol_t *sym;              ///< the symbol, NULL for an empty slot
+    size_t writer;              ///< last task that writes it, or NO_TASK
+    size_t readers;             ///< newest reader since then (index + 1), or 0
+} sym_state_t;
+
+/// A task that reads a symbol; readers of one symbol form a list
+typedef struct reader_s {
+    size_t task;
+    size_t next;                ///< the previous reader (index + 1), or 0
+} reader_t;
+
+/// One thread of the pool with its own queue of ready tasks
+typedef struct worker_s {
+    pthread_t thread;
+    size_t id;
+    struct batch_run_s *run;    ///< the run it belongs to
+    pthread_mutex_t lock;       ///< guards the queue
+    size_t *deque;              ///< owner pops the bottom, thieves take the top
+    size_t top;
+    size_t bottom;
+    size_t deque_cap;
+    int *stack;                 ///< VM operand stack
+    size_t stack_cap;
+    define_log_t log;           ///< symbols this worker defined first
+} worker_t;
+
+/// Scheduler state of one run_parallel() call, owned by its context
+typedef struct batch_run_s {
+    batch_line_t *lines;        ///< lines of the current chunk
+    size_t lines_cap;
+    size_t nlines;
+
+    batch_task_t *tasks;        ///< tasks of the current chunk
+    size_t tasks_cap;
+    size_t ntasks;
+
+    edge_t *edges;              ///< dependencies found so far
+    size_t edges_cap;
+    size_t nedges;
+    size_t *succs;              ///< successor lists, by task
+    size_t succs_cap;
+
+    vm_insn_t *code;            ///< compiled lines, back to back
+    size_t code_cap;
+    size_t code_len;
+    size_t stack_need;          ///< largest VM stack any line needs
+    bytecode_t scratch;         ///< compiler output for one line
+    outbuf_t err_text;          ///< held-back error messages
+
+    sym_state_t *sym_map;       ///< symbol states, keyed by address
+    size_t sym_map_cap;
+    size_t sym_map_used;
+    reader_t *readers;
+    size_t readers_cap;
+    size_t nreaders;
+
+    worker_t *workers;
+    size_t nworkers;
+    size_t remaining;           ///< tasks not finished (atomic)
+    size_t ready;               ///< tasks waiting in queues (atomic)
+    size_t sleepers;            ///< workers waiting for work (atomic)
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    size_t generation;          ///< chunks handed to the pool (idle_lock)
+    size_t busy;                ///< workers still in the chunk (idle_lock)
+    int closing;                ///< the pool is shutting down (idle_lock)
+    pthread_cond_t start_cond;
+    pthread_cond_t done_cond;
+} batch_run_t;
+
+/// Add a line to the chunk
+/// @return the new line, with no tree and no code
+static batch_line_t *new_line(batch_run_t *b)
+{
+    b->lines = reserve_work(b->lines, &b->lines_cap, b->nlines + 1, sizeof(batch_line_t));
+    batch_line_t *ln = &b->lines[b->nlines++];
+    ln->root = NULL;
+    ln->err_start = b->err_text.len;
+    ln->err_end = b->err_text.len;
+    ln->code = b->code_len;
+    ln->code_len = 0;
+    ln->max_depth = 0;
+    ln->memo_slots = 0;
+    ln->value = 0;
+    ln->err = EVAL_NONE;
+    return ln;
+}
+
+/// Parse, bind and compile one cleaned line; parse errors are held
+/// back in err_text, and the tree stays alive for printing
+static void prepare_line(interp_ctx_t *ctx, char *start, size_t len)
+{
+    batch_run_t *b = ctx->batch;
+    batch_line_t *ln = new_line(b);
+    ln->root = make_parse_tree_n_r(ctx, start, len);
+    ln->err_end = b->err_text.len;
+    if (!ln->root) return;
+
+    bind_tree_r(ctx, ln->root);
+    compile_expr_r(ctx, &b->scratch, ln->root);
+
+    b->code = reserve_work(b->code, &b->code_cap, b->code_len + b->scratch.len, sizeof(vm_insn_t));
+    memcpy(b->code + b->code_len, b->scratch.code, b->scratch.len * sizeof(vm_insn_t));
+    ln->code = b->code_len;
+    ln->code_len = b->scratch.len;
+    ln->max_depth = b->scratch.max_depth;
+    ln->memo_slots = b->scratch.memo_slots;
+    b->code_len += b->scratch.len;
+    if (vm_stack_size(&b->scratch) > b->stack_need) b->stack_need = vm_stack_size(&b->scratch);
+}
+
+/// Read lines from *cursor until the chunk is full or the text ends
+/// @param cursor scan position, advanced past the lines read
+/// @param end one past the end of the text
+/// @param max_line longest accepted line (0 = no limit)
+static void read_chunk(interp_ctx_t *ctx, char **cursor, char *end, size_t max_line)
+{
+    batch_run_t *b = ctx->batch;
+    char *p = *cursor;
+    while (p < end && b->nlines < BATCH_CHUNK) {
+        char *nl = memchr(p, '\n', (size_t)(end - p));
+        char *eol = nl ? nl : end;
+        size_t len = (size_t)(eol - p);
+
+        if (max_line && len > max_line) {
+            new_line(b);
+            ob_puts(&b->err_text, "Input line too long\n");
+            b->lines[b->nlines - 1].err_end = b->err_text.len;
+        } else {
+            size_t n;
+            char *start = clean_line(p, len, &n);
+            if (n > 0) prepare_line(ctx, start, n);
+        }
+        p = nl ? nl + 1 : end;
+    }
+    *cursor = p;
+}
+
+/// Slot of a symbol in the map: its state, or the empty slot for it
+static sym_state_t *sym_slot(batch_run_t *b, symbol_t *sym)
+{
+    size_t mask = b->sym_map_cap - 1;
+    size_t i = hash_ptr(sym) & mask;
+    while (b->sym_map[i].sym && b->sym_map[i].sym != sym) i = (i + 1) & mask;
+    return &b->sym_map[i];
+}
+
+/// Double the symbol map and re-insert its states
+static void grow_sym_map(batch_run_t *b)
+{
+    size_t old_cap = b->sym_map_cap;
+    sym_state_t *old = b->sym_map;
+
+    b->sym_map_cap = old_cap ? old_cap * 2 : 256;
+    b->sym_map = calloc(b->sym_map_cap, sizeof(sym_state_t));
+    if (!b->sym_map) {
+        perror("calloc batch symbol map");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < old_cap; ++i) {
+        if (old[i].sym) *sym_slot(b, old[i].sym) = old[i];
+    }
+    free(old);
+}
+
+/// Scheduling state of a symbol, created on first use in the chunk
+static sym_state_t *sym_state(batch_run_t *b, symbol_t *sym)
+{
+    if ((b->sym_map_used + 1) * 2 > b->sym_map_cap) grow_sym_map(b);
+
+    sym_state_t *st = sym_slot(b, sym);
+    if (!st->sym) {
+        st->sym = sym;
+        st->writer = NO_TASK;
+        st->readers = 0;
+        b->sym_map_used++;
+    }
+    return st;
+}
+
+/// Record that task to must wait for task from
+static void add_edge(batch_run_t *b, size_t from, size_t to)
+{
+    if (from == NO_TASK || from == to || b->tasks[from].seen == to) return;
+    b->tasks[from].seen = to;
+    b->edges = reserve_work(b->edges, &b->edges_cap, b->nedges + 1, sizeof(edge_t));
+    b->edges[b->nedges].from = from;
+    b->edges[b->nedges].to = to;
+    b->nedges++;
+}
+
+/// A read waits for the last write
+static void note_read(batch_run_t *b, size_t t, symbol_t *sym)
+{
+    sym_state_t *st = sym_state(b, sym);
+    add_edge(b, st->writer, t);
+    if (st->readers && b->readers[st->readers - 1].task == t) return;
+
+    b->readers = reserve_work(b->readers, &b->readers_cap, b->nreaders + 1, sizeof(reader_t));
+    b->readers[b->nreaders].task = t;
+    b->readers[b->nreaders].next = st->readers;
+    st->readers = ++b->nreaders;
+}
+
+/// A write waits for the last write and every read since
+static void note_write(batch_run_t *b, size_t t, symbol_t *sym)
+{
+    sym_state_t *st = sym_state(b, sym);
+    add_edge(b, st->writer, t);
+    for (size_t r = st->readers; r; r = b->readers[r - 1].next) add_edge(b, b->readers[r - 1].task, t);
+    st->writer = t;
+    st->readers = 0;
+}
+
+/// Group the chunk's lines into tasks and link them by the symbols
+/// their code loads and stores
+static void build_graph(batch_run_t *b)
+{
+    b->ntasks = (b->nlines + BATCH_GROUP - 1) / BATCH_GROUP;
+    b->tasks = reserve_work(b->tasks, &b->tasks_cap, b->ntasks, sizeof(batch_task_t));
+    b->nedges = 0;
+    b->nreaders = 0;
+    if (b->sym_map) memset(b->sym_map, 0, b->sym_map_cap * sizeof(sym_state_t));
+    b->sym_map_used = 0;
+
+    for (size_t t = 0; t < b->ntasks; ++t) {
+        batch_task_t *task = &b->tasks[t];
+        task->first = t * BATCH_GROUP;
+        task->count = b->nlines - task->first < BATCH_GROUP ? b->nlines - task->first : BATCH_GROUP;
+        task->pending = 0;
+        task->nsucc = 0;
+        task->seen = NO_TASK;
+        task->def_len = 0;
+
+        for (size_t i = task->first; i < task->first + task->count; ++i) {
+            const vm_insn_t *insn = b->code + b->lines[i].code;
+            for (size_t k = 0; k < b->lines[i].code_len; ++k) {
+                if (insn[k].op == VM_LOAD) note_read(b, t, insn[k].arg.sym);
+                else if (insn[k].op == VM_STORE) note_write(b, t, insn[k].arg.sym);
+            }
+        }
+    }
+
+    /* successor lists, grouped by task */
+    for (size_t e = 0; e < b->nedges; ++e) {
+        b->tasks[b->edges[e].from].nsucc++;
+        b->tasks[b->edges[e].to].pending++;
+    }
+    size_t at = 0;
+    for (size_t t = 0; t < b->ntasks; ++t) {
+        b->tasks[t].succ = at;
+        at += b->tasks[t].nsucc;
+        b->tasks[t].nsucc = 0;
+    }
+    b->succs = reserve_work(b->succs, &b->succs_cap, b->nedges, sizeof(size_t));
+    for (size_t e = 0; e < b->nedges; ++e) {
+        batch_task_t *from = &b->tasks[b->edges[e].from];
+        b->succs[from->succ + from->nsucc++] = b->edges[e].to;
+    }
+}
+
+/// Put a ready task on a worker's queue, waking a sleeping worker
+static void push_task(worker_t *w, size_t t)
+{
+    batch_run_t *b = w->run;
+    pthread_mutex_lock(&w->lock);
+    w->deque[w->bottom++] = t;
+    __atomic_add_fetch(&b->ready, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&w->lock);
+
+    if (__atomic_load_n(&b->sleepers, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&b->idle_lock);
+        pthread_cond_signal(&b->idle_cond);
+        pthread_mutex_unlock(&b->idle_lock);
+    }
+}
+
+/// Take the newest task from a worker's own queue
+/// @return 1 if a task was taken
+static int pop_task(worker_t *w, size_t *t)
+{
+    batch_run_t *b = w->run;
+    int found = 0;
+    pthread_mutex_lock(&w->lock);
+    if (w->bottom > w->top) {
+        *t = w->deque[--w->bottom];
+        __atomic_sub_fetch(&b->ready, 1, __ATOMIC_SEQ_CST);
+        found = 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return found;
+}
+
+/// Take the oldest task from some other worker's queue
+/// @return 1 if a task was taken
+static int steal_task(worker_t *w, size_t *t)
+{
+    batch_run_t *b = w->run;
+    for (size_t i = 1; i < b->nworkers; ++i) {
+        worker_t *victim = &b->workers[(w->id + i) % b->nworkers];
+        int found = 0;
+        pthread_mutex_lock(&victim->lock);
+        if (victim->bottom > victim->top) {
+            *t = victim->deque[victim->top++];
+            __atomic_sub_fetch(&b->ready, 1, __ATOMIC_SEQ_CST);
+            found = 1;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if (found) return 1;
+    }
+    return 0;
+}
+
+/// Sleep until a task is queued or every task is done
+static void wait_for_work(batch_run_t *b)
+{
+    pthread_mutex_lock(&b->idle_lock);
+    __atomic_add_fetch(&b->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&b->ready, __ATOMIC_SEQ_CST) == 0
+           && __atomic_load_n(&b->remaining, __ATOMIC_SEQ_CST) > 0) {
+        pthread_cond_wait(&b->idle_cond, &b->idle_lock);
+    }
+    __atomic_sub_fetch(&b->sleepers, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&b->idle_lock);
+}
+
+/// Run a task's lines, then release the tasks waiting for it
+static void run_task(worker_t *w, size_t t)
+{
+    batch_run_t *b = w->run;
+    batch_task_t *task = &b->tasks[t];
+    task->worker = w->id;
+    task->def_start = w->log.len;
+
+    for (size_t i = task->first; i < task->first + task->count; ++i) {
+        batch_line_t *ln = &b->lines[i];
+        if (ln->code_len == 0) continue;
+
+        bytecode_t bc;
+        bc_init(&bc);
+        bc.code = b->code + ln->code;
+        bc.len = ln->code_len;
+        bc.max_depth = ln->max_depth;
+        bc.memo_slots = ln->memo_slots;
+        ln->value = vm_exec_log(&bc, w->stack, &ln->err, &w->log);
+    }
+    task->def_len = w->log.len - task->def_start;
+
+    for (size_t s = 0; s < task->nsucc; ++s) {
+        size_t next = b->succs[task->succ + s];
+        if (__atomic_sub_fetch(&b->tasks[next].pending, 1, __ATOMIC_ACQ_REL) == 0) push_task(w, next);
+    }
+
+    if (__atomic_sub_fetch(&b->remaining, 1, __ATOMIC_SEQ_CST) == 0) {
+        pthread_mutex_lock(&b->idle_lock);
+        pthread_cond_broadcast(&b->idle_cond);
+        pthread_mutex_unlock(&b->idle_lock);
+    }
+}
+
+/// Work on the current chunk: own queue first, then steal, then sleep,
+/// until every task of the chunk is done
+static void work_chunk(worker_t *w)
+{
+    batch_run_t *b = w->run;
+    size_t t;
+    for (;;) {
+        if (pop_task(w, &t) || steal_task(w, &t)) {
+            run_task(w, t);
+        } else if (__atomic_load_n(&b->remaining, __ATOMIC_SEQ_CST) == 0) {
+            break;
+        } else {
+            wait_for_work(b);
+        }
+    }
+}
+
+/// Pool thread: work on each chunk as it is handed out, until the
+/// pool closes
+static void *worker_main(void *arg)
+{
+    worker_t *w = arg;
+    batch_run_t *b = w->run;
+    size_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&b->idle_lock);
+        while (b->generation == seen && !b->closing) pthread_cond_wait(&b->start_cond, &b->idle_lock);
+        if (b->closing) {
+            pthread_mutex_unlock(&b->idle_lock);
+            break;
+        }
+        seen = b->generation;
+        pthread_mutex_unlock(&b->idle_lock);
+
+        work_chunk(w);
+
+        pthread_mutex_lock(&b->idle_lock);
+        if (--b->busy == 0) pthread_cond_signal(&b->done_cond);
+        pthread_mutex_unlock(&b->idle_lock);
+    }
+    return NULL;
+}
+
+/// Start the pool threads; the calling thread is worker 0
+static void start_pool(batch_run_t *b)
+{
+    for (size_t i = 1; i < b->nworkers; ++i) {
+        if (pthread_create(&b->workers[i].thread, NULL, worker_main, &b->workers[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/// Stop the pool threads and wait for them to exit
+static void stop_pool(batch_run_t *b)
+{
+    pthread_mutex_lock(&b->idle_lock);
+    b->closing = 1;
+    pthread_cond_broadcast(&b->start_cond);
+    pthread_mutex_unlock(&b->idle_lock);
+    for (size_t i = 1; i < b->nworkers; ++i) pthread_join(b->workers[i].thread, NULL);
+}
+
+/// Run every task of the chunk on the pool, with the calling thread
+/// as worker 0, and wait until every worker has left the chunk, so its
+/// storage can be reused
+static void run_tasks(batch_run_t *b)
+{
+    b->remaining = b->ntasks;
+    b->ready = 0;
+    b->sleepers = 0;
+
+    for (size_t i = 0; i < b->nworkers; ++i) {
+        worker_t *w = &b->workers[i];
+        w->deque = reserve_work(w->deque, &w->deque_cap, b->ntasks, sizeof(size_t));
+        w->stack = reserve_work(w->stack, &w->stack_cap, b->stack_need, sizeof(int));
+        w->top = 0;
+        w->bottom = 0;
+        w->log.len = 0;
+    }
+
+    /* deal the tasks that wait for nothing round-robin */
+    size_t next = 0;
+    for (size_t t = 0; t < b->ntasks; ++t) {
+        if (b->tasks[t].pending == 0) {
+            worker_t *w = &b->workers[next++ % b->nworkers];
+            w->deque[w->bottom++] = t;
+            b->ready++;
+        }
+    }
+
+    pthread_mutex_lock(&b->idle_lock);
+    b->busy = b->nworkers - 1;
+    b->generation++;
+    pthread_cond_broadcast(&b->start_cond);
+    pthread_mutex_unlock(&b->idle_lock);
+
+    work_chunk(&b->workers[0]);
+
+    pthread_mutex_lock(&b->idle_lock);
+    while (b->busy > 0) pthread_cond_wait(&b->done_cond, &b->idle_lock);
+    pthread_mutex_unlock(&b->idle_lock);
+}
+
+/// Print the chunk's output in input order and link the symbols it
+/// defined into the table in the order they were first assigned
+static void write_chunk(interp_ctx_t *ctx)
+{
+    batch_run_t *b = ctx->batch;
+    outbuf_t *out = ctx_output(ctx);
+
+    for (size_t t = 0; t < b->ntasks; ++t) {
+        batch_task_t *task = &b->tasks[t];
+        for (size_t i = task->first; i < task->first + task->count; ++i) {
+            batch_line_t *ln = &b->lines[i];
+            if (ln->err_end > ln->err_start)
+                fwrite(b->err_text.buf + ln->err_start, 1, ln->err_end - ln->err_start, stderr);
+            if (!ln->root) continue;
+
+            print_infix_r(ctx, ln->root);
+            if (ln->err == EVAL_NONE) {
+                ob_write(out, " = ", 3);
+                ob_int(out, ln->value);
+            }
+            ob_putc(out, '\n');
+
+            const char *msg = eval_error_message(ln->err);
+            if (msg) fprintf(stderr, "%s\n", msg);
+        }
+
+        define_log_t *log = &b->workers[task->worker].log;
+        for (size_t d = 0; d < task->def_len; ++d) attach_symbol_r(ctx, log->syms[task->def_start + d]);
+    }
+}
+
+/// Run a script on the worker pool, one chunk of lines at a time
+void run_parallel(interp_ctx_t *ctx, char *text, size_t size, size_t max_line, size_t threads)
+{
+    batch_run_t *b = alloc_or_die(sizeof(batch_run_t), "calloc batch run");
+    ctx->batch = b;
+
+    b->nworkers = threads ? threads : 1;
+    b->workers = alloc_or_die(b->nworkers * sizeof(worker_t), "calloc workers");
+    for (size_t i = 0; i < b->nworkers; ++i) {
+        b->workers[i].id = i;
+        b->workers[i].run = b;
+        pthread_mutex_init(&b->workers[i].lock, NULL);
+    }
+    pthread_mutex_init(&b->idle_lock, NULL);
+    pthread_cond_init(&b->idle_cond, NULL);
+    pthread_cond_init(&b->start_cond, NULL);
+    pthread_cond_init(&b->done_cond, NULL);
+    bc_init(&b->scratch);
+    ob_init_heap(&b->err_text);
+    start_pool(b);
+
+    char *p = text;
+    char *end = text + size;
+    while (p < end) {
+        b->nlines = 0;
+        b->code_len = 0;
+        b->stack_need = 0;
+        b->err_text.len = 0;
+
+        outbuf_t *error_out = ctx->error_out;
+        set_error_output_r(ctx, &b->err_text);
+        read_chunk(ctx, &p, end, max_line);
+        set_error_output_r(ctx, error_out);
+
+        build_graph(b);
+        run_tasks(b);
+        write_chunk(ctx);
+        release_trees_r(ctx);
+    }
+    stop_pool(b);
+
+    for (size_t i = 0; i < b->nworkers; ++i) {
+        pthread_mutex_destroy(&b->workers[i].lock);
+        free(b->workers[i].deque);
+        free(b->workers[i].stack);
+        free(b->workers[i].log.syms);
+    }
+    free(b->workers);
+    pthread_mutex_destroy(&b->idle_lock);
+    pthread_cond_destroy(&b->idle_cond);
+    pthread_cond_destroy(&b->start_cond);
+    pthread_cond_destroy(&b->done_cond);
+
+    bc_free(&b->scratch);
+    ob_free(&b->err_text);
+    free(b->lines);
+    free(b->tasks);
+    free(b->edges);
+    free(b->succs);
+    free(b->code);
+    free(b->sym_map);
+    free(b->readers);
+    free(b);
+    ctx->batch = NULL;
+}
@@ -0,0 +1,27 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include "symtab.h"
+
+#define BATCH_CHUNK 16384           // lines parsed and scheduled together
+#define BATCH_GROUP 32              // consecutive lines run as one task
+
+/// Runs a script held in memory on a pool of threads.  The lines are
+/// parsed and compiled in order, grouped into tasks, and each task
+/// waits only for the earlier tasks that write a symbol it uses or use
+/// a symbol it writes.  Independent tasks run in parallel on workers
+/// that steal from each other's queues.  All output, and the final
+/// symbol table, is exactly what rep_n_r() on each line in order gives.
+/// The scheduler's storage belongs to the context for the length of
+/// the call, so calls on different contexts may run at the same time.
+/// @param ctx  the context the script runs in
+/// @param text  the script
+/// @param size  its length in bytes
+/// @param max_line  longest accepted line (0 = no limit)
+/// @param threads  number of worker threads (at least 1)
+void run_parallel(interp_ctx_t *ctx, char *text, size_t size, size_t max_line, size_t threads);
+
+#endif
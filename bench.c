@@ -0,0 +1,510 @@
+// bench.c
+// Synthetic benchmark: generates a deterministic script of random
+// postfix expressions, times each phase of the interpreter on it line
+// by line, then times whole runs through the REPL and batch paths.
+// Results are written as CSV or JSON for comparing revisions.
+// @author: Munkh-Orgil Jargalsaikhan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "parser.h"
+#include "symtab.h"
+#include "stack.h"
+#include "bytecode.h"
+#include "batch.h"
+#include "line_reader.h"
+#include "outbuf.h"
+#include "interp_ctx.h"
+#include "util.h"
+
+/// Shape of the generated script
+typedef struct bench_config_s {
+    size_t lines;               ///< expressions in the script
+    size_t tokens;              ///< target tokens per expression
+    size_t depth;               ///< deepest tree allowed
+    const char *ops;            ///< operator mix; repeats weight an operator
+    size_t ternary;             ///< percent of interior nodes that are ?:
+    size_t symbols;             ///< distinct names the expressions use
+    size_t table;               ///< names defined in the symbol table
+    size_t seed;                ///< generator seed
+    size_t jobs;                ///< threads for the parallel batch run
+    int json;                   ///< JSON instead of CSV
+    const char *label;          ///< tag for the revision being measured
+} bench_config_t;
+
+/// Timing of one phase
+typedef struct bench_result_s {
+    const char *phase;
+    size_t lines;
+    size_t tokens;
+    double seconds;
+    uint64_t *samples;          ///< per-line latency in ns, or NULL
+} bench_result_t;
+
+#define PHASES 6                // tokenize, parse, bind, print_infix, eval_tree, vm
+#define RUNS 3                  // repl, batch, parallel
+
+/* ---- the generator ---- */
+
+/// xorshift64* state; the same seed always gives the same script
+static uint64_t rng_state;
+
+/// Next pseudo-random number
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+/// Pseudo-random number in [0, n)
+static size_t rng_below(size_t n)
+{
+    return n ? (size_t)(rng_next() % n) : 0;
+}
+
+/// Append text to the script
+static void put_token(outbuf_t *ob, const char *text)
+{
+    if (ob->len > 0 && ob->buf[ob->len - 1] != '\n') ob_putc(ob, ' ');
+    ob_puts(ob, text);
+}
+
+/// Append a leaf: a symbol or a nonzero literal
+static void gen_leaf(outbuf_t *ob, const bench_config_t *cfg)
+{
+    char text[32];
+    if (cfg->symbols && rng_below(2))
+        snprintf(text, sizeof text, "v%zu", rng_below(cfg->symbols));
+    else
+        snprintf(text, sizeof text, "%zu", 1 + rng_below(99));
+    put_token(ob, text);
+}
+
+/// Append a random subexpression of about the given number of tokens
+/// @param depth levels left before only leaves are allowed
+static void gen_expr(outbuf_t *ob, const bench_config_t *cfg, size_t tokens, size_t depth)
+{
+    if (tokens < 3 || depth == 0) {
+        gen_leaf(ob, cfg);
+        return;
+    }
+
+    if (tokens >= 4 && rng_below(100) < cfg->ternary) {
+        size_t rest = tokens - 1;
+        size_t test = 1 + rng_below(rest / 3);
+        size_t yes = (rest - test) / 2;
+        gen_expr(ob, cfg, test, depth - 1);
+        gen_expr(ob, cfg, yes, depth - 1);
+        gen_expr(ob, cfg, rest - test - yes, depth - 1);
+        put_token(ob, "?");
+        return;
+    }
+
+    char op[2] = { cfg->ops[rng_below(strlen(cfg->ops))], '\0' };
+    if (op[0] == '=') {
+        char target[32];
+        snprintf(target, sizeof target, "v%zu", rng_below(cfg->symbols ? cfg->symbols : 1));
+        put_token(ob, target);
+        gen_expr(ob, cfg, tokens - 2, depth - 1);
+    } else {
+        size_t left = 1 + rng_below(tokens - 2);
+        gen_expr(ob, cfg, left, depth - 1);
+        gen_expr(ob, cfg, tokens - 1 - left, depth - 1);
+    }
+    put_token(ob, op);
+}
+
+/// Generate the script, one expression per line
+static void gen_script(outbuf_t *ob, const bench_config_t *cfg)
+{
+    rng_state = cfg->seed * 0x9E3779B97F4A7C15ull + 1;
+    if (rng_state == 0) rng_state = 1;
+    for (size_t i = 0; i < cfg->lines; ++i) {
+        gen_expr(ob, cfg, cfg->tokens, cfg->depth);
+        ob_putc(ob, '\n');
+    }
+}
+
+/// Define the first cfg->table names in a context
+static void fill_table(interp_ctx_t *ctx, const bench_config_t *cfg)
+{
+    char name[32];
+    for (size_t i = 0; i < cfg->table; ++i) {
+        snprintf(name, sizeof name, "v%zu", i);
+        create_symbol_r(ctx, name, (int)(1 + i % 97));
+    }
+}
+
+/* ---- timing ---- */
+
+/// Monotonic time in nanoseconds
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/// Next line of the script
+/// @return the line, or NULL after the last one
+static char *next_line(char **cursor, char *end, size_t *len)
+{
+    char *p = *cursor;
+    if (p >= end) return NULL;
+    char *nl = memchr(p, '\n', (size_t)(end - p));
+    char *eol = nl ? nl : end;
+    *len = (size_t)(eol - p);
+    *cursor = nl ? nl + 1 : end;
+    return p;
+}
+
+/// Token delimiters, as the parser has them
+static int is_delim(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/// Slice a line into tokens and push them, as make_parse_tree() does
+/// @return the number of tokens
+static size_t tokenize(stack_t *stk, char *line, size_t len)
+{
+    size_t n = 0;
+    char *p = line;
+    char *end = line + len;
+    for (;;) {
+        while (p < end && is_delim(*p)) p++;
+        if (p == end) break;
+        token_t tok;
+        tok.str = p;
+        while (p < end && !is_delim(*p)) p++;
+        tok.len = (size_t)(p - tok.str);
+        push(stk, tok);
+        n++;
+    }
+    return n;
+}
+
+/// Time every phase of every line separately
+static void bench_phases(char *text, size_t size, const bench_config_t *cfg, bench_result_t *res)
+{
+    static const char *const names[PHASES] = {
+        "tokenize", "parse", "bind", "print_infix", "eval_tree", "vm"
+    };
+    for (int k = 0; k < PHASES; ++k) {
+        res[k].phase = names[k];
+        res[k].lines = cfg->lines;
+        res[k].tokens = 0;
+        res[k].seconds = 0;
+        res[k].samples = alloc_or_die(cfg->lines * sizeof(uint64_t), "calloc samples");
+    }
+
+    interp_ctx_t ctx;
+    ctx_init(&ctx);
+    fill_table(&ctx, cfg);
+    outbuf_t sink;
+    ob_init_heap(&sink);
+    set_output_r(&ctx, &sink);
+
+    bytecode_t bc;
+    bc_init(&bc);
+    int *vm_stack = NULL;
+    size_t vm_stack_cap = 0;
+    stack_t *stk = make_stack();
+
+    char *cursor = text;
+    char *line;
+    size_t len;
+    for (size_t i = 0; (line = next_line(&cursor, text + size, &len)) != NULL; ++i) {
+        uint64_t t[PHASES + 1];
+        t[0] = now_ns();
+        size_t ntokens = tokenize(stk, line, len);
+        t[1] = now_ns();
+        tree_node_t *root = parse_r(&ctx, stk);
+        t[2] = now_ns();
+        reset_stack(stk);
+        if (!root) {
+            release_trees_r(&ctx);
+            continue;
+        }
+        bind_tree_r(&ctx, root);
+        t[3] = now_ns();
+        sink.len = 0;
+        print_infix_r(&ctx, root);
+        t[4] = now_ns();
+        eval_tree_r(&ctx, root);
+        t[5] = now_ns();
+        compile_expr_r(&ctx, &bc, root);
+        if (vm_stack_size(&bc) > vm_stack_cap) {
+            vm_stack_cap = vm_stack_size(&bc);
+            free(vm_stack);
+            vm_stack = alloc_or_die(vm_stack_cap * sizeof(int), "calloc vm stack");
+        }
+        eval_error_t err;
+        vm_exec(&ctx, &bc, vm_stack, &err);
+        t[6] = now_ns();
+        release_trees_r(&ctx);
+
+        for (int k = 0; k < PHASES; ++k) {
+            res[k].samples[i] = t[k + 1] - t[k];
+            res[k].seconds += (double)(t[k + 1] - t[k]) * 1e-9;
+            res[k].tokens += ntokens;
+        }
+    }
+
+    free_stack(stk);
+    free(vm_stack);
+    bc_free(&bc);
+    ob_free(&sink);
+    ctx_free(&ctx);
+}
+
+/// Time whole runs of the script through the REPL and batch paths
+/// @param tokens tokens in the whole script
+static void bench_runs(char *text, size_t size, const bench_config_t *cfg, size_t tokens,
+                       bench_result_t *res)
+{
+    static const char *const names[RUNS] = { "repl", "batch", "parallel" };
+    for (int k = 0; k < RUNS; ++k) {
+        interp_ctx_t ctx;
+        ctx_init(&ctx);
+        fill_table(&ctx, cfg);
+        outbuf_t sink;
+        ob_init_heap(&sink);
+        set_output_r(&ctx, &sink);
+
+        uint64_t start = now_ns();
+        if (k == 0) {
+            // read line by line from a stream, as the interactive loop does
+            FILE *in = fmemopen(text, size, "r");
+            if (!in) {
+                perror("fmemopen");
+                exit(EXIT_FAILURE);
+            }
+            line_reader_t reader;
+            reader_init(&reader, in, 0);
+            char *line;
+            size_t len;
+            while (read_line(&reader, &line, &len) == LINE_OK) {
+                size_t n;
+                char *expr = clean_line(line, len, &n);
+                if (n > 0) rep_n_r(&ctx, expr, n);
+                if (sink.len > OUTBUF_SIZE) sink.len = 0;
+            }
+            reader_free(&reader);
+            fclose(in);
+        } else if (k == 1) {
+            // split the text in place, as -f does with one job
+            char *cursor = text;
+            char *line;
+            size_t len;
+            while ((line = next_line(&cursor, text + size, &len)) != NULL) {
+                size_t n;
+                char *expr = clean_line(line, len, &n);
+                if (n > 0) rep_n_r(&ctx, expr, n);
+                if (sink.len > OUTBUF_SIZE) sink.len = 0;
+            }
+        } else {
+            run_parallel(&ctx, text, size, 0, cfg->jobs);
+        }
+        uint64_t stop = now_ns();
+
+        res[k].phase = names[k];
+        res[k].lines = cfg->lines;
+        res[k].tokens = tokens;
+        res[k].seconds = (double)(stop - start) * 1e-9;
+        res[k].samples = NULL;
+        ob_free(&sink);
+        ctx_free(&ctx);
+    }
+}
+
+/* ---- the report ---- */
+
+/// Compare two latencies for qsort()
+static int cmp_ns(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/// Latency percentile of sorted samples
+static uint64_t percentile(const uint64_t *sorted, size_t n, double pct)
+{
+    if (n == 0) return 0;
+    size_t i = (size_t)(pct / 100.0 * (double)(n - 1) + 0.5);
+    return sorted[i < n ? i : n - 1];
+}
+
+/// Write one result as a CSV row or a JSON object
+static void report(FILE *out, const bench_config_t *cfg, bench_result_t *r, int last)
+{
+    double secs = r->seconds > 0 ? r->seconds : 1e-9;
+    double lps = (double)r->lines / secs;
+    uint64_t p50 = 0, p90 = 0, p99 = 0, max = 0;
+    if (r->samples) {
+        qsort(r->samples, r->lines, sizeof(uint64_t), cmp_ns);
+        p50 = percentile(r->samples, r->lines, 50);
+        p90 = percentile(r->samples, r->lines, 90);
+        p99 = percentile(r->samples, r->lines, 99);
+        max = r->lines ? r->samples[r->lines - 1] : 0;
+    }
+
+    double tps = (double)r->tokens / secs;
+
+    // end-to-end runs are timed as a whole and have no percentiles
+    if (!cfg->json) {
+        fprintf(out, "%s,%s,%zu,%zu,%.6f,%.0f,%.0f", cfg->label, r->phase, r->lines, r->tokens,
+                r->seconds, lps, tps);
+        if (r->samples)
+            fprintf(out, ",%llu,%llu,%llu,%llu\n", (unsigned long long)p50,
+                    (unsigned long long)p90, (unsigned long long)p99, (unsigned long long)max);
+        else
+            fprintf(out, ",,,,\n");
+        return;
+    }
+
+    fprintf(out, "    {\"phase\": \"%s\", \"lines\": %zu, \"tokens\": %zu, \"seconds\": %.6f, "
+            "\"lines_per_sec\": %.0f, \"tokens_per_sec\": %.0f", r->phase, r->lines, r->tokens,
+            r->seconds, lps, tps);
+    if (r->samples)
+        fprintf(out, ", \"p50_ns\": %llu, \"p90_ns\": %llu, \"p99_ns\": %llu, \"max_ns\": %llu",
+                (unsigned long long)p50, (unsigned long long)p90,
+                (unsigned long long)p99, (unsigned long long)max);
+    fprintf(out, "}%s\n", last ? "" : ",");
+}
+
+/// Print the usage message
+/// @return EXIT_FAILURE, for use as main's return value
+static int usage(void)
+{
+    fprintf(stderr, "Usage: interp_bench [--lines=N] [--tokens=N] [--depth=N] [--ops=CHARS] [--ternary=PCT]\n"
+                    "                    [--symbols=N] [--table=N] [--seed=N] [--jobs=N] [--format=csv|json]\n"
+                    "                    [--label=TEXT] [--script=FILE]\n");
+    return EXIT_FAILURE;
+}
+
+/// Parse the numeric value of a --name=N option
+/// @return 1 if arg is this option with a valid number, 0 otherwise
+static int size_option(const char *arg, const char *prefix, size_t *value)
+{
+    size_t plen = strlen(prefix);
+    if (strncmp(arg, prefix, plen) != 0) return 0;
+
+    const char *digits = arg + plen;
+    if (!isdigit((unsigned char)*digits)) return 0;
+    char *end;
+    unsigned long long v = strtoull(digits, &end, 10);
+    if (*end != '\0' || v > (size_t)-1) return 0;
+    *value = (size_t)v;
+    return 1;
+}
+
+/// Benchmark entry point
+/// @param argv options describing the script:
+///     --lines=N      expressions in the script (20000)
+///     --tokens=N     target tokens per expression (15)
+///     --depth=N      deepest tree allowed (8)
+///     --ops=CHARS    operators to draw from, repeats weighting them (+-*/%)
+///     --ternary=PCT  percent of interior nodes that are ternaries (10)
+///     --symbols=N    distinct names used by the expressions (64)
+///     --table=N      names defined in the symbol table (1024)
+///     --seed=N       generator seed (1)
+///     --jobs=N       threads for the parallel run (0 = one per CPU)
+///     --format=F     csv (default) or json
+///     --label=TEXT   tag written with every result, e.g. a revision
+///     --script=FILE  also save the generated script to FILE
+/// @return EXIT_SUCCESS, or EXIT_FAILURE on a usage error
+int main(int argc, char **argv)
+{
+    bench_config_t cfg = { 20000, 15, 8, "+-*/%", 10, 64, 1024, 1, 0, 0, "" };
+    const char *script = NULL;
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        if (size_option(a, "--lines=", &cfg.lines) || size_option(a, "--tokens=", &cfg.tokens)
+            || size_option(a, "--depth=", &cfg.depth) || size_option(a, "--ternary=", &cfg.ternary)
+            || size_option(a, "--symbols=", &cfg.symbols) || size_option(a, "--table=", &cfg.table)
+            || size_option(a, "--seed=", &cfg.seed) || size_option(a, "--jobs=", &cfg.jobs)) {
+            continue;
+        } else if (strncmp(a, "--ops=", 6) == 0 && a[6] && strspn(a + 6, "+-*/%=") == strlen(a + 6)) {
+            cfg.ops = a + 6;
+        } else if (strcmp(a, "--format=csv") == 0) {
+            cfg.json = 0;
+        } else if (strcmp(a, "--format=json") == 0) {
+            cfg.json = 1;
+        } else if (strncmp(a, "--label=", 8) == 0) {
+            cfg.label = a + 8;
+        } else if (strncmp(a, "--script=", 9) == 0 && a[9]) {
+            script = a + 9;
+        } else {
+            return usage();
+        }
+    }
+    if (cfg.ternary > 100 || cfg.lines == 0) return usage();
+    if (cfg.jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        cfg.jobs = cpus > 0 ? (size_t)cpus : 1;
+    }
+
+    outbuf_t text;
+    ob_init_heap(&text);
+    gen_script(&text, &cfg);
+    if (script) {
+        FILE *f = fopen(script, "w");
+        if (!f || fwrite(text.buf, 1, text.len, f) != text.len || fclose(f) != 0) {
+            perror(script);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* evaluation errors are part of the workload; keep them off the report */
+    fflush(stderr);
+    int saved_err = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+
+    bench_result_t res[PHASES + RUNS];
+    bench_phases(text.buf, text.len, &cfg, res);
+    bench_runs(text.buf, text.len, &cfg, res[0].tokens, res + PHASES);
+
+    fflush(stderr);
+    if (saved_err >= 0) {
+        dup2(saved_err, STDERR_FILENO);
+        close(saved_err);
+    }
+
+    FILE *out = stdout;
+    if (cfg.json) {
+        fprintf(out, "{\n  \"label\": \"%s\",\n", cfg.label);
+        fprintf(out, "  \"config\": {\"lines\": %zu, \"tokens\": %zu, \"depth\": %zu, \"ops\": \"%s\", "
+                "\"ternary\": %zu, \"symbols\": %zu, \"table\": %zu, \"seed\": %zu, \"jobs\": %zu},\n",
+                cfg.lines, cfg.tokens, cfg.depth, cfg.ops, cfg.ternary, cfg.symbols,
+                cfg.table, cfg.seed, cfg.jobs);
+        fprintf(out, "  \"phases\": [\n");
+    } else {
+        fprintf(out, "label,phase,lines,tokens,seconds,lines_per_sec,tokens_per_sec,"
+                     "p50_ns,p90_ns,p99_ns,max_ns\n");
+    }
+    for (int k = 0; k < PHASES + RUNS; ++k) {
+        report(out, &cfg, &res[k], k == PHASES + RUNS - 1);
+        free(res[k].samples);
+    }
+    if (cfg.json) fprintf(out, "  ]\n}\n");
+
+    ob_free(&text);
+    return EXIT_SUCCESS;
+}
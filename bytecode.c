@@ -0,0 +1,428 @@
+// bytecode.c
+// Compiler from parse trees to a flat instruction array, and the VM
+// that runs it.  Build with -DVM_COMPUTED_GOTO to dispatch through a
+// label table (GCC/Clang) instead of a switch.
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bytecode.h"
+#include "symtab.h"
+
+/// One pending node of the iterative compiler
+typedef struct compile_frame_s {
+    tree_node_t *node;          ///< subtree being compiled
+    int state;                  ///< how many of its children are done
+    size_t depth;               ///< stack depth before the subtree runs
+    size_t patch;               ///< jump waiting for its target
+    int branch;                 ///< inside a ternary branch (may not run)
+    int slot;                   ///< memo slot being filled, or -1
+    int bare;                   ///< compile the node itself, not its memo
+} compile_frame_t;
+
+/// Initialize an empty program
+void bc_init(bytecode_t *bc)
+{
+    bc->code = NULL;
+    bc->len = 0;
+    bc->cap = 0;
+    bc->max_depth = 0;
+    bc->memo_slots = 0;
+    bc->work = NULL;
+    bc->work_cap = 0;
+    bc->memo_done = NULL;
+    bc->memo_done_cap = 0;
+}
+
+/// Free the instruction array and the compiler's scratch storage
+void bc_free(bytecode_t *bc)
+{
+    free(bc->code);
+    free(bc->work);
+    free(bc->memo_done);
+    bc_init(bc);
+}
+
+/// Stack room for the operands and the memo slots (value and flag)
+size_t vm_stack_size(const bytecode_t *bc)
+{
+    return bc->max_depth + 1 + 2 * bc->memo_slots;
+}
+
+/// Append an instruction, growing the array when needed
+/// @return index of the new instruction
+static size_t emit(bytecode_t *bc, vm_op_t op)
+{
+    if (bc->len == bc->cap) {
+        size_t cap = bc->cap ? bc->cap * 2 : 64;
+        vm_insn_t *code = realloc(bc->code, cap * sizeof(vm_insn_t));
+        if (!code) {
+            perror("realloc bytecode");
+            exit(EXIT_FAILURE);
+        }
+        bc->code = code;
+        bc->cap = cap;
+    }
+    bc->code[bc->len].op = op;
+    bc->code[bc->len].slot = 0;
+    bc->code[bc->len].arg.target = 0;
+    return bc->len++;
+}
+
+/// Append an instruction with a constant argument
+static void emit_imm(bytecode_t *bc, vm_op_t op, int imm)
+{
+    size_t at = emit(bc, op);
+    bc->code[at].arg.imm = imm;
+}
+
+/// Record that the stack reaches the given depth
+static void note_depth(bytecode_t *bc, size_t depth)
+{
+    if (depth > bc->max_depth) bc->max_depth = depth;
+}
+
+/// Append a VM_LOAD or VM_STORE of a SYMBOL leaf's slot
+/// The compiler has no symbol table of its own, so a leaf that
+/// bind_tree() never saw cannot be resolved and fails when run
+static void emit_symbol(bytecode_t *bc, vm_op_t op, tree_node_t *node)
+{
+    symbol_t *sym = ((leaf_node_t *)node->node)->sym;
+    if (!sym) {
+        emit_imm(bc, VM_FAIL, UNDEFINED_SYMBOL);
+        return;
+    }
+    size_t at = emit(bc, op);
+    bc->code[at].arg.sym = sym;
+}
+
+/// Push a subtree onto the compiler's work stack
+/// @param branch whether the subtree is inside a ternary branch
+/// @return the new stack size
+static size_t push_work(bytecode_t *bc, size_t sp, tree_node_t *node, size_t depth, int branch)
+{
+    if (sp == bc->work_cap) {
+        size_t cap = bc->work_cap ? bc->work_cap * 2 : 64;
+        compile_frame_t *grown = realloc(bc->work, cap * sizeof(compile_frame_t));
+        if (!grown) {
+            perror("realloc compile stack");
+            exit(EXIT_FAILURE);
+        }
+        bc->work = grown;
+        bc->work_cap = cap;
+    }
+    bc->work[sp].node = node;
+    bc->work[sp].state = 0;
+    bc->work[sp].depth = depth;
+    bc->work[sp].patch = 0;
+    bc->work[sp].branch = branch;
+    bc->work[sp].slot = -1;
+    bc->work[sp].bare = 0;
+    return sp + 1;
+}
+
+/// Compile a tree, reusing the program's storage
+void compile_tree(bytecode_t *bc, tree_node_t *root)
+{
+    compile_dag(bc, root, NULL);
+}
+
+/// Compile a DAG, reusing the program's storage
+/// Works from an explicit stack of frames; each finished subtree leaves
+/// its value on top of the VM stack, one deeper than its frame's depth.
+/// A shared node gets a frame that wraps the node's own code in
+/// VM_MEMO ... VM_SAVE, unless an unconditional copy already saved it
+void compile_dag(bytecode_t *bc, tree_node_t *root, const cse_t *cse)
+{
+    bc->len = 0;
+    bc->max_depth = 0;
+    bc->memo_slots = cse ? cse->len : 0;
+    if (bc->memo_slots > bc->memo_done_cap) {
+        unsigned char *done = realloc(bc->memo_done, bc->memo_slots);
+        if (!done) {
+            perror("realloc memo flags");
+            exit(EXIT_FAILURE);
+        }
+        bc->memo_done = done;
+        bc->memo_done_cap = bc->memo_slots;
+    }
+    if (bc->memo_slots) memset(bc->memo_done, 0, bc->memo_slots);
+
+    size_t sp = push_work(bc, 0, root, 0, 0);
+    while (sp > 0) {
+        compile_frame_t *f = &bc->work[sp - 1];
+        tree_node_t *node = f->node;
+        size_t depth = f->depth;
+
+        if (f->slot >= 0) {
+            /* the shared node's code is done; its value is on top */
+            size_t at = emit(bc, VM_SAVE);
+            bc->code[at].slot = f->slot;
+            bc->code[f->patch].arg.target = bc->len;
+            if (!f->branch) bc->memo_done[f->slot] = 1;
+            sp--;
+            continue;
+        }
+
+        if (f->state == 0) note_depth(bc, depth + 1);
+
+        if (cse && !f->bare && node && node->type == INTERIOR) {
+            int slot = cse_slot(cse, node);
+            if (slot >= 0 && bc->memo_done[slot]) {
+                size_t at = emit(bc, VM_RECALL);
+                bc->code[at].slot = slot;
+                sp--;
+                continue;
+            }
+            if (slot >= 0) {
+                f->slot = slot;
+                f->patch = emit(bc, VM_MEMO);
+                bc->code[f->patch].slot = slot;
+                int branch = f->branch;
+                sp = push_work(bc, sp, node, depth, branch);
+                bc->work[sp - 1].bare = 1;
+                continue;
+            }
+        }
+
+        if (!node) {
+            emit_imm(bc, VM_FAIL, UNKNOWN_OPERATION);
+            sp--;
+            continue;
+        }
+
+        if (node->type == LEAF) {
+            leaf_node_t *ln = (leaf_node_t *)node->node;
+            if (ln->exp_type == INTEGER) {
+                emit_imm(bc, VM_PUSH, ln->value);
+            } else {
+                emit_symbol(bc, VM_LOAD, node);
+            }
+            sp--;
+            continue;
+        }
+
+        interior_node_t *in = (interior_node_t *)node->node;
+
+        if (in->op == ASSIGN_OP) {
+            if (f->state == 0) {
+                if (in->left->type != LEAF || ((leaf_node_t *)in->left->node)->exp_type != SYMBOL) {
+                    emit_imm(bc, VM_FAIL, INVALID_LVALUE);
+                    sp--;
+                    continue;
+                }
+                f->state = 1;
+                sp = push_work(bc, sp, in->right, depth, f->branch);
+            } else {
+                emit_symbol(bc, VM_STORE, in->left);
+                sp--;
+            }
+            continue;
+        }
+
+        if (in->op == Q_OP) {
+            interior_node_t *alt = (interior_node_t *)in->right->node;
+            switch (f->state++) {
+                case 0:
+                    sp = push_work(bc, sp, in->left, depth, f->branch);
+                    break;
+                case 1:
+                    f->patch = emit(bc, VM_JZ);
+                    sp = push_work(bc, sp, alt->left, depth, 1);
+                    break;
+                case 2: {
+                    size_t jmp = emit(bc, VM_JMP);
+                    bc->code[f->patch].arg.target = bc->len;
+                    f->patch = jmp;
+                    sp = push_work(bc, sp, alt->right, depth, 1);
+                    break;
+                }
+                default:
+                    bc->code[f->patch].arg.target = bc->len;
+                    sp--;
+                    break;
+            }
+            continue;
+        }
+
+        if (f->state == 0) {
+            f->state = 1;
+            sp = push_work(bc, sp, in->left, depth, f->branch);
+            continue;
+        }
+        if (f->state == 1) {
+            f->state = 2;
+            sp = push_work(bc, sp, in->right, depth + 1, f->branch);
+            continue;
+        }
+
+        switch (in->op) {
+            case ADD_OP: emit(bc, VM_ADD); break;
+            case SUB_OP: emit(bc, VM_SUB); break;
+            case MUL_OP: emit(bc, VM_MUL); break;
+            case DIV_OP: emit(bc, VM_DIV); break;
+            case MOD_OP: emit(bc, VM_MOD); break;
+            default: emit_imm(bc, VM_FAIL, UNKNOWN_OPERATION); break;
+        }
+        sp--;
+    }
+
+    emit(bc, VM_HALT);
+}
+
+#ifdef VM_COMPUTED_GOTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"   // labels as values are a GNU extension
+#define VM_CASE(op)  lbl_##op:
+#define VM_NEXT()    goto *dispatch[pc->op]
+#else
+#define VM_CASE(op)  case op:
+#define VM_NEXT()    continue
+#endif
+
+/// Give a symbol its first value and record it instead of linking it
+static void log_define(define_log_t *log, symbol_t *sym, int val)
+{
+    if (log->len == log->cap) {
+        size_t cap = log->cap ? log->cap * 2 : 64;
+        symbol_t **syms = realloc(log->syms, cap * sizeof(symbol_t *));
+        if (!syms) {
+            perror("realloc define log");
+            exit(EXIT_FAILURE);
+        }
+        log->syms = syms;
+        log->cap = cap;
+    }
+    sym->val = val;
+    sym->defined = 1;
+    sym->changed = 1;
+    log->syms[log->len++] = sym;
+}
+
+/// Run a program
+/// The top of stack lives in acc; sp points one past the last spilled
+/// value, and the slot under the first value absorbs one dummy spill.
+/// With a log, first definitions are recorded rather than linked into
+/// the table of ctx
+static int vm_run(interp_ctx_t *ctx, const bytecode_t *bc, int *stack,
+                  eval_error_t *err, define_log_t *log)
+{
+    const vm_insn_t *pc = bc->code;
+    int *sp = stack;
+    int acc = 0;
+    int r;
+    int *memo = stack + bc->max_depth + 1;      // memo values, then flags
+    int *memo_set = memo + bc->memo_slots;
+
+    for (size_t i = 0; i < bc->memo_slots; ++i) memo_set[i] = 0;
+
+#ifdef VM_COMPUTED_GOTO
+    static const void *const dispatch[] = {
+        &&lbl_VM_PUSH, &&lbl_VM_LOAD, &&lbl_VM_STORE,
+        &&lbl_VM_ADD, &&lbl_VM_SUB, &&lbl_VM_MUL, &&lbl_VM_DIV, &&lbl_VM_MOD,
+        &&lbl_VM_JZ, &&lbl_VM_JMP, &&lbl_VM_MEMO, &&lbl_VM_SAVE, &&lbl_VM_RECALL,
+        &&lbl_VM_FAIL, &&lbl_VM_HALT
+    };
+    VM_NEXT();
+#else
+    for (;;) {
+        switch (pc->op) {
+#endif
+        VM_CASE(VM_PUSH)
+            *sp++ = acc;
+            acc = pc->arg.imm;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_LOAD)
+            if (!pc->arg.sym->defined) { *err = UNDEFINED_SYMBOL; return 0; }
+            *sp++ = acc;
+            acc = pc->arg.sym->val;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_STORE)
+            if (pc->arg.sym->defined) {
+                pc->arg.sym->val = acc;
+                pc->arg.sym->changed = 1;
+            } else if (log) log_define(log, pc->arg.sym, acc);
+            else define_symbol_r(ctx, pc->arg.sym, acc);
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_ADD)
+            acc = *--sp + acc;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_SUB)
+            acc = *--sp - acc;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_MUL)
+            acc = *--sp * acc;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_DIV)
+            r = acc;
+            if (r == 0) { *err = DIVISION_BY_ZERO; return 0; }
+            acc = *--sp / r;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_MOD)
+            r = acc;
+            if (r == 0) { *err = INVALID_MODULUS; return 0; }
+            acc = *--sp % r;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_JZ)
+            r = acc;
+            acc = *--sp;
+            pc = r ? pc + 1 : bc->code + pc->arg.target;
+            VM_NEXT();
+        VM_CASE(VM_JMP)
+            pc = bc->code + pc->arg.target;
+            VM_NEXT();
+        VM_CASE(VM_MEMO)
+            if (memo_set[pc->slot]) {
+                *sp++ = acc;
+                acc = memo[pc->slot];
+                pc = bc->code + pc->arg.target;
+            } else {
+                pc++;
+            }
+            VM_NEXT();
+        VM_CASE(VM_SAVE)
+            memo[pc->slot] = acc;
+            memo_set[pc->slot] = 1;
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_RECALL)
+            *sp++ = acc;
+            acc = memo[pc->slot];
+            pc++;
+            VM_NEXT();
+        VM_CASE(VM_FAIL)
+            *err = (eval_error_t)pc->arg.imm;
+            return 0;
+        VM_CASE(VM_HALT)
+            *err = EVAL_NONE;
+            return acc;
+#ifndef VM_COMPUTED_GOTO
+        }
+    }
+#endif
+}
+
+#ifdef VM_COMPUTED_GOTO
+#pragma GCC diagnostic pop
+#endif
+
+/// Run a program, linking new symbols into the table
+int vm_exec(interp_ctx_t *ctx, const bytecode_t *bc, int *stack, eval_error_t *err)
+{
+    return vm_run(ctx, bc, stack, err, NULL);
+}
+
+/// Run a program, logging new symbols
+int vm_exec_log(const bytecode_t *bc, int *stack, eval_error_t *err, define_log_t *log)
+{
+    return vm_run(NULL, bc, stack, err, log);
+}
@@ -0,0 +1,117 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <stddef.h>
+#include "tree_node.h"
+#include "parser.h"
+#include "cse.h"
+
+// Instructions of the expression VM.  The top of the operand stack is
+// kept in a register (the accumulator); the rest lives in memory.
+typedef enum vm_op_e {
+    VM_PUSH,                    // push the constant arg.imm
+    VM_LOAD,                    // push the value of symbol arg.sym
+    VM_STORE,                   // assign the top value to arg.sym (kept)
+    VM_ADD,                     // pop r, pop l, push l + r
+    VM_SUB,                     // pop r, pop l, push l - r
+    VM_MUL,                     // pop r, pop l, push l * r
+    VM_DIV,                     // pop r, pop l, push l / r
+    VM_MOD,                     // pop r, pop l, push l % r
+    VM_JZ,                      // pop; jump to arg.target if it was 0
+    VM_JMP,                     // jump to arg.target
+    VM_MEMO,                    // if memo slot is set, push it and jump to arg.target
+    VM_SAVE,                    // set memo slot to the top value (kept)
+    VM_RECALL,                  // push memo slot (known to be set)
+    VM_FAIL,                    // raise the eval_error_t in arg.imm
+    VM_HALT                     // stop; the result is on top
+} vm_op_t;
+
+// One instruction
+typedef struct vm_insn_s {
+    vm_op_t op;                 // the operation
+    int slot;                   // memo slot (VM_MEMO, VM_SAVE, VM_RECALL)
+    union {
+        int imm;                // constant or error code
+        size_t target;          // jump destination (instruction index)
+        symbol_t *sym;          // bound symbol slot
+    } arg;
+} vm_insn_t;
+
+// A compiled expression
+typedef struct bytecode_s {
+    vm_insn_t *code;            // the instructions
+    size_t len;                 // number of instructions
+    size_t cap;                 // allocated instructions
+    size_t max_depth;           // deepest operand stack the code reaches
+    size_t memo_slots;          // values of shared subexpressions it keeps
+    struct compile_frame_s *work;   // scratch stack used by compile_tree()
+    size_t work_cap;            // allocated scratch frames
+    unsigned char *memo_done;   // scratch: slots already saved unconditionally
+    size_t memo_done_cap;
+} bytecode_t;
+
+// Symbols given their first value by vm_exec_log(), in the order it
+// defined them.  They are marked defined but not yet linked into the
+// table's dump list (see attach_symbol()).
+typedef struct define_log_s {
+    symbol_t **syms;            // the newly defined symbols
+    size_t len;                 // number of entries
+    size_t cap;                 // allocated entries
+} define_log_t;
+
+/// Initializes an empty program.
+/// @param bc  the program to initialize
+void bc_init(bytecode_t *bc);
+
+/// Releases the instruction array.
+/// @param bc  the program to free
+void bc_free(bytecode_t *bc);
+
+/// Compiles a bound parse tree into bc, replacing its old contents
+/// but keeping its storage.  Operands are evaluated in the same order
+/// as eval_tree(), and only the chosen branch of a ternary runs.  A
+/// SYMBOL leaf that was never bound compiles to UNDEFINED_SYMBOL.
+/// @param bc  the program to fill
+/// @param root  the root of the tree (bound by bind_tree())
+void compile_tree(bytecode_t *bc, tree_node_t *root);
+
+/// Compiles a DAG made by share_subtrees().  The first copy of a
+/// shared node to run saves its value in the node's memo slot and
+/// every later copy reuses it, so each shared subexpression is
+/// evaluated at most once per run.  A copy that follows a copy which
+/// always runs (one outside every ternary branch) just loads the slot.
+/// @param bc  the program to fill
+/// @param root  the root of the DAG
+/// @param cse  its shared nodes, or NULL to compile it as a tree
+void compile_dag(bytecode_t *bc, tree_node_t *root, const cse_t *cse);
+
+/// The number of ints the operand stack passed to vm_exec() needs:
+/// room for the deepest stack plus the memo slots.
+/// @param bc  the program
+/// @return the stack size in ints
+size_t vm_stack_size(const bytecode_t *bc);
+
+/// Runs a compiled program.
+/// @param ctx  the context whose table gets symbols assigned for the
+///     first time
+/// @param bc  the program
+/// @param stack  operand stack of at least vm_stack_size(bc) ints
+/// @param[out] err  EVAL_NONE, or the first error raised; it matches
+///     the error eval_tree() reports for the same tree
+/// @return the value of the expression (0 after an error)
+int vm_exec(interp_ctx_t *ctx, const bytecode_t *bc, int *stack, eval_error_t *err);
+
+/// Runs a compiled program like vm_exec(), except that a symbol
+/// assigned for the first time is appended to log instead of being
+/// linked into the symbol table.  Together with attach_symbol() this
+/// lets several threads run programs whose symbols do not overlap.
+/// @param bc  the program
+/// @param stack  operand stack of at least vm_stack_size(bc) ints
+/// @param[out] err  EVAL_NONE, or the first error raised
+/// @param log  receives the symbols defined by this run
+/// @return the value of the expression (0 after an error)
+int vm_exec_log(const bytecode_t *bc, int *stack, eval_error_t *err, define_log_t *log);
+
+#endif
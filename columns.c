@@ -0,0 +1,265 @@
+// columns.c
+// Column table for vectorized evaluation: every symbol holds one value
+// per row (scenario), stored as a contiguous int array
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include "columns.h"
+#include "line_reader.h"
+#include "outbuf.h"
+#include "interp_ctx.h"
+#include "util.h"
+
+/// Find the index slot for a name: either the slot holding the column
+/// with that name, or the empty slot where it would go
+/// @param name the name (need not be null-terminated)
+/// @param len length of the name
+/// @param hash hash_name(name, len)
+/// @return slot position in tab->index
+static size_t find_slot(const column_table_t *tab, const char *name, size_t len, unsigned int hash)
+{
+    size_t mask = tab->index_cap - 1;
+    size_t i = hash & mask;
+    while (tab->index[i] != NULL) {
+        column_t *col = tab->index[i];
+        if (col->hash == hash && col->name_len == len && memcmp(col->name, name, len) == 0)
+            break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/// Double the index (or create it) until it holds count columns at a
+/// load factor of 1/2, and re-insert every column
+/// @param count number of columns the index must hold
+static void grow_index(column_table_t *tab, size_t count)
+{
+    size_t old_cap = tab->index_cap;
+    column_t **old = tab->index;
+
+    tab->index_cap = old_cap ? old_cap * 2 : COLUMNS_MIN_CAP;
+    while (tab->index_cap < count * 2) tab->index_cap *= 2;
+    tab->index = alloc_or_die(tab->index_cap * sizeof(column_t *), "calloc column index");
+
+    size_t mask = tab->index_cap - 1;
+    for (size_t j = 0; j < old_cap; ++j) {
+        column_t *col = old[j];
+        if (!col) continue;
+        size_t i = col->hash & mask;
+        while (tab->index[i] != NULL) i = (i + 1) & mask;
+        tab->index[i] = col;
+    }
+    free(old);
+}
+
+/// Find a column in a table
+static column_t *find_column(const column_table_t *tab, const char *name, size_t len)
+{
+    if (!tab->count) return NULL;
+    return tab->index[find_slot(tab, name, len, hash_name(name, len))];
+}
+
+/// Append a column with room for every row, and index it
+/// The name must not have a column yet
+static column_t *new_column(column_table_t *tab, const char *name, size_t len)
+{
+    column_t *col = alloc_or_die(sizeof(column_t), "malloc column");
+    col->name = alloc_or_die(len + 1, "malloc column name");
+    memcpy(col->name, name, len);
+    col->name[len] = '\0';
+    col->name_len = len;
+    col->hash = hash_name(name, len);
+    col->values = alloc_or_die(tab->rows * sizeof(int), "malloc column values");
+    col->defined = NULL;
+    col->next = NULL;
+
+    if ((tab->count + 1) * 2 > tab->index_cap) grow_index(tab, tab->count + 1);
+    tab->index[find_slot(tab, name, len, col->hash)] = col;
+    tab->count++;
+
+    if (tab->tail) tab->tail->next = col;
+    else tab->head = col;
+    tab->tail = col;
+    return col;
+}
+
+/// Report a bad line and exit, as build_table() does
+static void malformed(FILE *f, line_reader_t *reader)
+{
+    fprintf(stderr, "Error loading column table: malformed line\n");
+    reader_free(reader);
+    fclose(f);
+    exit(EXIT_FAILURE);
+}
+
+/// Parse the values after a name
+/// @param p first character after the name
+/// @param end end of the line
+/// @param values the values of the line, grown as needed
+/// @param cap capacity of *values
+/// @return the number of values, or 0 if the line is malformed
+static size_t parse_values(char *p, char *end, int **values, size_t *cap)
+{
+    size_t n = 0;
+    for (;;) {
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p == end || *p == '#') break;
+
+        char *after;
+        errno = 0;
+        long v = strtol(p, &after, 10);
+        if (after == p || errno == ERANGE || v < INT_MIN || v > INT_MAX) return 0;
+        if (after < end && !isspace((unsigned char)*after) && *after != '#') return 0;
+
+        *values = reserve_work(*values, cap, n + 1, sizeof(int));
+        (*values)[n++] = (int)v;
+        p = after;
+    }
+    return n;
+}
+
+/// Load the column table from a file
+/// Lines may be of any length, since each holds a whole column
+/// @param filename path to the column file
+void build_columns_r(interp_ctx_t *ctx, char *filename)
+{
+    FILE *f = fopen(filename, "r");
+    if (!f) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+
+    free_columns_r(ctx);
+    column_table_t *tab = alloc_or_die(sizeof(column_table_t), "calloc column table");
+    ctx->columns = tab;
+
+    line_reader_t reader;
+    reader_init(&reader, f, 0);
+
+    int *values = NULL;                 // values of the line being read
+    size_t values_cap = 0;
+    char *line;
+    size_t len;
+    int first = 1;
+    while (read_line(&reader, &line, &len) == LINE_OK) {
+        char *p = line;
+        char *end = line + len;
+
+        // skip leading whitespace
+        while (p < end && (*p == ' ' || *p == '\t')) p++;
+        if (p == end || *p == '#' || *p == '\r') continue;
+
+        char *name = p;
+        while (p < end && !isspace((unsigned char)*p)) p++;
+        size_t name_len = (size_t)(p - name);
+
+        size_t n = parse_values(p, end, &values, &values_cap);
+        if (n == 0 || (!first && n != tab->rows)) malformed(f, &reader);
+        if (first) {
+            tab->rows = n;
+            first = 0;
+        }
+
+        column_t *col = find_column(tab, name, name_len);
+        if (!col) col = new_column(tab, name, name_len);
+        memcpy(col->values, values, n * sizeof(int));
+    }
+
+    reader_free(&reader);
+    fclose(f);
+    free(values);
+}
+
+/// Whether a column table is loaded
+int columns_loaded_r(const interp_ctx_t *ctx)
+{
+    return ctx->columns != NULL;
+}
+
+/// Rows in the table
+size_t column_rows_r(const interp_ctx_t *ctx)
+{
+    return ctx->columns ? ctx->columns->rows : 0;
+}
+
+/// Find a column by name
+/// Columns are looked up once per expression and block, not per row
+column_t *lookup_column_r(interp_ctx_t *ctx, const char *name, size_t len)
+{
+    return ctx->columns ? find_column(ctx->columns, name, len) : NULL;
+}
+
+/// Add a column for a name first assigned by an expression
+column_t *add_column_r(interp_ctx_t *ctx, const char *name, size_t len, const symbol_t *sym)
+{
+    column_table_t *tab = ctx->columns;
+    column_t *col = new_column(tab, name, len);
+    if (sym && sym->defined) {
+        for (size_t i = 0; i < tab->rows; ++i) col->values[i] = sym->val;
+    } else {
+        memset(col->values, 0, tab->rows * sizeof(int));
+        col->defined = alloc_or_die(tab->rows, "malloc column flags");
+        memset(col->defined, 0, tab->rows);
+    }
+    return col;
+}
+
+/// Print every column in load order
+void dump_columns_r(interp_ctx_t *ctx)
+{
+    column_table_t *tab = ctx->columns;
+    if (!tab || !tab->head) return;
+
+    outbuf_t *out = ctx_output(ctx);
+    ob_puts(out, "COLUMNS:\n");
+    for (column_t *col = tab->head; col; col = col->next) {
+        ob_puts(out, "\tName: ");
+        ob_write(out, col->name, col->name_len);
+        ob_puts(out, ", Values:");
+        for (size_t i = 0; i < tab->rows; ++i) {
+            ob_putc(out, ' ');
+            if (col->defined && !col->defined[i]) ob_putc(out, '-');
+            else ob_int(out, col->values[i]);
+        }
+        ob_putc(out, '\n');
+    }
+}
+
+/// Free every column
+void free_columns_r(interp_ctx_t *ctx)
+{
+    column_table_t *tab = ctx->columns;
+    if (!tab) return;
+
+    column_t *col = tab->head;
+    while (col) {
+        column_t *next = col->next;
+        free(col->name);
+        free(col->values);
+        free(col->defined);
+        free(col);
+        col = next;
+    }
+    free(tab->index);
+    free(tab);
+    ctx->columns = NULL;
+}
+
+/* ---- the same operations on the default context ---- */
+
+/// build_columns_r() on the default context
+void build_columns(char *filename)
+{
+    build_columns_r(default_ctx(), filename);
+}
+
+/// dump_columns_r() on the default context
+void dump_columns(void)
+{
+    dump_columns_r(default_ctx());
+}
@@ -0,0 +1,98 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef COLUMNS_H
+#define COLUMNS_H
+
+#include <stddef.h>
+#include "symtab.h"
+
+// One symbol bound to a value per row of the scenario table
+typedef struct column_s {
+    char *name;                 // the name of the symbol
+    size_t name_len;
+    unsigned int hash;          // hash of the name
+    int *values;                // one value per row
+    unsigned char *defined;     // per-row flags, or NULL if every row has a value
+    struct column_s *next;      // the next column, in load order
+} column_t;
+
+#define COLUMNS_MIN_CAP 64      // initial number of hash index slots
+
+// Every column of the scenario table
+typedef struct column_table_s {
+    column_t *head;             // first column, in load order
+    column_t *tail;             // last column (new ones go after it)
+    column_t **index;           // open-addressing index (NULL = empty slot)
+    size_t index_cap;           // number of index slots (power of two)
+    size_t count;               // number of occupied slots
+    size_t rows;                // values in every column
+} column_table_t;
+
+/// Loads a context's column table from a file.  The format is the
+/// symbol file turned on its side: one symbol per line, followed by
+/// its value in every row,
+///
+///     variable-name  row-1-value  row-2-value ...
+///     ...
+///
+/// Every line must give the same number of values.  Blank lines and
+/// lines starting with # are skipped, and text from a # after the
+/// values on is a comment.  A name given again replaces the values of
+/// the earlier line.
+/// @param ctx  the context the table belongs to
+/// @param filename  the name of the file containing the columns
+/// @exception If the file can't be opened, or a line is malformed,
+/// an error message is displayed to standard error and the program
+/// exits with EXIT_FAILURE.
+void build_columns_r(interp_ctx_t *ctx, char *filename);
+
+/// Tells whether a context has a column table.
+/// @param ctx  the context
+/// @return nonzero after build_columns_r()
+int columns_loaded_r(const interp_ctx_t *ctx);
+
+/// The number of rows (scenarios) in a context's table.
+/// @param ctx  the context
+/// @return the length of every column, 0 if there is no table
+size_t column_rows_r(const interp_ctx_t *ctx);
+
+/// Returns the column for a name.
+/// @param ctx  the context whose table is searched
+/// @param name  the name (not necessarily null-terminated)
+/// @param len  the length of the name
+/// @return the column, or NULL if there is none
+column_t *lookup_column_r(interp_ctx_t *ctx, const char *name, size_t len);
+
+/// Adds a column that is first assigned by an expression.  A defined
+/// symbol of the same name gives every row its value; otherwise no
+/// row has a value until one is stored.
+/// @param ctx  the context whose table gets the column (it must have one)
+/// @param name  the name (not necessarily null-terminated)
+/// @param len  the length of the name
+/// @param sym  the symbol table slot for the name, or NULL
+/// @return the new column
+column_t *add_column_r(interp_ctx_t *ctx, const char *name, size_t len, const symbol_t *sym);
+
+/// Displays the columns to the context's output in the following
+/// format:
+///
+/// COLUMNS:
+///     Name: variable-name, Values: row-1-value row-2-value ...
+///     ...
+///
+/// A row without a value is shown as -.  Nothing is printed when no
+/// column table is loaded or it has no columns.
+/// @param ctx  the context
+void dump_columns_r(interp_ctx_t *ctx);
+
+/// Destroys a context's column table
+/// @param ctx  the context
+void free_columns_r(interp_ctx_t *ctx);
+
+/// build_columns_r() on the default context
+void build_columns(char *filename);
+
+/// dump_columns_r() on the default context
+void dump_columns(void);
+
+#endif
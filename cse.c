@@ -0,0 +1,377 @@
+// cse.c
+// Common subexpression elimination: structural hashing (hash-consing)
+// of the side-effect-free subtrees of a parse tree, which turns the
+// tree into a DAG whose shared nodes the compiler evaluates once
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cse.h"
+#include "util.h"
+
+/// Entry of a pointer-keyed map
+typedef struct ptr_entry_s {
+    const void *key;            ///< NULL for an empty slot
+    int refs;                   ///< paths reaching the node
+    int slot;                   ///< memo slot, or -1
+} ptr_entry_t;
+
+/// Open-addressing map from pointers to counts
+typedef struct ptr_map_s {
+    ptr_entry_t *entries;
+    size_t cap;                 ///< power of two
+    size_t len;
+} ptr_map_t;
+
+/// Canonical node of one subtree shape
+typedef struct cons_entry_s {
+    tree_node_t *node;          ///< NULL for an empty slot
+    unsigned int hash;
+} cons_entry_t;
+
+/// Open-addressing table of canonical subtrees
+typedef struct cons_map_s {
+    cons_entry_t *entries;
+    size_t cap;                 ///< power of two
+    size_t len;
+} cons_map_t;
+
+/// One pending node of the sharing walk
+typedef struct cse_frame_s {
+    tree_node_t *node;
+    int state;                  ///< 0 before its children, 1 after
+} cse_frame_t;
+
+/// What a finished subtree hands to its parent
+typedef struct cse_result_s {
+    tree_node_t *node;          ///< canonical node for the subtree
+    size_t fresh;               ///< nodes of it that are still reachable
+    int pure;                   ///< no assignment, reads no assigned symbol
+} cse_result_t;
+
+/// Lookup structures and work stacks kept between calls
+struct cse_table_s {
+    ptr_map_t written;          ///< symbols the expression assigns
+    ptr_map_t refs;             ///< DAG nodes and their reference counts
+    cons_map_t cons;
+    cse_frame_t *frames;
+    size_t frames_cap;
+    cse_result_t *results;
+    size_t results_cap;
+};
+
+/// Empty a pointer map, keeping its storage
+static void ptr_clear(ptr_map_t *m)
+{
+    if (m->entries) memset(m->entries, 0, m->cap * sizeof(ptr_entry_t));
+    m->len = 0;
+}
+
+/// Find a key's entry
+/// @return the entry, or NULL if the key is not in the map
+static ptr_entry_t *ptr_find(const ptr_map_t *m, const void *key)
+{
+    if (m->len == 0) return NULL;
+    size_t mask = m->cap - 1;
+    for (size_t i = hash_ptr(key) & mask; m->entries[i].key; i = (i + 1) & mask) {
+        if (m->entries[i].key == key) return &m->entries[i];
+    }
+    return NULL;
+}
+
+static ptr_entry_t *ptr_add(ptr_map_t *m, const void *key);
+
+/// Double a pointer map's capacity
+static void ptr_grow(ptr_map_t *m)
+{
+    ptr_map_t old = *m;
+    m->cap = old.cap ? old.cap * 2 : 64;
+    m->entries = calloc(m->cap, sizeof(ptr_entry_t));
+    if (!m->entries) {
+        perror("calloc cse map");
+        exit(EXIT_FAILURE);
+    }
+    m->len = 0;
+    for (size_t i = 0; i < old.cap; ++i) {
+        if (old.entries[i].key) *ptr_add(m, old.entries[i].key) = old.entries[i];
+    }
+    free(old.entries);
+}
+
+/// Find a key's entry, adding it (with no references and no slot) if
+/// it is new
+static ptr_entry_t *ptr_add(ptr_map_t *m, const void *key)
+{
+    if ((m->len + 1) * 2 > m->cap) ptr_grow(m);
+
+    size_t mask = m->cap - 1;
+    size_t i = hash_ptr(key) & mask;
+    while (m->entries[i].key && m->entries[i].key != key) i = (i + 1) & mask;
+    if (!m->entries[i].key) {
+        m->entries[i].key = key;
+        m->entries[i].refs = 0;
+        m->entries[i].slot = -1;
+        m->len++;
+    }
+    return &m->entries[i];
+}
+
+/// Whether two children are the same subtree; interior children are
+/// already canonical, so for them only the same node will do
+static int same_child(const tree_node_t *a, const tree_node_t *b)
+{
+    if (a == b) return 1;
+    if (!a || !b || a->type != LEAF || b->type != LEAF) return 0;
+
+    const leaf_node_t *la = (const leaf_node_t *)a->node;
+    const leaf_node_t *lb = (const leaf_node_t *)b->node;
+    if (la->exp_type != lb->exp_type) return 0;
+    return la->exp_type == INTEGER ? la->value == lb->value : la->sym == lb->sym;
+}
+
+/// Hash of a child, consistent with same_child()
+static unsigned int hash_child(const tree_node_t *c)
+{
+    if (!c) return 0;
+    if (c->type == INTERIOR) return (unsigned int)hash_ptr(c);
+    const leaf_node_t *ln = (const leaf_node_t *)c->node;
+    if (ln->exp_type == INTEGER) return (unsigned int)ln->value * 2654435761u + 1u;
+    return (unsigned int)hash_ptr(ln->sym) + 2u;
+}
+
+/// Hash of an interior node's shape
+static unsigned int hash_shape(const tree_node_t *node)
+{
+    const interior_node_t *in = (const interior_node_t *)node->node;
+    unsigned int h = (unsigned int)in->op * 16777619u;
+    h = (h ^ hash_child(in->left)) * 16777619u;
+    h = (h ^ hash_child(in->right)) * 16777619u;
+    return h;
+}
+
+/// The canonical node with the same shape as node, entering node as
+/// the canonical one if the shape is new
+static tree_node_t *cons_node(cons_map_t *m, tree_node_t *node)
+{
+    if ((m->len + 1) * 2 > m->cap) {
+        cons_map_t old = *m;
+        m->cap = old.cap ? old.cap * 2 : 64;
+        m->entries = calloc(m->cap, sizeof(cons_entry_t));
+        if (!m->entries) {
+            perror("calloc cse table");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < old.cap; ++i) {
+            if (!old.entries[i].node) continue;
+            size_t j = old.entries[i].hash & (m->cap - 1);
+            while (m->entries[j].node) j = (j + 1) & (m->cap - 1);
+            m->entries[j] = old.entries[i];
+        }
+        free(old.entries);
+    }
+
+    unsigned int h = hash_shape(node);
+    const interior_node_t *in = (const interior_node_t *)node->node;
+    size_t mask = m->cap - 1;
+    size_t i = h & mask;
+    for (; m->entries[i].node; i = (i + 1) & mask) {
+        if (m->entries[i].hash != h) continue;
+        const interior_node_t *other = (const interior_node_t *)m->entries[i].node->node;
+        if (other->op == in->op && same_child(other->left, in->left)
+            && same_child(other->right, in->right))
+            return m->entries[i].node;
+    }
+    m->entries[i].node = node;
+    m->entries[i].hash = h;
+    m->len++;
+    return node;
+}
+
+/// Push a node onto the frame stack
+static size_t push_node(struct cse_table_s *t, size_t sp, tree_node_t *node)
+{
+    t->frames = reserve_work(t->frames, &t->frames_cap, sp + 1, sizeof(cse_frame_t));
+    t->frames[sp].node = node;
+    t->frames[sp].state = 0;
+    return sp + 1;
+}
+
+/// Initialize an empty result
+void cse_init(cse_t *cse)
+{
+    cse->nodes = NULL;
+    cse->len = 0;
+    cse->cap = 0;
+    cse->removed = 0;
+    cse->table = NULL;
+}
+
+/// Free the result and the lookup structures
+void cse_free(cse_t *cse)
+{
+    if (cse->table) {
+        free(cse->table->written.entries);
+        free(cse->table->refs.entries);
+        free(cse->table->cons.entries);
+        free(cse->table->frames);
+        free(cse->table->results);
+        free(cse->table);
+    }
+    free(cse->nodes);
+    cse_init(cse);
+}
+
+/// Record the symbols assigned anywhere in the tree
+static void collect_written(struct cse_table_s *t, tree_node_t *root)
+{
+    size_t sp = push_node(t, 0, root);
+    while (sp > 0) {
+        tree_node_t *node = t->frames[--sp].node;
+        if (!node || node->type == LEAF) continue;
+
+        interior_node_t *in = (interior_node_t *)node->node;
+        if (in->op == ASSIGN_OP && in->left && in->left->type == LEAF) {
+            leaf_node_t *ln = (leaf_node_t *)in->left->node;
+            if (ln->exp_type == SYMBOL && ln->sym) ptr_add(&t->written, ln->sym);
+        }
+        sp = push_node(t, sp, in->right);
+        sp = push_node(t, sp, in->left);
+    }
+}
+
+/// node with new children, or node itself if they did not change
+static tree_node_t *rebuild(arena_t *arena, tree_node_t *node,
+                            tree_node_t *left, tree_node_t *right)
+{
+    interior_node_t *in = (interior_node_t *)node->node;
+    if (left == in->left && right == in->right) return node;
+    token_t tok = { node->token, node->token_len };
+    return make_interior(arena, in->op, tok, left, right);
+}
+
+/// Replace repeated pure subtrees by their canonical copies, bottom up
+/// A node whose children were replaced is copied, so the tree given
+/// is never changed
+/// @param[out] removed the number of nodes made unreachable
+/// @return the root of the DAG
+static tree_node_t *share_pass(struct cse_table_s *t, arena_t *arena,
+                               tree_node_t *root, size_t *removed)
+{
+    size_t sp = push_node(t, 0, root);
+    size_t rp = 0;
+    *removed = 0;
+
+    while (sp > 0) {
+        cse_frame_t *f = &t->frames[sp - 1];
+        tree_node_t *node = f->node;
+
+        t->results = reserve_work(t->results, &t->results_cap, rp + 1, sizeof(cse_result_t));
+        if (!node || node->type == LEAF) {
+            cse_result_t *r = &t->results[rp++];
+            r->node = node;
+            r->fresh = node ? 1 : 0;
+            r->pure = 0;
+            if (node) {
+                leaf_node_t *ln = (leaf_node_t *)node->node;
+                r->pure = ln->exp_type == INTEGER
+                          || (ln->sym && !ptr_find(&t->written, ln->sym));
+            }
+            sp--;
+            continue;
+        }
+
+        interior_node_t *in = (interior_node_t *)node->node;
+        if (f->state == 0) {
+            f->state = 1;
+            sp = push_node(t, sp, in->right);
+            sp = push_node(t, sp, in->left);
+            continue;
+        }
+        sp--;
+
+        cse_result_t right = t->results[--rp];
+        cse_result_t left = t->results[--rp];
+        node = rebuild(arena, node, left.node, right.node);
+
+        cse_result_t *r = &t->results[rp++];
+        r->node = node;
+        r->fresh = 1 + left.fresh + right.fresh;
+        r->pure = in->op != ASSIGN_OP && left.pure && right.pure;
+        if (r->pure) {
+            tree_node_t *canon = cons_node(&t->cons, node);
+            if (canon != node) {
+                *removed += r->fresh;
+                r->node = canon;
+                r->fresh = 0;
+            }
+        }
+    }
+
+    return rp ? t->results[0].node : root;
+}
+
+/// Count the paths into each node of the DAG and give a memo slot to
+/// every node reached along more than one.  ALT_OP nodes only hold
+/// the branches of a ternary and are never evaluated alone, so they
+/// get no slot
+static void assign_slots(cse_t *cse, tree_node_t *root)
+{
+    struct cse_table_s *t = cse->table;
+    size_t sp = 0;
+    if (root && root->type == INTERIOR) {
+        ptr_add(&t->refs, root)->refs = 1;
+        sp = push_node(t, sp, root);
+    }
+
+    while (sp > 0) {
+        tree_node_t *node = t->frames[--sp].node;
+        interior_node_t *in = (interior_node_t *)node->node;
+        tree_node_t *kids[2] = { in->left, in->right };
+
+        for (int k = 0; k < 2; ++k) {
+            tree_node_t *c = kids[k];
+            if (!c || c->type != INTERIOR) continue;
+
+            ptr_entry_t *e = ptr_add(&t->refs, c);
+            if (e->refs++ == 0) {
+                sp = push_node(t, sp, c);
+            } else if (e->slot < 0 && ((interior_node_t *)c->node)->op != ALT_OP) {
+                cse->nodes = reserve_work(cse->nodes, &cse->cap, cse->len + 1, sizeof(tree_node_t *));
+                e->slot = (int)cse->len;
+                cse->nodes[cse->len++] = c;
+            }
+        }
+    }
+}
+
+/// Build the DAG of a tree and find its shared nodes
+tree_node_t *share_subtrees(cse_t *cse, arena_t *arena, tree_node_t *root)
+{
+    if (!cse->table) {
+        cse->table = calloc(1, sizeof(struct cse_table_s));
+        if (!cse->table) {
+            perror("calloc cse table");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct cse_table_s *t = cse->table;
+    ptr_clear(&t->written);
+    ptr_clear(&t->refs);
+    if (t->cons.entries) memset(t->cons.entries, 0, t->cons.cap * sizeof(cons_entry_t));
+    t->cons.len = 0;
+    cse->len = 0;
+
+    collect_written(t, root);
+    tree_node_t *dag = share_pass(t, arena, root, &cse->removed);
+    assign_slots(cse, dag);
+    return dag;
+}
+
+/// Memo slot of a node
+int cse_slot(const cse_t *cse, const tree_node_t *node)
+{
+    if (!cse->table || cse->len == 0) return -1;
+    const ptr_entry_t *e = ptr_find(&cse->table->refs, node);
+    return e ? e->slot : -1;
+}
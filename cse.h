@@ -0,0 +1,52 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef CSE_H
+#define CSE_H
+
+#include <stddef.h>
+#include "tree_node.h"
+#include "arena.h"
+
+// Result of sharing the common subexpressions of one tree: the
+// interior nodes that are now reached along more than one path, each
+// with a memo slot number (its index in nodes).
+typedef struct cse_s {
+    tree_node_t **nodes;        // shared nodes, by slot
+    size_t len;                 // number of shared nodes
+    size_t cap;                 // allocated entries
+    size_t removed;             // nodes the last call made unreachable
+    struct cse_table_s *table;  // lookup structures (reused between calls)
+} cse_t;
+
+/// Initializes an empty result.
+/// @param cse  the result to initialize
+void cse_init(cse_t *cse);
+
+/// Releases the result and its lookup structures.
+/// @param cse  the result to free
+void cse_free(cse_t *cse);
+
+/// Builds the DAG of a bound tree: every subtree that is structurally
+/// identical to one met earlier is replaced by a pointer to that one.
+/// Only side-effect-free subtrees are shared, that is subtrees with no
+/// ASSIGN_OP that read no symbol the expression assigns anywhere, so
+/// every copy of a shared subtree has the same value wherever it is
+/// evaluated.  Integer literals are compared by value, so the DAG is
+/// for evaluation only; it may not print as the tree does.
+///
+/// The tree is not changed; nodes whose children are replaced are
+/// copied into the arena, and the rest are shared with the tree.  The
+/// number of nodes the DAG no longer reaches is left in cse->removed.
+/// @param cse  receives the shared nodes (its old contents are dropped)
+/// @param arena  the arena for copied nodes
+/// @param root  the root of the tree (already bound by bind_tree())
+/// @return the root of the DAG (root itself if nothing was shared)
+tree_node_t *share_subtrees(cse_t *cse, arena_t *arena, tree_node_t *root);
+
+/// The memo slot of a shared node.
+/// @param cse  the result of share_subtrees()
+/// @param node  an interior node of the DAG
+/// @return its slot, or -1 if the node is reached along only one path
+int cse_slot(const cse_t *cse, const tree_node_t *node);
+
+#endif
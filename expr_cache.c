@@ -0,0 +1,149 @@
+// expr_cache.c
+// LRU cache of compiled expressions keyed by their normalized text,
+// so a repeated line skips tokenizing, parsing and infix printing
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "expr_cache.h"
+#include "util.h"
+
+/// Turn the cache on with room for cap entries
+void cache_init(expr_cache_t *cache, size_t cap)
+{
+    cache_free(cache);
+    cache->hits = 0;
+    cache->misses = 0;
+    if (cap == 0) return;
+
+    cache->nbuckets = 16;
+    while (cache->nbuckets < cap) cache->nbuckets *= 2;
+    cache->buckets = calloc(cache->nbuckets, sizeof(cache_entry_t *));
+    if (!cache->buckets) {
+        perror("calloc expression cache");
+        exit(EXIT_FAILURE);
+    }
+    cache->capacity = cap;
+}
+
+/// Whether the cache is on
+int cache_enabled(const expr_cache_t *cache)
+{
+    return cache->capacity > 0;
+}
+
+/// Take an entry out of the LRU list
+static void unlink_entry(expr_cache_t *cache, cache_entry_t *e)
+{
+    if (e->prev) e->prev->next = e->next;
+    else cache->newest = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else cache->oldest = e->prev;
+}
+
+/// Put an entry at the front of the LRU list
+static void push_newest(expr_cache_t *cache, cache_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = cache->newest;
+    if (cache->newest) cache->newest->prev = e;
+    else cache->oldest = e;
+    cache->newest = e;
+}
+
+/// Find an expression and make it the most recently used
+cache_entry_t *cache_find(expr_cache_t *cache, const char *key, size_t len)
+{
+    if (!cache->capacity) return NULL;
+
+    unsigned int h = hash_name(key, len);
+    cache_entry_t *e = cache->buckets[h & (cache->nbuckets - 1)];
+    while (e && (e->hash != h || e->key_len != len || memcmp(e->key, key, len) != 0))
+        e = e->chain;
+
+    if (!e) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    if (e != cache->newest) {
+        unlink_entry(cache, e);
+        push_newest(cache, e);
+    }
+    return e;
+}
+
+/// Drop the least recently used entry
+static void evict_oldest(expr_cache_t *cache)
+{
+    cache_entry_t *e = cache->oldest;
+    cache_entry_t **link = &cache->buckets[e->hash & (cache->nbuckets - 1)];
+    while (*link != e) link = &(*link)->chain;
+    *link = e->chain;
+
+    unlink_entry(cache, e);
+    jit_release(e->native);
+    free(e);
+    cache->count--;
+}
+
+/// Copy an expression into a new entry
+/// The entry, its code, its key and its infix text share one allocation
+cache_entry_t *cache_insert(expr_cache_t *cache, const char *key, size_t len,
+                            const bytecode_t *bc, const char *infix, size_t infix_len)
+{
+    if (cache->count == cache->capacity) evict_oldest(cache);
+
+    size_t code_size = bc->len * sizeof(vm_insn_t);
+    cache_entry_t *e = malloc(sizeof(cache_entry_t) + code_size + len + 1 + infix_len + 1);
+    if (!e) {
+        perror("malloc cache entry");
+        exit(EXIT_FAILURE);
+    }
+
+    bc_init(&e->code);
+    e->code.code = (vm_insn_t *)(e + 1);
+    e->code.len = bc->len;
+    e->code.cap = bc->len;
+    e->code.max_depth = bc->max_depth;
+    e->code.memo_slots = bc->memo_slots;
+    memcpy(e->code.code, bc->code, code_size);
+    e->runs = 0;
+    e->native = NULL;
+
+    e->key = (char *)e->code.code + code_size;
+    memcpy(e->key, key, len);
+    e->key[len] = '\0';
+    e->key_len = len;
+    e->hash = hash_name(key, len);
+
+    e->infix = e->key + len + 1;
+    memcpy(e->infix, infix, infix_len);
+    e->infix[infix_len] = '\0';
+    e->infix_len = infix_len;
+
+    cache_entry_t **bucket = &cache->buckets[e->hash & (cache->nbuckets - 1)];
+    e->chain = *bucket;
+    *bucket = e;
+    push_newest(cache, e);
+    cache->count++;
+    return e;
+}
+
+/// Hit and miss counts
+void cache_counts(const expr_cache_t *cache, size_t *h, size_t *m)
+{
+    *h = cache->hits;
+    *m = cache->misses;
+}
+
+/// Free every entry and the index
+void cache_free(expr_cache_t *cache)
+{
+    while (cache->oldest) evict_oldest(cache);
+    free(cache->buckets);
+    cache->buckets = NULL;
+    cache->nbuckets = 0;
+    cache->capacity = 0;
+}
@@ -0,0 +1,81 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef EXPR_CACHE_H
+#define EXPR_CACHE_H
+
+#include <stddef.h>
+#include "bytecode.h"
+#include "jit.h"
+
+// A cached expression: everything rep() needs to print and evaluate a
+// line it has seen before.  The entry owns its key, its infix text and
+// a copy of the compiled code; the code refers to symbol table slots,
+// which live until free_table().
+typedef struct cache_entry_s {
+    char *key;                  // normalized expression text
+    size_t key_len;
+    unsigned int hash;          // hash of the key
+    char *infix;                // the text print_infix() produced
+    size_t infix_len;
+    bytecode_t code;            // the compiled expression
+    size_t runs;                // times it has been evaluated
+    jit_code_t *native;         // machine code for it, once it is hot
+    struct cache_entry_s *prev; // more recently used entry
+    struct cache_entry_s *next; // less recently used entry
+    struct cache_entry_s *chain;    // next entry in the same hash bucket
+} cache_entry_t;
+
+// An LRU cache of expressions, owned by one interpreter context
+typedef struct expr_cache_s {
+    cache_entry_t **buckets;    // hash index (power-of-two size)
+    size_t nbuckets;
+    size_t capacity;            // most entries kept, 0 = off
+    size_t count;               // entries cached now
+    cache_entry_t *newest;      // head of the LRU list
+    cache_entry_t *oldest;      // tail of the LRU list
+    size_t hits;
+    size_t misses;
+} expr_cache_t;
+
+/// Sets the number of expressions kept, dropping any cached ones.
+/// A zero-filled cache is an empty one that is off.
+/// @param cache  the cache
+/// @param capacity  the most entries kept, or 0 to turn the cache off
+void cache_init(expr_cache_t *cache, size_t capacity);
+
+/// Tells whether the cache is on.
+/// @param cache  the cache
+/// @return nonzero if cache_init() was given a capacity
+int cache_enabled(const expr_cache_t *cache);
+
+/// Looks up an expression and marks it most recently used.  Every
+/// call counts as a hit or a miss.
+/// @param cache  the cache
+/// @param key  the normalized expression text
+/// @param len  its length
+/// @return the entry, or NULL on a miss
+cache_entry_t *cache_find(expr_cache_t *cache, const char *key, size_t len);
+
+/// Adds an expression, evicting the least recently used one when the
+/// cache is full.  The key must not be cached already.
+/// @param cache  the cache
+/// @param key  the normalized expression text
+/// @param len  its length
+/// @param bc  the compiled expression (copied)
+/// @param infix  its infix text (copied)
+/// @param infix_len  the length of the infix text
+/// @return the new entry
+cache_entry_t *cache_insert(expr_cache_t *cache, const char *key, size_t len,
+                            const bytecode_t *bc, const char *infix, size_t infix_len);
+
+/// Reports how lookups have gone so far.
+/// @param cache  the cache
+/// @param[out] hits  lookups that found their expression
+/// @param[out] misses  lookups that did not
+void cache_counts(const expr_cache_t *cache, size_t *hits, size_t *misses);
+
+/// Drops every entry (and its native code) and turns the cache off.
+/// @param cache  the cache
+void cache_free(expr_cache_t *cache);
+
+#endif
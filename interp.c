@@ -1,5 +1,5 @@
 // interp.c
-// Main program: command-line handling and REPL for postfix interpreter
+// Main program: command-line handling, REPL and batch mode for postfix interpreter
 // Handles symbol table loading, input processing, comments, and final dump
 // @author: Munkh-Orgil Jargalsaikhan
 
@@ -9,89 +9,299 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "interp.h"
 #include "parser.h"
 #include "symtab.h"
+#include "line_reader.h"
+#include "outbuf.h"
+#include "batch.h"
+#include "expr_cache.h"
+#include "jit.h"
+#include "columns.h"
+#include "interp_ctx.h"
+#include "reactive.h"
+
+/// Print the usage message
+/// @return EXIT_FAILURE, for use as main's return value
+static int usage(void)
+{
+    fprintf(stderr, "Usage: interp [--tree] [-O] [--cse] [--jit] [--reactive] [--stats] [--save=file] [--verify-snapshot] [--lazy] [--dump=all|changed] [--columns=file] [--max-line=N] [--cache=N] [-f script [--jobs=N]] [sym-table]\n");
+    return EXIT_FAILURE;
+}
+
+/// Parse the numeric value of a --name=N option
+/// @param arg the whole argument
+/// @param prefix the option name including '='
+/// @param[out] value the number
+/// @return 1 if arg is this option with a valid number, 0 otherwise
+static int size_option(const char *arg, const char *prefix, size_t *value)
+{
+    size_t plen = strlen(prefix);
+    if (strncmp(arg, prefix, plen) != 0) return 0;
+
+    const char *digits = arg + plen;
+    if (!isdigit((unsigned char)*digits)) return 0;
+    char *end;
+    unsigned long long v = strtoull(digits, &end, 10);
+    if (*end != '\0' || v > (size_t)-1) return 0;
+    *value = (size_t)v;
+    return 1;
+}
+
+/// Run lines from a stream through rep()
+/// @param in the input stream
+/// @param max_line longest accepted line (0 = no limit)
+/// @param interactive print a prompt and flush before each line
+static void run_stream(FILE *in, size_t max_line, int interactive)
+{
+    outbuf_t *out = ob_stdout();
+    line_reader_t reader;
+    reader_init(&reader, in, max_line);
+    char *line;
+    size_t len;
+
+    /* FIXED: Proper REPL loop — prompt only printed when a line will be read */
+    for (;;) {
+        if (interactive) {
+            ob_puts(out, "> ");
+            ob_flush(out);
+        }
+        line_status_t status = read_line(&reader, &line, &len);
+        if (status == LINE_EOF) break;
+
+        /* Reject lines over the limit (the rest was already skipped) */
+        if (status == LINE_TOO_LONG) {
+            fprintf(stderr, "Input line too long\n");
+            continue;
+        }
+
+        /* Drop comments and surrounding whitespace in one pass */
+        size_t n;
+        char *start = clean_line(line, len, &n);
+
+        /* Skip blank and comment-only lines; process the expression */
+        if (n > 0) rep_n(start, n);
+    }
+    reader_free(&reader);
+}
+
+/// Run every line of a script file through rep(), with no prompts
+/// The file is memory-mapped and split into lines in place; anything
+/// that cannot be mapped (a pipe, say) is read as a stream instead.
+/// With more than one job the lines run on a thread pool
+/// @param path script file name
+/// @param max_line longest accepted line (0 = no limit)
+/// @param jobs number of threads
+static void run_batch(const char *path, size_t max_line, size_t jobs)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    if (map == MAP_FAILED) {
+        FILE *f = fdopen(fd, "r");
+        if (!f) {
+            perror(path);
+            exit(EXIT_FAILURE);
+        }
+        run_stream(f, max_line, 0);
+        fclose(f);
+        return;
+    }
+    close(fd);
+
+    size_t size = (size_t)st.st_size;
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+    if (jobs > 1) {
+        run_parallel(default_ctx(), map, size, max_line, jobs);
+        munmap(map, size);
+        return;
+    }
+
+    char *p = map;
+    char *end = map + size;
+    while (p < end) {
+        char *nl = memchr(p, '\n', (size_t)(end - p));
+        char *eol = nl ? nl : end;
+        size_t len = (size_t)(eol - p);
+
+        if (max_line && len > max_line) {
+            fprintf(stderr, "Input line too long\n");
+        } else {
+            size_t n;
+            char *start = clean_line(p, len, &n);
+            if (n > 0) rep_n(start, n);
+        }
+        p = nl ? nl + 1 : end;
+    }
+
+    munmap(map, size);
+}
 
 /// Program entry point
-/// @param argc number of command-line arguments (1 or 2 expected)
-/// @param argv program name and optional symbol table filename
+/// @param argc number of command-line arguments
+/// @param argv program name, options and optional symbol table filename
+///     -f script     run the script file in batch mode (no prompts)
+///     --jobs=N      run the script on N threads (0 = one per CPU)
+///     --cache=N     keep the last N distinct expressions parsed and compiled
+///     --tree        evaluate with the tree walker instead of the bytecode VM
+///     -O            fold constants and simplify before evaluating
+///     --cse         evaluate repeated subexpressions once per line
+///     --jit         run hot cached expressions as native code
+///     --reactive    keep assignments as formulas, recomputed when an input changes
+///     --stats       time the hot paths and print a report on exit
+///     --save=F      write the final symbol table to snapshot file F
+///     --verify-snapshot  check the whole of a snapshot symbol table on load
+///     --lazy        load the symbol table through a cached sidecar index
+///     --dump=changed  end with only the symbols assigned since loading
+///                   (--dump=all, the default, ends with the whole table)
+///     --columns=F   evaluate every expression over the rows of column file F
+///     --max-line=N  reject lines longer than N characters (0 = no limit)
 /// @return EXIT_SUCCESS on clean exit, EXIT_FAILURE on usage error
 int main(int argc, char **argv)
 {
     /* Validate command-line arguments */
-    if (argc > 2) {
-        fprintf(stderr, "Usage: interp [sym-table]\n");
-        return EXIT_FAILURE;
+    char *symfile = NULL;
+    char *script = NULL;
+    char *colfile = NULL;
+    char *savefile = NULL;
+    int changed_only = 0;
+    size_t max_line = MAX_LINE;
+    size_t jobs = 1;
+    size_t cache_size = 0;
+    int share = 0;
+    int native = 0;
+    int stats = 0;
+    int reactive = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--tree") == 0) {
+            set_eval_mode(EVAL_TREE);
+        } else if (strcmp(argv[i], "-O") == 0) {
+            set_optimize(1);
+        } else if (strcmp(argv[i], "--cse") == 0) {
+            set_cse(1);
+            share = 1;
+        } else if (strcmp(argv[i], "--jit") == 0) {
+            set_jit(1);
+            native = 1;
+        } else if (strcmp(argv[i], "--reactive") == 0) {
+            set_reactive(1);
+            reactive = 1;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_enable(&default_ctx()->stats);
+            stats = 1;
+        } else if (strcmp(argv[i], "-f") == 0) {
+            if (++i == argc || script) return usage();
+            script = argv[i];
+        } else if (strncmp(argv[i], "--columns=", 10) == 0 && argv[i][10] && !colfile) {
+            colfile = argv[i] + 10;
+        } else if (strncmp(argv[i], "--save=", 7) == 0 && argv[i][7] && !savefile) {
+            savefile = argv[i] + 7;
+        } else if (strcmp(argv[i], "--verify-snapshot") == 0) {
+            set_verify_snapshot(1);
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            set_lazy(1);
+        } else if (strcmp(argv[i], "--dump=changed") == 0) {
+            changed_only = 1;
+        } else if (strcmp(argv[i], "--dump=all") == 0) {
+            changed_only = 0;
+        } else if (size_option(argv[i], "--max-line=", &max_line)) {
+            continue;
+        } else if (size_option(argv[i], "--jobs=", &jobs)) {
+            continue;
+        } else if (size_option(argv[i], "--cache=", &cache_size)) {
+            continue;
+        } else if (argv[i][0] == '-' || symfile) {
+            return usage();
+        } else {
+            symfile = argv[i];
+        }
     }
 
     /* Load symbol table: either from file or create empty one */
-    if (argc == 2) {
-        build_table(argv[1]);           // exits on error (per spec)
-    } else {
-        build_table(NULL);              // empty table
-    }
+    build_table(symfile);               // exits on error (per spec)
 
     /* Print initial symbol table (only if non-empty) */
     dump_table();
 
-    printf("Enter postfix expressions (CTRL-D to exit):\n");
+    if (colfile) {
+        build_columns(colfile);
+        dump_columns();
+        set_eval_mode(EVAL_COLUMNS);
+        jobs = 1;                       // the parallel batch runs the VM
+    }
 
-    char linebuf[MAX_LINE + 2];         // +2 for '\n' and '\0'
+    if (native && cache_size == 0) cache_size = JIT_CACHE_SIZE;   // hot means cached
+    expr_cache_t *cache = &default_ctx()->cache;
+    cache_init(cache, cache_size);
 
-    /* FIXED: Proper REPL loop — prompt only printed when fgets() will read */
-    while (printf("> "), fflush(stdout), fgets(linebuf, sizeof(linebuf), stdin)) {
+    if (reactive) jobs = 1;             // formulas chain from line to line
 
-        /* Detect and reject overly long lines */
-        size_t len = strlen(linebuf);
-        if (len == sizeof(linebuf) - 1 && linebuf[len-1] != '\n') {
-            fprintf(stderr, "Input line too long\n");
-            int c;
-            while ((c = getchar()) != EOF && c != '\n') ;  // discard rest
-            continue;
-        }
+    if (jobs == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = cpus > 0 ? (size_t)cpus : 1;
+    }
 
-        /* Remove trailing newline */
-        if (len > 0 && linebuf[len-1] == '\n') {
-            linebuf[len-1] = '\0';
-        }
+    if (script) {
+        run_batch(script, max_line, jobs);
+    } else {
+        ob_puts(ob_stdout(), "Enter postfix expressions (CTRL-D to exit):\n");
+        run_stream(stdin, max_line, 1);
 
-        /* Skip full-line comments starting with # */
-        char *p = linebuf;
-        while (*p == ' ' || *p == '\t') p++;
-        if (*p == '#') continue;
-
-        /* Remove inline comments (everything after #) */
-        char *hash = strchr(linebuf, '#');
-        if (hash) *hash = '\0';
-
-        /* Trim leading and trailing whitespace */
-        char *start = linebuf;
-        while (*start && isspace((unsigned char)*start)) start++;
-
-        char *end = start + strlen(start);
-        if (end != start) {
-            end--;
-            while (end >= start && isspace((unsigned char)*end)) {
-                *end = '\0';
-                end--;
-            }
-        }
+        /* FIXED: Clean separation — final symbol table starts on its own line */
+        ob_putc(ob_stdout(), '\n');
+    }
 
-        /* Skip blank lines after trimming */
-        if (*start == '\0') continue;
+    if (changed_only) dump_changed();
+    else dump_table();
+    dump_columns();
+    if (savefile) save_table(savefile);
 
-        /* Process the expression */
-        rep(start);
+    if (share) {
+        fprintf(stderr, "Common subexpressions: %zu nodes deduplicated\n", cse_removed_count());
     }
 
-    /* FIXED: Clean separation — final symbol table starts on its own line */
-    printf("\n");
-    dump_table();
+    if (native) {
+        if (jit_available())
+            fprintf(stderr, "Native code: %zu expressions compiled\n", jit_compiled_count());
+        else
+            fprintf(stderr, "Native code: not available in this build\n");
+    }
+
+    if (reactive) {
+        const reactive_t *r = &default_ctx()->formulas;
+        fprintf(stderr, "Formulas: %zu live, %zu recomputations, %zu failed\n",
+                r->live, r->recomputed, r->failed);
+    }
+
+    if (cache_enabled(cache)) {
+        size_t hits, misses;
+        cache_counts(cache, &hits, &misses);
+        fprintf(stderr, "Expression cache: %zu hits, %zu misses\n", hits, misses);
+    }
+
+    if (stats) {
+        ob_flush(ob_stdout());          // count the last write too
+        stats_report(default_ctx(), stderr);
+    }
 
-    /* Clean up symbol table memory */
-    free_table();
+    /* Clean up the interpreter and write out the last output */
+    ctx_free(default_ctx());
+    ob_free(ob_stdout());
 
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
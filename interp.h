@@ -3,8 +3,9 @@
 #ifndef INTERP_H
 #define INTERP_H
 
-/// the maximum number of characters entered for an expression
-/// (not including the null character)
-#define MAX_LINE 100
+/// the default maximum number of characters entered for an expression
+/// (not including the null character); --max-line=N overrides it.
+/// Lines are read into a growable buffer, so this is only a safety cap.
+#define MAX_LINE (64u * 1024u * 1024u)
 
 #endif
@@ -0,0 +1,69 @@
+// interp_ctx.c
+// Interpreter contexts: creation, teardown, and the default context
+// used by the command-line program
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "interp_ctx.h"
+#include "columns.h"
+
+/// Initialize a context: empty table, VM evaluator, nothing turned on
+void ctx_init(interp_ctx_t *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->parser_error = PARSE_NONE;
+    ctx->evaluator_error = EVAL_NONE;
+    ctx->eval_mode = EVAL_VM;
+    cse_init(&ctx->expr_cse);
+    bc_init(&ctx->expr_code);
+    init_stack(&ctx->tokens);
+    react_init(&ctx->formulas);
+    ob_init(&ctx->sink, stdout, 0);
+    ctx->own_out = &ctx->sink;
+}
+
+/// Free everything the context owns
+void ctx_free(interp_ctx_t *ctx)
+{
+    cache_free(&ctx->cache);           // may release native code first
+    free_table_r(ctx);
+    free_columns_r(ctx);
+    if (ctx->expr_arena_ready) arena_free(&ctx->expr_arena);
+    if (ctx->infix_text_ready) ob_free(&ctx->infix_text);
+    cse_free(&ctx->expr_cse);
+    fold_work_free(&ctx->fold);
+    bc_free(&ctx->expr_code);
+    react_free(&ctx->formulas);
+    free(ctx->vm_stack);
+    free(ctx->key_buf);
+    release_stack(&ctx->tokens);
+    free(ctx->frames);
+    free(ctx->parse_items);
+    free(ctx->parse_vals);
+    ob_free(&ctx->sink);               // writes out what is left
+    memset(ctx, 0, sizeof(*ctx));
+}
+
+/// The context of the functions without the _r suffix
+/// Created on first use; the command-line program is single-threaded
+/// until run_parallel(), which is handed the context explicitly
+interp_ctx_t *default_ctx(void)
+{
+    static interp_ctx_t ctx;
+    static int ready = 0;
+    if (!ready) {
+        ctx_init(&ctx);
+        ob_free(&ctx.sink);             // it shares the stdout buffer instead
+        ctx.own_out = ob_stdout();
+        ready = 1;
+    }
+    return &ctx;
+}
+
+/// Where the context's results go
+outbuf_t *ctx_output(interp_ctx_t *ctx)
+{
+    return ctx->out ? ctx->out : ctx->own_out;
+}
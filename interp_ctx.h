@@ -0,0 +1,97 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef INTERP_CTX_H
+#define INTERP_CTX_H
+
+#include <stddef.h>
+#include "symtab.h"
+#include "arena.h"
+#include "outbuf.h"
+#include "parser.h"
+#include "bytecode.h"
+#include "cse.h"
+#include "expr_cache.h"
+#include "optimize.h"
+#include "stats.h"
+#include "reactive.h"
+
+// Everything one interpreter keeps between expressions: its symbol
+// table, error state, allocators, evaluator settings and output.  The
+// parser and symbol table functions ending in _r work on the context
+// they are given and touch no other mutable state, so each thread can
+// run its own context.  A context must not be used by two threads at
+// once.
+struct interp_ctx_s {
+    symtab_t symtab;                // the symbol table
+
+    parse_error_t parser_error;     // error of the last parse
+    eval_error_t evaluator_error;   // error of the last evaluation
+
+    arena_t expr_arena;             // nodes and token bytes of the current expression
+    int expr_arena_ready;
+
+    outbuf_t *out;                  // where results go (NULL = own_out)
+    outbuf_t *own_out;              // where they go by default
+    outbuf_t sink;                  // the context's own stdout buffer
+    outbuf_t *error_out;            // where parse errors go (NULL = stderr)
+
+    eval_mode_t eval_mode;          // how rep_r() evaluates
+    int optimize;                   // fold constants before evaluating
+    int share;                      // share common subexpressions
+    int jit;                        // compile hot cached expressions natively
+    size_t cse_removed;             // nodes removed by sharing, in total
+    size_t jit_compiled;            // expressions given native code
+    int reactive;                   // keep assignments as live formulas
+    reactive_t formulas;            // the live formulas
+
+    cse_t expr_cse;                 // shared nodes of the current expression
+    fold_work_t fold;               // work stacks of fold_tree()
+    bytecode_t expr_code;           // compiled form of the current expression
+    int *vm_stack;                  // operand stack reused by every run
+    size_t vm_stack_cap;
+    expr_cache_t cache;             // compiled expressions by normalized text
+
+    char *key_buf;                  // normalized text of the current expression
+    size_t key_buf_cap;
+    outbuf_t infix_text;            // infix text of an expression being cached
+    int infix_text_ready;
+
+    stack_t tokens;                 // token slices of the line being parsed
+    struct frame_s *frames;         // work stacks of the iterative walks
+    size_t frames_cap;
+    struct parse_item_s *parse_items;
+    size_t parse_items_cap;
+    tree_node_t **parse_vals;
+    size_t parse_vals_cap;
+
+    struct column_table_s *columns; // rows of --columns (NULL = none)
+    struct batch_run_s *batch;      // scheduler of run_parallel(), while it runs
+
+    interp_stats_t stats;           // hot-path counters (see --stats)
+};
+
+/// Initializes a context with an empty symbol table, the VM evaluator,
+/// every optimization off, no expression cache, and results going to
+/// a standard output buffer of its own, so contexts on different
+/// threads never share one.
+/// @param ctx  the context to initialize
+void ctx_init(interp_ctx_t *ctx);
+
+/// Releases everything a context owns, including its symbol table and
+/// expression cache, after writing out its output buffer.  The context
+/// must be initialized again before it is used.
+/// @param ctx  the context to free
+void ctx_free(interp_ctx_t *ctx);
+
+/// The context used by the functions without the _r suffix, created
+/// on first use.  It is the only context the command-line program has,
+/// and the only one whose results go to the shared ob_stdout() buffer.
+/// @return the process's default context
+interp_ctx_t *default_ctx(void);
+
+/// The buffer results of a context go to.
+/// @param ctx  the context
+/// @return its output buffer, or its own buffer if none was set
+outbuf_t *ctx_output(interp_ctx_t *ctx);
+
+#endif
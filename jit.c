@@ -0,0 +1,359 @@
+// jit.c
+// Native x86-64 code generator for compiled expressions: translates
+// the VM's instructions one by one into machine code, with the same
+// accumulator and in-memory operand stack, and runs it directly.
+// Build with -DNO_JIT to leave the generator out.
+// @author: Munkh-Orgil Jargalsaikhan
+
+#define _DEFAULT_SOURCE           // MAP_ANONYMOUS
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "jit.h"
+#include "symtab.h"
+#include "util.h"
+
+#if !defined(NO_JIT) && defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#define JIT_ENABLED 1
+#endif
+
+#ifdef JIT_ENABLED
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+/// Signature of generated code: operand stack, memo values, error out
+typedef int (*native_fn_t)(int *stack, int *memo, int *err);
+
+/// Native code and the stack layout it expects
+struct jit_code_s {
+    native_fn_t entry;          ///< start of the code
+    void *map;                  ///< executable mapping
+    size_t map_size;
+    size_t max_depth;           ///< operand stack depth, as in the program
+    size_t memo_slots;          ///< memo values (flags follow them)
+};
+
+/// A rel32 field waiting for its label's address
+typedef struct fixup_s {
+    size_t at;                  ///< offset of the rel32 field
+    size_t label;               ///< instruction index or LBL_* past the end
+} fixup_t;
+
+/// Labels after the program's instructions (added to its length)
+enum { LBL_UNDEFINED, LBL_DIVISION, LBL_MODULUS, LBL_FAIL, LBL_COUNT };
+
+/// Assembly buffers of one jit_compile() call
+typedef struct jit_asm_s {
+    interp_ctx_t *ctx;          ///< context whose table stores go to
+    unsigned char *text;
+    size_t text_len;
+    size_t text_cap;
+    size_t *labels;             ///< native offset of each label
+    size_t labels_cap;
+    fixup_t *fixups;
+    size_t fixups_len;
+    size_t fixups_cap;
+} jit_asm_t;
+
+/// Append machine code bytes
+static void put(jit_asm_t *a, const unsigned char *bytes, size_t n)
+{
+    a->text = reserve_work(a->text, &a->text_cap, a->text_len + n, 1);
+    memcpy(a->text + a->text_len, bytes, n);
+    a->text_len += n;
+}
+
+/// Append a little-endian 32-bit field
+static void put32(jit_asm_t *a, uint32_t v)
+{
+    unsigned char b[4] = { v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24 };
+    put(a, b, 4);
+}
+
+/// Append a little-endian 64-bit field
+static void put64(jit_asm_t *a, uint64_t v)
+{
+    put32(a, (uint32_t)v);
+    put32(a, (uint32_t)(v >> 32));
+}
+
+#define PUT(a, ...) do { \
+        static const unsigned char bytes_[] = { __VA_ARGS__ }; \
+        put(a, bytes_, sizeof bytes_); \
+    } while (0)
+
+/// Append a rel32 field that will point at a label
+static void put_label(jit_asm_t *a, size_t label)
+{
+    a->fixups = reserve_work(a->fixups, &a->fixups_cap, a->fixups_len + 1, sizeof(fixup_t));
+    a->fixups[a->fixups_len].at = a->text_len;
+    a->fixups[a->fixups_len].label = label;
+    a->fixups_len++;
+    put32(a, 0);
+}
+
+/// Spill the accumulator: mov [rbx], eax; add rbx, 4
+static void spill(jit_asm_t *a)
+{
+    PUT(a, 0x89, 0x03, 0x48, 0x83, 0xc3, 0x04);
+}
+
+/// Point rcx at a symbol slot: mov rcx, imm64
+static void load_symbol_address(jit_asm_t *a, symbol_t *sym)
+{
+    PUT(a, 0x48, 0xb9);
+    put64(a, (uint64_t)(uintptr_t)sym);
+}
+
+/// Slow path of VM_STORE, taken while the symbol has no value
+/// @return the value, which the generated code keeps as its top
+static int store_symbol(interp_ctx_t *ctx, symbol_t *sym, int val)
+{
+    if (sym->defined) {
+        sym->val = val;
+        sym->changed = 1;
+    } else {
+        define_symbol_r(ctx, sym, val);
+    }
+    return val;
+}
+
+/// Byte offset of a memo value (or of its flag) from the memo base
+static uint32_t memo_offset(size_t slot)
+{
+    return (uint32_t)(slot * sizeof(int));
+}
+
+/// Translate one instruction
+/// Registers: eax = top of stack, rbx = spill pointer, r12 = error
+/// out, r13 = memo values (flags after them), rcx/rdx scratch
+static void translate(jit_asm_t *a, const bytecode_t *bc, const vm_insn_t *pc)
+{
+    uint32_t val_off = (uint32_t)offsetof(symbol_t, val);
+    uint32_t def_off = (uint32_t)offsetof(symbol_t, defined);
+    uint32_t chg_off = (uint32_t)offsetof(symbol_t, changed);
+
+    switch (pc->op) {
+        case VM_PUSH:
+            spill(a);
+            PUT(a, 0xb8);                           // mov eax, imm32
+            put32(a, (uint32_t)pc->arg.imm);
+            break;
+        case VM_LOAD:
+            load_symbol_address(a, pc->arg.sym);
+            PUT(a, 0x83, 0xb9); put32(a, def_off); PUT(a, 0x00);  // cmp dword [rcx+def], 0
+            PUT(a, 0x0f, 0x84); put_label(a, bc->len + LBL_UNDEFINED);  // je
+            spill(a);
+            PUT(a, 0x8b, 0x81); put32(a, val_off);  // mov eax, [rcx+val]
+            break;
+        case VM_STORE:
+            load_symbol_address(a, pc->arg.sym);
+            PUT(a, 0x83, 0xb9); put32(a, def_off); PUT(a, 0x00);  // cmp dword [rcx+def], 0
+            PUT(a, 0x74, 0x12);                     // je slow
+            PUT(a, 0x89, 0x81); put32(a, val_off);  // mov [rcx+val], eax
+            PUT(a, 0xc7, 0x81); put32(a, chg_off); put32(a, 1);  // mov dword [rcx+chg], 1
+            PUT(a, 0xeb, 0x1b);                     // jmp done
+            PUT(a, 0x89, 0xc2, 0x48, 0x89, 0xce);   // slow: mov edx, eax; mov rsi, rcx
+            PUT(a, 0x48, 0xbf);                     // mov rdi, ctx
+            put64(a, (uint64_t)(uintptr_t)a->ctx);
+            PUT(a, 0x48, 0xb8);                     // mov rax, store_symbol
+            put64(a, (uint64_t)(uintptr_t)store_symbol);
+            PUT(a, 0xff, 0xd0);                     // call rax
+            break;
+        case VM_ADD:
+            PUT(a, 0x48, 0x83, 0xeb, 0x04, 0x03, 0x03);     // sub rbx, 4; add eax, [rbx]
+            break;
+        case VM_SUB:
+            PUT(a, 0x48, 0x83, 0xeb, 0x04, 0x89, 0xc1,      // sub rbx, 4; mov ecx, eax
+                0x8b, 0x03, 0x29, 0xc8);                    // mov eax, [rbx]; sub eax, ecx
+            break;
+        case VM_MUL:
+            PUT(a, 0x48, 0x83, 0xeb, 0x04, 0x0f, 0xaf, 0x03);  // sub rbx, 4; imul eax, [rbx]
+            break;
+        case VM_DIV:
+        case VM_MOD:
+            PUT(a, 0x85, 0xc0, 0x0f, 0x84);                 // test eax, eax; je
+            put_label(a, bc->len + (pc->op == VM_DIV ? LBL_DIVISION : LBL_MODULUS));
+            PUT(a, 0x89, 0xc1, 0x48, 0x83, 0xeb, 0x04,      // mov ecx, eax; sub rbx, 4
+                0x8b, 0x03, 0x99, 0xf7, 0xf9);              // mov eax, [rbx]; cdq; idiv ecx
+            if (pc->op == VM_MOD) PUT(a, 0x89, 0xd0);       // mov eax, edx
+            break;
+        case VM_JZ:
+            PUT(a, 0x89, 0xc1, 0x48, 0x83, 0xeb, 0x04,      // mov ecx, eax; sub rbx, 4
+                0x8b, 0x03, 0x85, 0xc9, 0x0f, 0x84);        // mov eax, [rbx]; test ecx, ecx; je
+            put_label(a, pc->arg.target);
+            break;
+        case VM_JMP:
+            PUT(a, 0xe9);
+            put_label(a, pc->arg.target);
+            break;
+        case VM_MEMO:
+            PUT(a, 0x41, 0x83, 0xbd);                       // cmp dword [r13+flag], 0
+            put32(a, memo_offset(bc->memo_slots + pc->slot));
+            PUT(a, 0x00, 0x74, 0x12);                       // je compute
+            spill(a);
+            PUT(a, 0x41, 0x8b, 0x85);                       // mov eax, [r13+value]
+            put32(a, memo_offset(pc->slot));
+            PUT(a, 0xe9);                                   // jmp past the SAVE
+            put_label(a, pc->arg.target);
+            break;
+        case VM_SAVE:
+            PUT(a, 0x41, 0x89, 0x85);                       // mov [r13+value], eax
+            put32(a, memo_offset(pc->slot));
+            PUT(a, 0x41, 0xc7, 0x85);                       // mov dword [r13+flag], 1
+            put32(a, memo_offset(bc->memo_slots + pc->slot));
+            put32(a, 1);
+            break;
+        case VM_RECALL:
+            spill(a);
+            PUT(a, 0x41, 0x8b, 0x85);                       // mov eax, [r13+value]
+            put32(a, memo_offset(pc->slot));
+            break;
+        case VM_FAIL:
+            PUT(a, 0xb9);                                   // mov ecx, imm32
+            put32(a, (uint32_t)pc->arg.imm);
+            PUT(a, 0xe9);
+            put_label(a, bc->len + LBL_FAIL);
+            break;
+        case VM_HALT:
+            PUT(a, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);     // pop r13; pop r12; pop rbx; ret
+            break;
+    }
+}
+
+/// Whether this build generates native code
+int jit_available(void)
+{
+    return 1;
+}
+
+/// Assemble a program, then copy it into a read-only executable mapping
+jit_code_t *jit_compile(interp_ctx_t *ctx, const bytecode_t *bc)
+{
+    jit_asm_t asm_buf = { ctx, NULL, 0, 0, NULL, 0, NULL, 0, 0 };
+    jit_asm_t *a = &asm_buf;
+    size_t *labels = reserve_work(NULL, &a->labels_cap, bc->len + LBL_COUNT, sizeof(size_t));
+    a->labels = labels;
+
+    PUT(a, 0x53, 0x41, 0x54, 0x41, 0x55,            // push rbx; push r12; push r13
+        0x48, 0x89, 0xfb, 0x49, 0x89, 0xf5,         // mov rbx, rdi; mov r13, rsi
+        0x49, 0x89, 0xd4, 0x31, 0xc0);              // mov r12, rdx; xor eax, eax
+
+    for (size_t i = 0; i < bc->len; ++i) {
+        labels[i] = a->text_len;
+        translate(a, bc, &bc->code[i]);
+    }
+
+    /* error exits: store the eval_error_t and return 0 */
+    labels[bc->len + LBL_UNDEFINED] = a->text_len;
+    PUT(a, 0xb9); put32(a, UNDEFINED_SYMBOL);
+    PUT(a, 0xe9); put_label(a, bc->len + LBL_FAIL);
+    labels[bc->len + LBL_DIVISION] = a->text_len;
+    PUT(a, 0xb9); put32(a, DIVISION_BY_ZERO);
+    PUT(a, 0xe9); put_label(a, bc->len + LBL_FAIL);
+    labels[bc->len + LBL_MODULUS] = a->text_len;
+    PUT(a, 0xb9); put32(a, INVALID_MODULUS);
+    labels[bc->len + LBL_FAIL] = a->text_len;
+    PUT(a, 0x41, 0x89, 0x0c, 0x24, 0x31, 0xc0,      // mov [r12], ecx; xor eax, eax
+        0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);        // pop r13; pop r12; pop rbx; ret
+
+    for (size_t i = 0; i < a->fixups_len; ++i) {
+        fixup_t *fx = &a->fixups[i];
+        int32_t rel = (int32_t)((long)labels[fx->label] - (long)(fx->at + 4));
+        uint32_t v = (uint32_t)rel;
+        unsigned char *p = a->text + fx->at;
+        p[0] = v & 0xff;
+        p[1] = (v >> 8) & 0xff;
+        p[2] = (v >> 16) & 0xff;
+        p[3] = v >> 24;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t map_size = (a->text_len + (size_t)page - 1) & ~((size_t)page - 1);
+    void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map != MAP_FAILED) {
+        memcpy(map, a->text, a->text_len);
+        if (mprotect(map, map_size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(map, map_size);              // no executable memory here
+            map = MAP_FAILED;
+        }
+    }
+    free(a->text);
+    free(a->labels);
+    free(a->fixups);
+    if (map == MAP_FAILED) return NULL;
+
+    jit_code_t *code = malloc(sizeof(jit_code_t));
+    if (!code) {
+        perror("malloc jit code");
+        exit(EXIT_FAILURE);
+    }
+    *(void **)&code->entry = map;               // object to function pointer, as with dlsym()
+    code->map = map;
+    code->map_size = map_size;
+    code->max_depth = bc->max_depth;
+    code->memo_slots = bc->memo_slots;
+    return code;
+}
+
+/// Run native code on a stack laid out as for vm_exec()
+int jit_run(const jit_code_t *code, int *stack, eval_error_t *err)
+{
+    int *memo = stack + code->max_depth + 1;
+    for (size_t i = 0; i < code->memo_slots; ++i) memo[code->memo_slots + i] = 0;
+
+    int raw = EVAL_NONE;
+    int value = code->entry(stack, memo, &raw);
+    *err = (eval_error_t)raw;
+    return value;
+}
+
+/// Unmap native code
+void jit_release(jit_code_t *code)
+{
+    if (!code) return;
+    munmap(code->map, code->map_size);
+    free(code);
+}
+
+#else /* no native code generator: every caller stays on the VM */
+
+/// Whether this build generates native code
+int jit_available(void)
+{
+    return 0;
+}
+
+/// Native code is never available
+jit_code_t *jit_compile(interp_ctx_t *ctx, const bytecode_t *bc)
+{
+    (void)ctx;
+    (void)bc;
+    return NULL;
+}
+
+/// Never called, since jit_compile() always fails
+int jit_run(const jit_code_t *code, int *stack, eval_error_t *err)
+{
+    (void)code;
+    (void)stack;
+    *err = UNKNOWN_OPERATION;
+    return 0;
+}
+
+/// Nothing to release
+void jit_release(jit_code_t *code)
+{
+    (void)code;
+}
+
+#endif
@@ -0,0 +1,44 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include "bytecode.h"
+#include "parser.h"
+
+#define JIT_HOT_RUNS 4          // runs of a cached expression before it is compiled
+#define JIT_CACHE_SIZE 1024     // cache entries --jit turns on when --cache is not given
+
+// Native x86-64 code for one compiled expression.  The generator is
+// left out when built with -DNO_JIT, and on hosts other than x86-64
+// Unix; jit_compile() then always fails and callers stay on the VM.
+typedef struct jit_code_s jit_code_t;
+
+/// Tells whether this build can generate native code.
+/// @return nonzero on x86-64 Unix builds without NO_JIT
+int jit_available(void);
+
+/// Translates a compiled expression into machine code in its own
+/// executable mapping.  The operand stack stays in memory and the top
+/// value in a register, as in the VM; symbol slots are addressed
+/// directly, and ternaries and memo slots become branches.
+/// @param ctx  the context whose table gets symbols the code assigns
+///     for the first time (it must outlive the result)
+/// @param bc  the program (its symbol slots must outlive the result)
+/// @return the native code, or NULL if it cannot be generated here
+jit_code_t *jit_compile(interp_ctx_t *ctx, const bytecode_t *bc);
+
+/// Runs native code exactly as vm_exec() would run its program: the
+/// same value, the same assignments and the same first error.
+/// @param code  the native code
+/// @param stack  operand stack of at least vm_stack_size() ints
+/// @param[out] err  EVAL_NONE, or the first error raised
+/// @return the value of the expression (0 after an error)
+int jit_run(const jit_code_t *code, int *stack, eval_error_t *err);
+
+/// Unmaps native code.
+/// @param code  the code to release (NULL is ignored)
+void jit_release(jit_code_t *code);
+
+#endif
@@ -0,0 +1,107 @@
+// line_reader.c
+// Unbounded line input on a reusable buffer, plus comment/space cleanup
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include "line_reader.h"
+
+#define READER_MIN_CAP 4096     ///< first buffer size
+
+/// Set up a reader with no buffer yet
+void reader_init(line_reader_t *reader, FILE *in, size_t max_line)
+{
+    reader->in = in;
+    reader->buf = NULL;
+    reader->cap = 0;
+    reader->max_line = max_line;
+}
+
+/// Double the buffer, but never past what the limit needs
+/// (max_line characters, a newline and the null byte)
+static void grow_buffer(line_reader_t *reader)
+{
+    size_t cap = reader->cap ? reader->cap * 2 : READER_MIN_CAP;
+    if (reader->max_line && cap > reader->max_line + 2) cap = reader->max_line + 2;
+    if (cap <= reader->cap) cap = reader->cap + 1;
+
+    char *buf = realloc(reader->buf, cap);
+    if (!buf) {
+        perror("realloc line buffer");
+        exit(EXIT_FAILURE);
+    }
+    reader->buf = buf;
+    reader->cap = cap;
+}
+
+/// Skip input up to and including the next newline
+static void discard_rest(FILE *in)
+{
+    int c;
+    while ((c = getc(in)) != EOF && c != '\n') ;
+}
+
+/// Read one line of any length (up to the limit)
+line_status_t read_line(line_reader_t *reader, char **line, size_t *len)
+{
+    size_t n = 0;
+
+    for (;;) {
+        if (reader->cap - n < 2) grow_buffer(reader);
+
+        size_t room = reader->cap - n;
+        if (room > INT_MAX) room = INT_MAX;
+        if (!fgets(reader->buf + n, (int)room, reader->in)) {
+            if (n == 0) return LINE_EOF;
+            break;                              // last line had no newline
+        }
+        n += strlen(reader->buf + n);
+
+        if (n > 0 && reader->buf[n - 1] == '\n') {
+            reader->buf[--n] = '\0';
+            break;
+        }
+        if (reader->max_line && n > reader->max_line) {
+            discard_rest(reader->in);
+            return LINE_TOO_LONG;
+        }
+    }
+
+    if (reader->max_line && n > reader->max_line) return LINE_TOO_LONG;
+
+    *line = reader->buf;
+    *len = n;
+    return LINE_OK;
+}
+
+/// Free the line buffer
+void reader_free(line_reader_t *reader)
+{
+    free(reader->buf);
+    reader->buf = NULL;
+    reader->cap = 0;
+}
+
+/// Locate the expression: stop at '#', trim whitespace on both ends
+char *clean_line(char *line, size_t len, size_t *out_len)
+{
+    size_t first = len;             // first non-space character
+    size_t last = 0;                // one past the last non-space character
+
+    for (size_t i = 0; i < len && line[i] != '#'; ++i) {
+        if (!isspace((unsigned char)line[i])) {
+            if (first == len) first = i;
+            last = i + 1;
+        }
+    }
+
+    if (first == len) {
+        *out_len = 0;
+        return line;
+    }
+    *out_len = last - first;
+    return line + first;
+}
@@ -0,0 +1,53 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Result of reading one line
+typedef enum line_status_e {
+    LINE_OK,                    // a line was read
+    LINE_EOF,                   // no more input
+    LINE_TOO_LONG               // line exceeded the limit and was discarded
+} line_status_t;
+
+// Reads lines of any length into one growable buffer that is reused
+// for every line, so once it has grown to the longest line seen no
+// more allocation happens.
+typedef struct line_reader_s {
+    FILE *in;                   // the input stream
+    char *buf;                  // the current line (null-terminated)
+    size_t cap;                 // allocated size of buf
+    size_t max_line;            // longest accepted line, 0 for no limit
+} line_reader_t;
+
+/// Initializes a reader.
+/// @param reader  the reader to initialize
+/// @param in  the stream to read from
+/// @param max_line  longest line accepted (without the newline), or 0
+void reader_init(line_reader_t *reader, FILE *in, size_t max_line);
+
+/// Reads the next line, without its newline.
+/// @param reader  the reader
+/// @param[out] line  the line; valid until the next call
+/// @param[out] len  the length of the line
+/// @return LINE_OK, LINE_EOF, or LINE_TOO_LONG if the line was longer
+///     than the limit (the rest of it is skipped)
+line_status_t read_line(line_reader_t *reader, char **line, size_t *len);
+
+/// Releases the line buffer.
+/// @param reader  the reader
+void reader_free(line_reader_t *reader);
+
+/// Finds the expression in a raw input line in a single pass: text
+/// from the first '#' on is a comment, and surrounding whitespace is
+/// trimmed.  The line is not modified.
+/// @param line  the raw line
+/// @param len  its length
+/// @param[out] out_len  length of the expression (0 if there is none)
+/// @return the first character of the expression
+char *clean_line(char *line, size_t len, size_t *out_len);
+
+#endif
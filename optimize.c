@@ -0,0 +1,182 @@
+// optimize.c
+// Constant folding and algebraic simplification of parse trees, done
+// once before evaluation; errors the evaluator would raise are kept
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "optimize.h"
+#include "util.h"
+
+/// One pending node of the folding walk
+typedef struct fold_frame_s {
+    tree_node_t *node;          ///< node being simplified
+    int state;                  ///< 0 before its children, 1 after
+} fold_frame_t;
+
+/// Push a node onto the frame stack
+static size_t push_node(fold_work_t *w, size_t sp, tree_node_t *node)
+{
+    w->frames = reserve_work(w->frames, &w->frames_cap, sp + 1, sizeof(fold_frame_t));
+    w->frames[sp].node = node;
+    w->frames[sp].state = 0;
+    return sp + 1;
+}
+
+/// Push a simplified subtree onto the result stack
+static size_t push_result(fold_work_t *w, size_t rp, tree_node_t *node)
+{
+    w->results = reserve_work(w->results, &w->results_cap, rp + 1, sizeof(tree_node_t *));
+    w->results[rp] = node;
+    return rp + 1;
+}
+
+/// Whether a node is an INTEGER leaf, and its value
+static int is_constant(tree_node_t *node, int *value)
+{
+    if (!node || node->type != LEAF) return 0;
+    leaf_node_t *ln = (leaf_node_t *)node->node;
+    if (ln->exp_type != INTEGER) return 0;
+    *value = ln->value;
+    return 1;
+}
+
+/// An INTEGER leaf holding value, in place of node
+static tree_node_t *constant_leaf(arena_t *arena, tree_node_t *node, int value)
+{
+    token_t tok = { node->token, node->token_len };
+    tree_node_t *leaf = make_leaf(arena, INTEGER, tok);
+    ((leaf_node_t *)leaf->node)->value = value;
+    return leaf;
+}
+
+/// node with new children, or node itself if they did not change
+static tree_node_t *rebuild(arena_t *arena, tree_node_t *node,
+                            tree_node_t *left, tree_node_t *right)
+{
+    interior_node_t *in = (interior_node_t *)node->node;
+    if (left == in->left && right == in->right) return node;
+    token_t tok = { node->token, node->token_len };
+    return make_interior(arena, in->op, tok, left, right);
+}
+
+/// Compute a binary operation on constants the way the evaluator does
+/// (+, - and * wrap around)
+/// @return 1 with the value, or 0 if evaluating it would fail
+static int fold_binary(op_type_t op, int l, int r, int *value)
+{
+    switch (op) {
+        case ADD_OP: *value = (int)((unsigned int)l + (unsigned int)r); return 1;
+        case SUB_OP: *value = (int)((unsigned int)l - (unsigned int)r); return 1;
+        case MUL_OP: *value = (int)((unsigned int)l * (unsigned int)r); return 1;
+        case DIV_OP:
+            if (r == 0 || (l == INT_MIN && r == -1)) return 0;
+            *value = l / r;
+            return 1;
+        case MOD_OP:
+            if (r == 0 || (l == INT_MIN && r == -1)) return 0;
+            *value = l % r;
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/// Simplify a binary operator whose operands are already simplified
+static tree_node_t *simplify_binary(arena_t *arena, tree_node_t *node,
+                                    tree_node_t *left, tree_node_t *right)
+{
+    op_type_t op = ((interior_node_t *)node->node)->op;
+    int l, r, value;
+    int lconst = is_constant(left, &l);
+    int rconst = is_constant(right, &r);
+
+    if (lconst && rconst && fold_binary(op, l, r, &value))
+        return constant_leaf(arena, node, value);
+
+    /* identities that drop only a constant operand */
+    if (rconst && r == 0 && (op == ADD_OP || op == SUB_OP)) return left;
+    if (rconst && r == 1 && (op == MUL_OP || op == DIV_OP)) return left;
+    if (lconst && l == 0 && op == ADD_OP) return right;
+    if (lconst && l == 1 && op == MUL_OP) return right;
+
+    return rebuild(arena, node, left, right);
+}
+
+/// Simplify a tree without recursion
+/// Each finished subtree leaves its simplified form on the result
+/// stack; a node then takes its children's forms off the top
+tree_node_t *fold_tree(fold_work_t *w, arena_t *arena, tree_node_t *root)
+{
+    size_t sp = push_node(w, 0, root);
+    size_t rp = 0;
+
+    while (sp > 0) {
+        fold_frame_t *f = &w->frames[sp - 1];
+        tree_node_t *node = f->node;
+
+        if (!node || node->type == LEAF) {
+            rp = push_result(w, rp, node);
+            sp--;
+            continue;
+        }
+
+        interior_node_t *in = (interior_node_t *)node->node;
+        if (f->state == 0) {
+            f->state = 1;
+            if (in->op == ASSIGN_OP) {
+                sp = push_node(w, sp, in->right);       // the target stays as is
+            } else if (in->op == Q_OP && in->right && in->right->type == INTERIOR) {
+                interior_node_t *alt = (interior_node_t *)in->right->node;
+                sp = push_node(w, sp, alt->right);
+                sp = push_node(w, sp, alt->left);
+                sp = push_node(w, sp, in->left);
+            } else {
+                sp = push_node(w, sp, in->right);
+                sp = push_node(w, sp, in->left);
+            }
+            continue;
+        }
+        sp--;
+
+        tree_node_t *folded;
+        if (in->op == ASSIGN_OP) {
+            tree_node_t *right = w->results[--rp];
+            folded = rebuild(arena, node, in->left, right);
+        } else if (in->op == Q_OP && in->right && in->right->type == INTERIOR) {
+            tree_node_t *other = w->results[--rp];
+            tree_node_t *then = w->results[--rp];
+            tree_node_t *test = w->results[--rp];
+            int t;
+            if (is_constant(test, &t)) {
+                folded = t ? then : other;           // the dead branch never runs
+            } else {
+                tree_node_t *alt = rebuild(arena, in->right, then, other);
+                folded = rebuild(arena, node, test, alt);
+            }
+        } else if (in->op == Q_OP) {
+            tree_node_t *right = w->results[--rp];
+            tree_node_t *left = w->results[--rp];
+            folded = rebuild(arena, node, left, right);
+        } else {
+            tree_node_t *right = w->results[--rp];
+            tree_node_t *left = w->results[--rp];
+            folded = simplify_binary(arena, node, left, right);
+        }
+        rp = push_result(w, rp, folded);
+    }
+
+    return w->results[0];
+}
+
+/// Free the work stacks
+void fold_work_free(fold_work_t *w)
+{
+    free(w->frames);
+    free(w->results);
+    w->frames = NULL;
+    w->frames_cap = 0;
+    w->results = NULL;
+    w->results_cap = 0;
+}
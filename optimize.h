@@ -0,0 +1,45 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "tree_node.h"
+#include "arena.h"
+
+// Work stacks of fold_tree(), kept between calls by their owner (one
+// per interpreter context).  A zero-filled one is empty.
+typedef struct fold_work_s {
+    struct fold_frame_s *frames;    // pending nodes
+    size_t frames_cap;
+    tree_node_t **results;          // simplified children, in order
+    size_t results_cap;
+} fold_work_t;
+
+/// Builds a simplified version of a bound parse tree for evaluation:
+///
+///     - operators whose operands are all INTEGER leaves become a leaf
+///       holding the value (3 4 * 2 + becomes 14)
+///     - x 0 +, 0 x +, x 0 -, x 1 *, 1 x * and x 1 / become x
+///     - a ternary whose test is constant becomes the branch it picks
+///
+/// Nothing that could raise an error at run time is folded away: a
+/// division or modulus by a constant 0 (and INT_MIN / -1) is left for
+/// the evaluator, and only constant operands are ever dropped, so the
+/// simplified tree raises the same errors in the same order and makes
+/// the same assignments as the original.
+///
+/// The original tree is not changed; unchanged subtrees are shared
+/// with it, and new nodes come from the arena.  Folded leaves carry
+/// the token of the operator they replace.
+/// @param work  work stacks to use (they grow as needed)
+/// @param arena  the arena for new nodes
+/// @param root  the root of the tree (already bound by bind_tree())
+/// @return the root of the simplified tree (root itself if nothing
+///     could be simplified)
+tree_node_t *fold_tree(fold_work_t *work, arena_t *arena, tree_node_t *root);
+
+/// Releases the work stacks of fold_tree().
+/// @param work  the stacks to free
+void fold_work_free(fold_work_t *work);
+
+#endif
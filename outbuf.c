@@ -0,0 +1,195 @@
+// outbuf.c
+// Buffered output writer: one reusable buffer, hand-rolled integer
+// formatting, and large fwrite() chunks instead of a printf per token
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "outbuf.h"
+#include "stats.h"
+
+static outbuf_t std_out;            ///< Buffer for standard output
+static int std_out_ready = 0;
+
+/// Set up a stream buffer
+void ob_init(outbuf_t *ob, FILE *out, size_t size)
+{
+    if (size == 0) size = OUTBUF_SIZE;
+    ob->buf = malloc(size);
+    if (!ob->buf) {
+        perror("malloc output buffer");
+        exit(EXIT_FAILURE);
+    }
+    ob->out = out;
+    ob->len = 0;
+    ob->cap = size;
+    ob->dropped = 0;
+    ob->grow = 0;
+#ifndef NO_STATS
+    ob->writes = 0;
+    ob->written = 0;
+    ob->write_ns = 0;
+#endif
+}
+
+/// Set up a buffer over caller memory, leaving room for the null byte
+void ob_init_mem(outbuf_t *ob, char *buf, size_t size)
+{
+    ob->out = NULL;
+    ob->buf = buf;
+    ob->len = 0;
+    ob->cap = size ? size - 1 : 0;
+    ob->dropped = 0;
+    ob->grow = 0;
+#ifndef NO_STATS
+    ob->writes = 0;
+    ob->written = 0;
+    ob->write_ns = 0;
+#endif
+    if (size) buf[0] = '\0';
+}
+
+/// Set up a growing heap buffer, leaving room for the null byte
+void ob_init_heap(outbuf_t *ob)
+{
+    ob_init(ob, NULL, 0);
+    ob->cap--;
+    ob->buf[0] = '\0';
+    ob->grow = 1;
+}
+
+/// Make room for at least len more bytes in a heap buffer
+static void grow_heap(outbuf_t *ob, size_t len)
+{
+    size_t cap = ob->cap + 1;
+    while (cap - 1 - ob->len < len) cap *= 2;
+    char *buf = realloc(ob->buf, cap);
+    if (!buf) {
+        perror("realloc output buffer");
+        exit(EXIT_FAILURE);
+    }
+    ob->buf = buf;
+    ob->cap = cap - 1;
+}
+
+/// Flush the stdout buffer at exit, so output written before an
+/// exit() on an error path is not lost
+static void flush_std_out(void)
+{
+    ob_free(&std_out);
+}
+
+/// The shared stdout buffer
+outbuf_t *ob_stdout(void)
+{
+    if (!std_out_ready) {
+        ob_init(&std_out, stdout, 0);
+        std_out_ready = 1;
+        atexit(flush_std_out);
+    }
+    return &std_out;
+}
+
+/// Hand bytes to the stream, counting the write for --stats
+static void write_out(outbuf_t *ob, const char *str, size_t len)
+{
+#ifndef NO_STATS
+    uint64_t start = stats_now();
+    fwrite(str, 1, len, ob->out);
+    ob->write_ns += stats_now() - start;
+    ob->writes++;
+    ob->written += len;
+#else
+    fwrite(str, 1, len, ob->out);
+#endif
+}
+
+/// Write out the buffered text
+void ob_flush(outbuf_t *ob)
+{
+    if (!ob->out || ob->len == 0) return;
+    write_out(ob, ob->buf, ob->len);
+    fflush(ob->out);
+    ob->len = 0;
+}
+
+/// Append bytes; when they do not fit, a stream buffer is flushed
+/// (text larger than the whole buffer is written straight through),
+/// a heap buffer grows, and caller memory keeps what fits
+void ob_write(outbuf_t *ob, const char *str, size_t len)
+{
+    if (ob->cap - ob->len < len) {
+        if (ob->grow) {
+            grow_heap(ob, len);
+        } else if (ob->out) {
+            ob_flush(ob);
+            if (len > ob->cap) {
+                write_out(ob, str, len);
+                return;
+            }
+        } else {
+            size_t fit = ob->cap - ob->len;
+            memcpy(ob->buf + ob->len, str, fit);
+            ob->len += fit;
+            ob->dropped += len - fit;
+            ob->buf[ob->len] = '\0';
+            return;
+        }
+    }
+    memcpy(ob->buf + ob->len, str, len);
+    ob->len += len;
+    if (!ob->out) ob->buf[ob->len] = '\0';
+}
+
+/// Append a null-terminated string
+void ob_puts(outbuf_t *ob, const char *str)
+{
+    ob_write(ob, str, strlen(str));
+}
+
+/// Append one character
+void ob_putc(outbuf_t *ob, char c)
+{
+    if (ob->len < ob->cap) {
+        ob->buf[ob->len++] = c;
+        if (!ob->out) ob->buf[ob->len] = '\0';
+    } else {
+        ob_write(ob, &c, 1);
+    }
+}
+
+/// Append an int in decimal
+/// Digits are produced right to left from the magnitude as unsigned,
+/// which also covers INT_MIN
+void ob_int(outbuf_t *ob, int value)
+{
+    char digits[16];
+    char *p = digits + sizeof(digits);
+    unsigned int mag = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+    do {
+        *--p = (char)('0' + mag % 10);
+        mag /= 10;
+    } while (mag);
+    if (value < 0) *--p = '-';
+
+    ob_write(ob, p, (size_t)(digits + sizeof(digits) - p));
+}
+
+/// Length of everything written, stored or not
+size_t ob_length(const outbuf_t *ob)
+{
+    return ob->len + ob->dropped;
+}
+
+/// Flush and release a stream or heap buffer
+void ob_free(outbuf_t *ob)
+{
+    if (!ob->out && !ob->grow) return;
+    ob_flush(ob);
+    free(ob->buf);
+    ob->buf = NULL;
+    ob->len = 0;
+    ob->cap = 0;
+}
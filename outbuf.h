@@ -0,0 +1,87 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#define OUTBUF_SIZE 65536           // default buffer size in bytes
+
+// An output buffer.  Text is collected in one reusable buffer and
+// written out in large fwrite() chunks.  A buffer with no stream
+// either writes into fixed caller memory and drops what does not fit,
+// or keeps everything in heap memory that grows.
+typedef struct outbuf_s {
+    FILE *out;                      // destination, or NULL for memory
+    char *buf;                      // collected text
+    size_t len;                     // bytes in buf
+    size_t cap;                     // usable size of buf
+    size_t dropped;                 // bytes that did not fit (caller memory)
+    int grow;                       // heap memory that grows as needed
+#ifndef NO_STATS
+    unsigned long long writes;      // fwrite() calls (for --stats)
+    unsigned long long written;     // bytes they wrote
+    unsigned long long write_ns;    // time spent in them
+#endif
+} outbuf_t;
+
+/// Initializes a buffer that writes to a stream.
+/// @param ob  the buffer to initialize
+/// @param out  the stream to write to
+/// @param size  buffer size, or 0 for OUTBUF_SIZE
+void ob_init(outbuf_t *ob, FILE *out, size_t size);
+
+/// Initializes a buffer over caller memory.  The text is kept
+/// null-terminated, so at most size - 1 characters are stored.
+/// @param ob  the buffer to initialize
+/// @param buf  the memory to write into
+/// @param size  its size in bytes (at least 1)
+void ob_init_mem(outbuf_t *ob, char *buf, size_t size);
+
+/// Initializes a buffer that keeps its text in growing heap memory.
+/// The text stays null-terminated.  ob_free() releases it.
+/// @param ob  the buffer to initialize
+void ob_init_heap(outbuf_t *ob);
+
+/// The buffer for standard output, set up on first use.  It is
+/// flushed at exit.
+/// @return the shared stdout buffer
+outbuf_t *ob_stdout(void);
+
+/// Appends bytes.
+/// @param ob  the buffer
+/// @param str  the bytes to append
+/// @param len  how many
+void ob_write(outbuf_t *ob, const char *str, size_t len);
+
+/// Appends a null-terminated string.
+/// @param ob  the buffer
+/// @param str  the string
+void ob_puts(outbuf_t *ob, const char *str);
+
+/// Appends one character.
+/// @param ob  the buffer
+/// @param c  the character
+void ob_putc(outbuf_t *ob, char c);
+
+/// Appends an int in decimal, formatted by hand.
+/// @param ob  the buffer
+/// @param value  the number
+void ob_int(outbuf_t *ob, int value);
+
+/// Writes out everything collected so far (no-op for caller memory).
+/// @param ob  the buffer
+void ob_flush(outbuf_t *ob);
+
+/// Total length of the text written to a caller-memory buffer,
+/// including anything that was dropped.
+/// @param ob  the buffer
+/// @return the untruncated length
+size_t ob_length(const outbuf_t *ob);
+
+/// Flushes a stream buffer or heap buffer and releases its memory.
+/// @param ob  the buffer
+void ob_free(outbuf_t *ob);
+
+#endif
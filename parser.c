@@ -9,296 +9,897 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "parser.h"
 #include "tree_node.h"
 #include "stack.h"
 #include "symtab.h"
+#include "bytecode.h"
+#include "outbuf.h"
+#include "expr_cache.h"
+#include "optimize.h"
+#include "cse.h"
+#include "jit.h"
+#include "vector.h"
+#include "interp_ctx.h"
+#include "stats.h"
+#include "reactive.h"
+#include "util.h"
+
+// Every piece of state lives in the interp_ctx_t passed to each
+// function; the functions without _r run on default_ctx()
+
+/// One pending step of an iterative tree walk
+typedef struct frame_s {
+    tree_node_t *node;             ///< node being visited
+    int state;                     ///< how many of its children are done
+    int left;                      ///< value of the left operand
+} frame_t;
+
+/// One pending step of the iterative parser
+typedef enum parse_step_e {
+    PARSE_TOKEN,                   ///< parse one subexpression (a recursive call)
+    BUILD_BINARY,                  ///< join the last two results with op
+    BUILD_TERNARY                  ///< join the last three results into ?:
+} parse_step_t;
+
+typedef struct parse_item_s {
+    parse_step_t step;
+    token_t token;                 ///< operator token for BUILD_* steps
+} parse_item_t;
+
+/// The arena that holds the tree of the expression being processed
+static arena_t *tree_arena(interp_ctx_t *ctx)
+{
+    if (!ctx->expr_arena_ready) {
+        arena_init(&ctx->expr_arena, 0);
+        ctx->expr_arena_ready = 1;
+    }
+    return &ctx->expr_arena;
+}
 
-static parse_error_t parser_error = PARSE_NONE;   ///< Current parsing error state
-static eval_error_t evaluator_error = EVAL_NONE;  ///< Current evaluation error state
+/// Push a node onto the frame stack
+/// The work stacks of the iterative walks only ever grow, so after the
+/// first few lines no walk allocates
+/// @param ctx the context that owns the stack
+/// @param sp current frame count
+/// @param node node to visit
+/// @return the new frame count
+static size_t push_frame(interp_ctx_t *ctx, size_t sp, tree_node_t *node)
+{
+    ctx->frames = reserve_work(ctx->frames, &ctx->frames_cap, sp + 1, sizeof(frame_t));
+    frame_t *f = &ctx->frames[sp];
+    f->node = node;
+    f->state = 0;
+    f->left = 0;
+    return sp + 1;
+}
 
-/// Custom re-entrant tokenizer (C99-safe)
-static char *my_strtok_r(char *str, const char *delim, char **saveptr)
+/// Token delimiters
+static int is_delim(char c)
 {
-    char *token;
-    if (str != NULL) *saveptr = str;
-    if (*saveptr == NULL) return NULL;
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
 
-    *saveptr += strspn(*saveptr, delim);
-    if (**saveptr == '\0') { *saveptr = NULL; return NULL; }
+/// Slice the next token out of [*cursor, end) without copying it
+/// @param cursor scan position, advanced past the token
+/// @param end one past the last character of the line
+/// @param[out] tok the token found
+/// @return 1 if a token was found, 0 at the end of the line
+static int next_token(char **cursor, char *end, token_t *tok)
+{
+    char *p = *cursor;
+    while (p < end && is_delim(*p)) p++;
+    if (p == end) { *cursor = p; return 0; }
+
+    tok->str = p;
+    while (p < end && !is_delim(*p)) p++;
+    tok->len = (size_t)(p - tok->str);
+    *cursor = p;
+    return 1;
+}
 
-    token = *saveptr;
-    *saveptr = strpbrk(token, delim);
-    if (*saveptr) { **saveptr = '\0'; (*saveptr)++; }
-    return token;
+static void set_parse_error(interp_ctx_t *ctx, parse_error_t e, const char *msg) {
+    ctx->parser_error = e;
+    if (!msg) return;
+    if (ctx->error_out) {
+        ob_puts(ctx->error_out, msg);
+        ob_putc(ctx->error_out, '\n');
+    } else {
+        fprintf(stderr, "%s\n", msg);
+    }
 }
 
-static void set_parse_error(parse_error_t e, const char *msg) {
-    parser_error = e;
-    if (msg) fprintf(stderr, "%s\n", msg);
+/// Send parse error messages to a buffer instead of stderr
+void set_error_output_r(interp_ctx_t *ctx, outbuf_t *ob)
+{
+    ctx->error_out = ob;
 }
 
-static void set_eval_error(eval_error_t e, const char *msg) {
-    evaluator_error = e;
+/// Send results to a buffer instead of the stdout buffer
+void set_output_r(interp_ctx_t *ctx, outbuf_t *ob)
+{
+    ctx->out = ob;
+}
+
+/// Message printed for each evaluation error
+const char *eval_error_message(eval_error_t e) {
+    switch (e) {
+        case DIVISION_BY_ZERO:  return "Division by zero";
+        case INVALID_MODULUS:   return "Invalid modulus";
+        case UNDEFINED_SYMBOL:  return "Undefined symbol";
+        case UNKNOWN_OPERATION: return "Unknown operation";
+        case UNKNOWN_EXP_TYPE:  return "Unknown expression type";
+        case MISSING_LVALUE:    return "Missing l-value";
+        case INVALID_LVALUE:    return "Invalid l-value";
+        case SYMTAB_FULL:       return "No room in symbol table";
+        default:                return NULL;
+    }
+}
+
+static void set_eval_error(interp_ctx_t *ctx, eval_error_t e) {
+    ctx->evaluator_error = e;
+    const char *msg = eval_error_message(e);
     if (msg) fprintf(stderr, "%s\n", msg);
 }
 
-static int is_op_token(const char *tok) {
-    return (strcmp(tok, ADD_OP_STR) == 0) ||
-           (strcmp(tok, SUB_OP_STR) == 0) ||
-           (strcmp(tok, MUL_OP_STR) == 0) ||
-           (strcmp(tok, DIV_OP_STR) == 0) ||
-           (strcmp(tok, MOD_OP_STR) == 0) ||
-           (strcmp(tok, Q_OP_STR)   == 0) ||
-           (strcmp(tok, ASSIGN_OP_STR) == 0);
-}
-
-static op_type_t tok_to_op(const char *tok) {
-    if (strcmp(tok, ADD_OP_STR) == 0) return ADD_OP;
-    if (strcmp(tok, SUB_OP_STR) == 0) return SUB_OP;
-    if (strcmp(tok, MUL_OP_STR) == 0) return MUL_OP;
-    if (strcmp(tok, DIV_OP_STR) == 0) return DIV_OP;
-    if (strcmp(tok, MOD_OP_STR) == 0) return MOD_OP;
-    if (strcmp(tok, ASSIGN_OP_STR) == 0) return ASSIGN_OP;
-    if (strcmp(tok, Q_OP_STR) == 0) return Q_OP;
-    return NO_OP;
-}
-
-static int is_integer_token(const char *tok) {
-    if (!tok || !tok[0]) return 0;
-    if (!isdigit((unsigned char)tok[0])) return 0;
-    for (size_t i = 1; tok[i]; ++i)
-        if (!isdigit((unsigned char)tok[i])) return 0;
+/// Operator named by a token
+/// @param tok the token
+/// @return the operation, or NO_OP if the token is not an operator
+static op_type_t tok_to_op(const token_t *tok) {
+    if (tok->len != 1) return NO_OP;
+    switch (tok->str[0]) {
+        case '+': return ADD_OP;
+        case '-': return SUB_OP;
+        case '*': return MUL_OP;
+        case '/': return DIV_OP;
+        case '%': return MOD_OP;
+        case '=': return ASSIGN_OP;
+        case '?': return Q_OP;
+        default:  return NO_OP;
+    }
+}
+
+/// Check for an integer literal and decode it in the same scan
+/// @param tok the token
+/// @param[out] value the decoded literal
+/// @return 1 if decoded, 0 if not an integer, -1 if it overflows an int
+static int decode_integer_token(const token_t *tok, int *value) {
+    if (tok->len == 0) return 0;
+    if (!isdigit((unsigned char)tok->str[0])) return 0;
+    int overflow = 0;
+    int v = 0;
+    for (size_t i = 0; i < tok->len; ++i) {
+        if (!isdigit((unsigned char)tok->str[i])) return 0;
+        int d = tok->str[i] - '0';
+        if (v > (INT_MAX - d) / 10) overflow = 1;
+        else v = v * 10 + d;
+    }
+    if (overflow) return -1;
+    *value = v;
     return 1;
 }
 
-static int is_symbol_token(const char *tok) {
-    if (!tok || !tok[0]) return 0;
-    if (!isalpha((unsigned char)tok[0])) return 0;
-    for (size_t i = 1; tok[i]; ++i)
-        if (!isalnum((unsigned char)tok[i])) return 0;
+static int is_symbol_token(const token_t *tok) {
+    if (tok->len == 0) return 0;
+    if (!isalpha((unsigned char)tok->str[0])) return 0;
+    for (size_t i = 1; i < tok->len; ++i)
+        if (!isalnum((unsigned char)tok->str[i])) return 0;
     return 1;
 }
 
-/// Recursive parser - builds tree from postfix tokens on stack
-/// @param stack stack with tokens (top = last token)
-/// @return root node or NULL on error
-tree_node_t *parse(stack_t *stack)
+/// Leaf for a non-operator token
+/// @param token the token
+/// @return the leaf, or NULL after reporting a parse error
+static tree_node_t *parse_leaf(interp_ctx_t *ctx, token_t token)
 {
-    if (!stack || empty_stack(stack)) {
-        set_parse_error(TOO_FEW_TOKENS, "Invalid expression, not enough tokens");
+    int value;
+    int kind = decode_integer_token(&token, &value);
+    if (kind > 0) {
+        tree_node_t *leaf = make_leaf(tree_arena(ctx), INTEGER, token);
+        ((leaf_node_t *)leaf->node)->value = value;
+        STAT_ADD(&ctx->stats, nodes, 1);
+        return leaf;
+    } else if (kind < 0) {
+        set_parse_error(ctx, INTEGER_OUT_OF_RANGE, "Integer literal out of range");
+        return NULL;
+    } else if (is_symbol_token(&token)) {
+        STAT_ADD(&ctx->stats, nodes, 1);
+        return make_leaf(tree_arena(ctx), SYMBOL, token);
+    } else {
+        set_parse_error(ctx, ILLEGAL_TOKEN, "Illegal token");
         return NULL;
     }
+}
 
-    // FIXED: Do NOT strdup here — the stack already owns a copy!
-    char *token = (char *)top(stack);
-    pop(stack);
-
-    if (is_op_token(token)) {
-        if (strcmp(token, Q_OP_STR) == 0) {
-            tree_node_t *expr_false = parse(stack);
-            tree_node_t *expr_true  = parse(stack);
-            tree_node_t *test_expr  = parse(stack);
-
-            if (parser_error != PARSE_NONE) {
-                cleanup_tree(expr_false);
-                cleanup_tree(expr_true);
-                cleanup_tree(test_expr);
-                return NULL;
+/// Queue a parser step
+static void push_item(interp_ctx_t *ctx, size_t *wp, parse_step_t step, token_t token)
+{
+    ctx->parse_items = reserve_work(ctx->parse_items, &ctx->parse_items_cap, *wp + 1, sizeof(parse_item_t));
+    ctx->parse_items[*wp].step = step;
+    ctx->parse_items[*wp].token = token;
+    (*wp)++;
+}
+
+/// Save a subexpression result
+static void push_val(interp_ctx_t *ctx, size_t *vp, tree_node_t *node)
+{
+    ctx->parse_vals = reserve_work(ctx->parse_vals, &ctx->parse_vals_cap, *vp + 1, sizeof(tree_node_t *));
+    ctx->parse_vals[(*vp)++] = node;
+}
+
+/// Iterative parser - builds tree from postfix tokens on stack
+/// Each PARSE_TOKEN step does what one recursive call used to do, in
+/// the same order (right operand before left, false branch first), so
+/// the error messages come out exactly as before
+/// @param stack stack with tokens (top = last token)
+/// @return root node or NULL on error
+tree_node_t *parse_r(interp_ctx_t *ctx, stack_t *stack)
+{
+    STAT_START(&ctx->stats, start);
+    token_t none = { NULL, 0 };
+    size_t wp = 0;                 // pending steps
+    size_t vp = 0;                 // finished subexpressions
+    push_item(ctx, &wp, PARSE_TOKEN, none);
+
+    while (wp > 0) {
+        parse_item_t item = ctx->parse_items[--wp];
+
+        if (item.step == PARSE_TOKEN) {
+            if (!stack || empty_stack(stack)) {
+                set_parse_error(ctx, TOO_FEW_TOKENS, "Invalid expression, not enough tokens");
+                push_val(ctx, &vp, NULL);
+                continue;
             }
 
-            tree_node_t *alt = make_interior(ALT_OP, ":", expr_true, expr_false);
-            tree_node_t *qnode = make_interior(Q_OP, "?", test_expr, alt);
-            return qnode;
+            // the stack holds slices of the line; nothing is copied
+            token_t token = *top(stack);
+            pop(stack);
+
+            op_type_t op = tok_to_op(&token);
+            if (op == Q_OP) {
+                push_item(ctx, &wp, BUILD_TERNARY, token);
+                push_item(ctx, &wp, PARSE_TOKEN, none);     // test
+                push_item(ctx, &wp, PARSE_TOKEN, none);     // true branch
+                push_item(ctx, &wp, PARSE_TOKEN, none);     // false branch (first)
+            } else if (op != NO_OP) {
+                push_item(ctx, &wp, BUILD_BINARY, token);
+                push_item(ctx, &wp, PARSE_TOKEN, none);     // left
+                push_item(ctx, &wp, PARSE_TOKEN, none);     // right (first)
+            } else {
+                push_val(ctx, &vp, parse_leaf(ctx, token));
+            }
+        } else if (item.step == BUILD_BINARY) {
+            tree_node_t *left  = ctx->parse_vals[--vp];
+            tree_node_t *right = ctx->parse_vals[--vp];
+            tree_node_t *node = NULL;          // arena reclaims on error
+            if (ctx->parser_error == PARSE_NONE) {
+                node = make_interior(tree_arena(ctx), tok_to_op(&item.token), item.token, left, right);
+                STAT_ADD(&ctx->stats, nodes, 1);
+            }
+            push_val(ctx, &vp, node);
         } else {
-            op_type_t op = tok_to_op(token);
-            tree_node_t *right = parse(stack);
-            tree_node_t *left  = parse(stack);
-
-            if (parser_error != PARSE_NONE) {
-                cleanup_tree(right);
-                cleanup_tree(left);
-                return NULL;
+            tree_node_t *test_expr  = ctx->parse_vals[--vp];
+            tree_node_t *expr_true  = ctx->parse_vals[--vp];
+            tree_node_t *expr_false = ctx->parse_vals[--vp];
+            tree_node_t *qnode = NULL;         // arena reclaims on error
+            if (ctx->parser_error == PARSE_NONE) {
+                token_t colon = { ":", 1 };
+                tree_node_t *alt = make_interior(tree_arena(ctx), ALT_OP, colon, expr_true, expr_false);
+                qnode = make_interior(tree_arena(ctx), Q_OP, item.token, test_expr, alt);
+                STAT_ADD(&ctx->stats, nodes, 2);
             }
-
-            tree_node_t *node = make_interior(op, token, left, right);
-            return node;   // token owned by stack → freed later by free_stack()
+            push_val(ctx, &vp, qnode);
         }
-    } else {
-        tree_node_t *leaf;
-        if (is_integer_token(token))
-            leaf = make_leaf(INTEGER, token);
-        else if (is_symbol_token(token))
-            leaf = make_leaf(SYMBOL, token);
-        else {
-            set_parse_error(ILLEGAL_TOKEN, "Illegal token");
-            return NULL;
-        }
-        return leaf;  // token owned by stack → freed later
     }
+
+    STAT_STOP(&ctx->stats, parse, start);
+    return ctx->parser_error == PARSE_NONE ? ctx->parse_vals[0] : NULL;
 }
 
 /// Tokenize input and build parse tree
 /// @param expr input expression string
 /// @return root of parse tree or NULL
-tree_node_t *make_parse_tree(char *expr)
+tree_node_t *make_parse_tree_r(interp_ctx_t *ctx, char *expr)
 {
-    parser_error = PARSE_NONE;
-    if (!expr || !*expr) {
-        set_parse_error(TOO_FEW_TOKENS, "Invalid expression, not enough tokens");
+    return make_parse_tree_n_r(ctx, expr, expr ? strlen(expr) : 0);
+}
+
+/// Tokenize a slice of input and build parse tree
+/// Tokens are slices of expr, so expr must outlive the tree
+/// @param expr first character of the expression
+/// @param len number of characters
+/// @return root of parse tree or NULL
+static tree_node_t *build_parse_tree(interp_ctx_t *ctx, char *expr, size_t len)
+{
+    ctx->parser_error = PARSE_NONE;
+    if (!expr || len == 0) {
+        set_parse_error(ctx, TOO_FEW_TOKENS, "Invalid expression, not enough tokens");
         return NULL;
     }
 
-    stack_t *stk = make_stack();
-    if (!stk) return NULL;
-
-    char *copy = strdup(expr);
-    if (!copy) { free_stack(stk); return NULL; }
-
-    char *saveptr = NULL;
-    char *tok = my_strtok_r(copy, " \t\r\n", &saveptr);
+    // slice the line in place; the context's stack keeps its array
+    // from line to line
+    stack_t *stk = &ctx->tokens;
+    reset_stack(stk);
+    char *cursor = expr;
+    char *end = expr + len;
+    token_t tok;
     int any = 0;
 
-    while (tok) {
-        char *token_copy = strdup(tok);
-        if (!token_copy) {
-            free(copy); free_stack(stk);
-            set_parse_error(ILLEGAL_TOKEN, "Memory allocation failed");
-            return NULL;
-        }
-        push(stk, token_copy);
+    size_t ntokens = 0;
+
+    STAT_START(&ctx->stats, start);
+    while (next_token(&cursor, end, &tok)) {
+        push(stk, tok);
         any = 1;
-        tok = my_strtok_r(NULL, " \t\r\n", &saveptr);
+        ntokens++;
     }
-    free(copy);
+    STAT_STOP(&ctx->stats, tokenize, start);
+    STAT_ADD(&ctx->stats, tokens, ntokens);
 
-    if (!any) { free_stack(stk); set_parse_error(TOO_FEW_TOKENS, "Invalid expression, not enough tokens"); return NULL; }
+    // size the work stacks for this line up front
+    ctx->parse_items = reserve_work(ctx->parse_items, &ctx->parse_items_cap, 3 * ntokens + 1, sizeof(parse_item_t));
+    ctx->parse_vals = reserve_work(ctx->parse_vals, &ctx->parse_vals_cap, 3 * ntokens + 1, sizeof(tree_node_t *));
+    ctx->frames = reserve_work(ctx->frames, &ctx->frames_cap, ntokens + 1, sizeof(frame_t));
 
-    tree_node_t *root = parse(stk);
-    if (parser_error != PARSE_NONE) { 
-        cleanup_tree(root);
-        free_stack(stk); 
-        return NULL; 
-    }
+    if (!any) { set_parse_error(ctx, TOO_FEW_TOKENS, "Invalid expression, not enough tokens"); return NULL; }
+
+    tree_node_t *root = parse_r(ctx, stk);
+    if (ctx->parser_error != PARSE_NONE) return NULL;
 
     if (!empty_stack(stk)) {
-        cleanup_tree(root);
-        free_stack(stk);
-        set_parse_error(TOO_MANY_TOKENS, "Invalid expression, too many tokens");
+        set_parse_error(ctx, TOO_MANY_TOKENS, "Invalid expression, too many tokens");
         return NULL;
     }
 
-    free_stack(stk);
     return root;
 }
 
-/// Evaluate expression tree
+/// Tokenize a slice of input and build parse tree, timed as a whole
+tree_node_t *make_parse_tree_n_r(interp_ctx_t *ctx, char *expr, size_t len)
+{
+    STAT_START(&ctx->stats, start);
+    tree_node_t *root = build_parse_tree(ctx, expr, len);
+    STAT_STOP(&ctx->stats, make_parse_tree, start);
+    return root;
+}
+
+/// Attach symbol slots to SYMBOL leaves
+/// @param node root node
+void bind_tree_r(interp_ctx_t *ctx, tree_node_t *node)
+{
+    STAT_START(&ctx->stats, start);
+    size_t sp = push_frame(ctx, 0, node);
+    while (sp > 0) {
+        tree_node_t *cur = ctx->frames[--sp].node;
+        if (!cur) continue;
+
+        if (cur->type == LEAF) {
+            leaf_node_t *ln = (leaf_node_t *)cur->node;
+            if (ln->exp_type == SYMBOL && !ln->sym)
+                ln->sym = reserve_symbol_r(ctx, cur->token, cur->token_len);
+            continue;
+        }
+
+        interior_node_t *in = (interior_node_t *)cur->node;
+        sp = push_frame(ctx, sp, in->right);
+        sp = push_frame(ctx, sp, in->left);
+    }
+    STAT_STOP(&ctx->stats, bind, start);
+}
+
+/// Slot for a SYMBOL leaf, binding it now if bind_tree() was skipped
+static symbol_t *leaf_symbol(interp_ctx_t *ctx, tree_node_t *node)
+{
+    leaf_node_t *ln = (leaf_node_t *)node->node;
+    if (!ln->sym) ln->sym = reserve_symbol_r(ctx, node->token, node->token_len);
+    return ln->sym;
+}
+
+/// Evaluate expression tree without recursion
+/// Each frame remembers how many operands it has evaluated; the value
+/// of the subtree that just finished is carried in ret.  The first
+/// error ends the walk, as it did when each level returned early.
 /// @param node root node
 /// @return result value
-int eval_tree(tree_node_t *node)
+static int walk_tree(interp_ctx_t *ctx, tree_node_t *node)
+{
+    ctx->evaluator_error = EVAL_NONE;
+    int ret = 0;
+    size_t sp = push_frame(ctx, 0, node);
+
+    while (sp > 0) {
+        frame_t *f = &ctx->frames[sp - 1];
+        tree_node_t *cur = f->node;
+        if (!cur) { set_eval_error(ctx, UNKNOWN_OPERATION); return 0; }
+        if (f->state == 0) STAT_ADD(&ctx->stats, evaluated, 1);
+
+        if (cur->type == LEAF) {
+            leaf_node_t *ln = (leaf_node_t *)cur->node;
+            if (ln->exp_type == INTEGER) {
+                ret = ln->value;
+            } else {
+                symbol_t *s = leaf_symbol(ctx, cur);
+                if (!s->defined) { set_eval_error(ctx, UNDEFINED_SYMBOL); return 0; }
+                ret = s->val;
+            }
+            sp--;
+            continue;
+        }
+
+        interior_node_t *in = (interior_node_t *)cur->node;
+        op_type_t op = in->op;
+
+        if (op == ASSIGN_OP) {
+            if (f->state == 0) {
+                if (in->left->type != LEAF || ((leaf_node_t *)in->left->node)->exp_type != SYMBOL) {
+                    set_eval_error(ctx, INVALID_LVALUE);
+                    return 0;
+                }
+                f->state = 1;
+                sp = push_frame(ctx, sp, in->right);
+            } else {
+                define_symbol_r(ctx, leaf_symbol(ctx, in->left), ret);
+                sp--;              // value of the assignment stays in ret
+            }
+            continue;
+        }
+
+        if (op == Q_OP) {
+            if (f->state == 0) {
+                f->state = 1;
+                sp = push_frame(ctx, sp, in->left);
+            } else {
+                // replace this frame with the chosen branch
+                interior_node_t *alt = (interior_node_t *)in->right->node;
+                f->node = ret ? alt->left : alt->right;
+                f->state = 0;
+            }
+            continue;
+        }
+
+        if (f->state == 0) {
+            f->state = 1;
+            sp = push_frame(ctx, sp, in->left);
+            continue;
+        }
+        if (f->state == 1) {
+            f->left = ret;
+            f->state = 2;
+            sp = push_frame(ctx, sp, in->right);
+            continue;
+        }
+
+        int left = f->left;
+        int right = ret;
+        switch (op) {
+            case ADD_OP: ret = left + right; break;
+            case SUB_OP: ret = left - right; break;
+            case MUL_OP: ret = left * right; break;
+            case DIV_OP: if (right == 0) { set_eval_error(ctx, DIVISION_BY_ZERO); return 0; } ret = left / right; break;
+            case MOD_OP: if (right == 0) { set_eval_error(ctx, INVALID_MODULUS); return 0; } ret = left % right; break;
+            default: set_eval_error(ctx, UNKNOWN_OPERATION); return 0;
+        }
+        sp--;
+    }
+    return ret;
+}
+
+/// Evaluate expression tree, timed as a whole
+int eval_tree_r(interp_ctx_t *ctx, tree_node_t *node)
 {
-    evaluator_error = EVAL_NONE;
-    if (!node) { set_eval_error(UNKNOWN_OPERATION, "Unknown operation"); return 0; }
+    STAT_START(&ctx->stats, start);
+    int ret = walk_tree(ctx, node);
+    STAT_STOP(&ctx->stats, eval_tree, start);
+    return ret;
+}
+
+/// Free every tree built since the last reset
+void release_trees_r(interp_ctx_t *ctx)
+{
+    arena_reset(tree_arena(ctx));
+}
 
-    if (node->type == LEAF) {
-        leaf_node_t *ln = (leaf_node_t *)node->node;
-        if (ln->exp_type == INTEGER)
-            return (int)strtol(node->token, NULL, 10);
+/// Select the evaluator used by rep()
+void set_eval_mode_r(interp_ctx_t *ctx, eval_mode_t mode)
+{
+    ctx->eval_mode = mode;
+}
+
+/// Turn constant folding on or off
+void set_optimize_r(interp_ctx_t *ctx, int on)
+{
+    ctx->optimize = on;
+}
+
+/// The tree to evaluate for a bound tree
+tree_node_t *optimize_tree_r(interp_ctx_t *ctx, tree_node_t *root)
+{
+    return ctx->optimize ? fold_tree(&ctx->fold, tree_arena(ctx), root) : root;
+}
+
+/// Turn common subexpression sharing on or off
+void set_cse_r(interp_ctx_t *ctx, int on)
+{
+    ctx->share = on;
+}
+
+/// Nodes removed by common subexpression sharing so far
+size_t cse_removed_count_r(interp_ctx_t *ctx)
+{
+    return ctx->cse_removed;
+}
+
+/// Turn native compilation of hot cached expressions on or off
+void set_jit_r(interp_ctx_t *ctx, int on)
+{
+    ctx->jit = on;
+}
+
+/// Expressions compiled to native code so far
+size_t jit_compiled_count_r(interp_ctx_t *ctx)
+{
+    return ctx->jit_compiled;
+}
+
+/// Turn live formulas on or off
+void set_reactive_r(interp_ctx_t *ctx, int on)
+{
+    ctx->reactive = on;
+}
+
+/// Compile a bound tree with the optimizations that are on
+void compile_expr_r(interp_ctx_t *ctx, bytecode_t *bc, tree_node_t *root)
+{
+    tree_node_t *run = optimize_tree_r(ctx, root);
+    if (ctx->share) {
+        tree_node_t *dag = share_subtrees(&ctx->expr_cse, tree_arena(ctx), run);
+        ctx->cse_removed += ctx->expr_cse.removed;
+        compile_dag(bc, dag, &ctx->expr_cse);
+    } else {
+        compile_tree(bc, run);
+    }
+}
 
-        symbol_t *s = lookup_table(node->token);
-        if (!s) { set_eval_error(UNDEFINED_SYMBOL, "Undefined symbol"); return 0; }
-        return s->val;
+/// Run compiled code, natively when there is machine code for it
+/// Reports errors exactly as eval_tree() does
+/// @param bc the program
+/// @param native its machine code, or NULL to use the VM
+/// @return result value
+static int run_code(interp_ctx_t *ctx, const bytecode_t *bc, const jit_code_t *native)
+{
+    if (vm_stack_size(bc) > ctx->vm_stack_cap) {
+        size_t cap = vm_stack_size(bc);
+        int *stk = realloc(ctx->vm_stack, cap * sizeof(int));
+        if (!stk) {
+            perror("realloc vm stack");
+            exit(EXIT_FAILURE);
+        }
+        ctx->vm_stack = stk;
+        ctx->vm_stack_cap = cap;
     }
 
-    interior_node_t *in = (interior_node_t *)node->node;
-    op_type_t op = in->op;
+    eval_error_t err;
+    STAT_START(&ctx->stats, start);
+    int value = native ? jit_run(native, ctx->vm_stack, &err) : vm_exec(ctx, bc, ctx->vm_stack, &err);
+    STAT_STOP(&ctx->stats, vm, start);
+    ctx->evaluator_error = EVAL_NONE;
+    if (err != EVAL_NONE) set_eval_error(ctx, err);
+    return value;
+}
 
-    if (op == ASSIGN_OP) {
-        if (in->left->type != LEAF || ((leaf_node_t *)in->left->node)->exp_type != SYMBOL) {
-            set_eval_error(INVALID_LVALUE, "Invalid l-value");
-            return 0;
+/// Compile a bound tree and run it on the VM
+/// @param root root node
+/// @return result value
+static int eval_compiled(interp_ctx_t *ctx, tree_node_t *root)
+{
+    compile_expr_r(ctx, &ctx->expr_code, root);
+    return run_code(ctx, &ctx->expr_code, NULL);
+}
+
+/// Write fully parenthesized infix into an output buffer without recursion
+/// The frame state says which piece of the node is written next
+static void write_infix(interp_ctx_t *ctx, outbuf_t *ob, tree_node_t *node)
+{
+    STAT_START(&ctx->stats, start);
+    size_t sp = push_frame(ctx, 0, node);
+    while (sp > 0) {
+        frame_t *f = &ctx->frames[sp - 1];
+        tree_node_t *cur = f->node;
+        if (!cur) { sp--; continue; }
+
+        if (cur->type == LEAF) {
+            ob_write(ob, cur->token, cur->token_len);
+            sp--;
+            continue;
         }
-        char *name = in->left->token;
-        int val = eval_tree(in->right);
-        if (evaluator_error != EVAL_NONE) return 0;
-
-        symbol_t *s = lookup_table(name);
-        if (!s) {
-            s = create_symbol(name, val);
-            if (!s) set_eval_error(SYMTAB_FULL, "No room in symbol table");
+
+        interior_node_t *in = (interior_node_t *)cur->node;
+        if (in->op == Q_OP) {
+            interior_node_t *alt = (interior_node_t *)in->right->node;
+            switch (f->state++) {
+                case 0: ob_putc(ob, '('); sp = push_frame(ctx, sp, in->left); break;
+                case 1: ob_write(ob, "?(", 2); sp = push_frame(ctx, sp, alt->left); break;
+                case 2: ob_putc(ob, ':'); sp = push_frame(ctx, sp, alt->right); break;
+                default: ob_write(ob, "))", 2); sp--; break;
+            }
         } else {
-            s->val = val;
+            switch (f->state++) {
+                case 0: ob_putc(ob, '('); sp = push_frame(ctx, sp, in->left); break;
+                case 1:
+                    ob_write(ob, cur->token, cur->token_len);
+                    sp = push_frame(ctx, sp, in->right);
+                    break;
+                default: ob_putc(ob, ')'); sp--; break;
+            }
         }
-        return val;
     }
+    STAT_STOP(&ctx->stats, print, start);
+}
+
+/// Print fully parenthesized infix to the context's output
+void print_infix_r(interp_ctx_t *ctx, tree_node_t *node)
+{
+    write_infix(ctx, ctx_output(ctx), node);
+}
+
+/// Format fully parenthesized infix into caller memory
+size_t print_infix_buf_r(interp_ctx_t *ctx, tree_node_t *node, char *buf, size_t size)
+{
+    outbuf_t ob;
+    ob_init_mem(&ob, buf, size);
+    write_infix(ctx, &ob, node);
+    return ob_length(&ob);
+}
+
+/// Read-Eval-Print one expression
+/// @param exp input line
+void rep_r(interp_ctx_t *ctx, char *exp)
+{
+    if (!exp) return;
+    rep_n_r(ctx, exp, strlen(exp));
+}
+
+/// Finish the output line with the value, unless evaluation failed
+static void print_result(interp_ctx_t *ctx, outbuf_t *out, int value)
+{
+    if (ctx->evaluator_error == EVAL_NONE) {
+        ob_write(out, " = ", 3);
+        ob_int(out, value);
+    }
+    ob_putc(out, '\n');
+}
 
-    if (op == Q_OP) {
-        int test = eval_tree(in->left);
-        if (evaluator_error != EVAL_NONE) return 0;
-        interior_node_t *alt = (interior_node_t *)in->right->node;
-        return test ? eval_tree(alt->left) : eval_tree(alt->right);
+/// Cache key for an expression: its tokens separated by single spaces
+/// @param exp first character of the expression
+/// @param len number of characters
+/// @param[out] key_len length of the key
+/// @return the key, valid until the next call
+static char *normalize_expr(interp_ctx_t *ctx, char *exp, size_t len, size_t *key_len)
+{
+    char *key_buf = reserve_work(ctx->key_buf, &ctx->key_buf_cap, len + 1, 1);
+    ctx->key_buf = key_buf;
+
+    char *cursor = exp;
+    char *end = exp + len;
+    size_t n = 0;
+    token_t tok;
+    while (next_token(&cursor, end, &tok)) {
+        if (n > 0) key_buf[n++] = ' ';
+        memcpy(key_buf + n, tok.str, tok.len);
+        n += tok.len;
     }
+    *key_len = n;
+    return key_buf;
+}
+
+/// Read-Eval-Print through the expression cache
+/// A hit reuses the cached infix text and code (and, with set_jit(),
+/// machine code once the expression is hot); a miss parses the
+/// key (which has the same tokens as the line) and caches the result
+/// @param exp first character of the expression
+/// @param len number of characters
+static void rep_cached(interp_ctx_t *ctx, char *exp, size_t len)
+{
+    size_t key_len;
+    char *key = normalize_expr(ctx, exp, len, &key_len);
+    cache_entry_t *entry = key_len ? cache_find(&ctx->cache, key, key_len) : NULL;
+
+    if (!entry) {
+        tree_node_t *root = make_parse_tree_n_r(ctx, key, key_len);
+        if (ctx->parser_error != PARSE_NONE || !root) {
+            arena_reset(tree_arena(ctx));
+            return;
+        }
+        bind_tree_r(ctx, root);
 
-    int left = eval_tree(in->left);
-    if (evaluator_error != EVAL_NONE) return 0;
-    int right = eval_tree(in->right);
-    if (evaluator_error != EVAL_NONE) return 0;
-
-    switch (op) {
-        case ADD_OP: return left + right;
-        case SUB_OP: return left - right;
-        case MUL_OP: return left * right;
-        case DIV_OP: if (right == 0) { set_eval_error(DIVISION_BY_ZERO, "Division by zero"); return 0; } return left / right;
-        case MOD_OP: if (right == 0) { set_eval_error(INVALID_MODULUS, "Invalid modulus"); return 0; } return left % right;
-        default: set_eval_error(UNKNOWN_OPERATION, "Unknown operation"); return 0;
+        outbuf_t *text = &ctx->infix_text;
+        if (!ctx->infix_text_ready) {
+            ob_init_heap(text);
+            ctx->infix_text_ready = 1;
+        }
+        text->len = 0;
+        write_infix(ctx, text, root);         // the expression as written
+        compile_expr_r(ctx, &ctx->expr_code, root);
+        entry = cache_insert(&ctx->cache, key, key_len, &ctx->expr_code, text->buf, text->len);
+        arena_reset(tree_arena(ctx));
+    }
+
+    if (ctx->jit && entry->runs < JIT_HOT_RUNS && ++entry->runs == JIT_HOT_RUNS) {
+        entry->native = jit_compile(ctx, &entry->code);     // stays NULL where unsupported
+        if (entry->native) ctx->jit_compiled++;
     }
+
+    outbuf_t *out = ctx_output(ctx);
+    ob_write(out, entry->infix, entry->infix_len);
+    print_result(ctx, out, run_code(ctx, &entry->code, entry->native));
 }
 
-/// Print fully parenthesized infix
-void print_infix(tree_node_t *node)
+/// Read-Eval-Print one expression given as a slice
+/// @param exp first character of the expression
+/// @param len number of characters
+void rep_n_r(interp_ctx_t *ctx, char *exp, size_t len)
 {
-    if (!node) return;
-    if (node->type == LEAF) {
-        printf("%s", node->token);
+    if (!exp) return;
+
+    ctx->parser_error = PARSE_NONE;
+    ctx->evaluator_error = EVAL_NONE;
+
+    if (ctx->eval_mode == EVAL_VM && cache_enabled(&ctx->cache) && !ctx->reactive) {
+        rep_cached(ctx, exp, len);
+        return;
+    }
+
+    tree_node_t *root = make_parse_tree_n_r(ctx, exp, len);
+    if (ctx->parser_error != PARSE_NONE || !root) {
+        arena_reset(tree_arena(ctx));
         return;
     }
 
-    interior_node_t *in = (interior_node_t *)node->node;
-    if (in->op == Q_OP) {
-        printf("("); print_infix(in->left); printf("?");
-        interior_node_t *alt = (interior_node_t *)in->right->node;
-        printf("("); print_infix(alt->left); printf(":"); print_infix(alt->right); printf(")");
-        printf(")");
+    bind_tree_r(ctx, root);
+    outbuf_t *out = ctx_output(ctx);
+    write_infix(ctx, out, root);          // always the expression as written
+    if (ctx->eval_mode == EVAL_COLUMNS) {
+        eval_columns_r(ctx, optimize_tree_r(ctx, root), out);
     } else {
-        printf("("); print_infix(in->left);
-        printf("%s", node->token); print_infix(in->right); printf(")");
+        int value = ctx->eval_mode == EVAL_TREE
+            ? eval_tree_r(ctx, optimize_tree_r(ctx, root))
+            : eval_compiled(ctx, root);
+        print_result(ctx, out, value);
+        if (ctx->reactive && ctx->evaluator_error == EVAL_NONE)
+            react_update(ctx, &ctx->formulas, root);
     }
+
+    arena_reset(tree_arena(ctx));  // frees the whole tree at once
 }
 
-extern void cleanup_tree(tree_node_t *node);
 
-/// Read-Eval-Print one expression
-/// @param exp input line
+/* ---- the same operations on the default context ---- */
+
+/// set_eval_mode_r() on the default context
+void set_eval_mode(eval_mode_t mode)
+{
+    set_eval_mode_r(default_ctx(), mode);
+}
+
+/// set_optimize_r() on the default context
+void set_optimize(int on)
+{
+    set_optimize_r(default_ctx(), on);
+}
+
+/// optimize_tree_r() on the default context
+tree_node_t *optimize_tree(tree_node_t *root)
+{
+    return optimize_tree_r(default_ctx(), root);
+}
+
+/// set_cse_r() on the default context
+void set_cse(int on)
+{
+    set_cse_r(default_ctx(), on);
+}
+
+/// cse_removed_count_r() on the default context
+size_t cse_removed_count(void)
+{
+    return cse_removed_count_r(default_ctx());
+}
+
+/// set_jit_r() on the default context
+void set_jit(int on)
+{
+    set_jit_r(default_ctx(), on);
+}
+
+/// jit_compiled_count_r() on the default context
+size_t jit_compiled_count(void)
+{
+    return jit_compiled_count_r(default_ctx());
+}
+
+/// set_reactive_r() on the default context
+void set_reactive(int on)
+{
+    set_reactive_r(default_ctx(), on);
+}
+
+/// compile_expr_r() on the default context
+void compile_expr(bytecode_t *bc, tree_node_t *root)
+{
+    compile_expr_r(default_ctx(), bc, root);
+}
+
+/// set_error_output_r() on the default context
+void set_error_output(outbuf_t *ob)
+{
+    set_error_output_r(default_ctx(), ob);
+}
+
+/// set_output_r() on the default context
+void set_output(outbuf_t *ob)
+{
+    set_output_r(default_ctx(), ob);
+}
+
+/// release_trees_r() on the default context
+void release_trees(void)
+{
+    release_trees_r(default_ctx());
+}
+
+/// rep_r() on the default context
 void rep(char *exp)
 {
-    if (!exp) return;
+    rep_r(default_ctx(), exp);
+}
 
-    parser_error = PARSE_NONE;
-    evaluator_error = EVAL_NONE;
+/// rep_n_r() on the default context
+void rep_n(char *exp, size_t len)
+{
+    rep_n_r(default_ctx(), exp, len);
+}
 
-    tree_node_t *root = make_parse_tree(exp);
-    if (parser_error != PARSE_NONE || !root) {
-        if (root) cleanup_tree(root);
-        return;
-    }
+/// parse_r() on the default context
+tree_node_t *parse(stack_t *stack)
+{
+    return parse_r(default_ctx(), stack);
+}
 
-    print_infix(root);
-    int value = eval_tree(root);
-    if (evaluator_error == EVAL_NONE)
-        printf(" = %d\n", value);
-    else
-        printf("\n");
+/// make_parse_tree_r() on the default context
+tree_node_t *make_parse_tree(char *expr)
+{
+    return make_parse_tree_r(default_ctx(), expr);
+}
 
-    cleanup_tree(root);
-}
\ No newline at end of file
+/// make_parse_tree_n_r() on the default context
+tree_node_t *make_parse_tree_n(char *expr, size_t len)
+{
+    return make_parse_tree_n_r(default_ctx(), expr, len);
+}
+
+/// bind_tree_r() on the default context
+void bind_tree(tree_node_t *node)
+{
+    bind_tree_r(default_ctx(), node);
+}
+
+/// eval_tree_r() on the default context
+int eval_tree(tree_node_t *node)
+{
+    return eval_tree_r(default_ctx(), node);
+}
+
+/// print_infix_r() on the default context
+void print_infix(tree_node_t *node)
+{
+    print_infix_r(default_ctx(), node);
+}
+
+/// print_infix_buf_r() on the default context
+size_t print_infix_buf(tree_node_t *node, char *buf, size_t size)
+{
+    return print_infix_buf_r(default_ctx(), node, buf, size);
+}
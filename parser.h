@@ -5,6 +5,8 @@
 
 #include "tree_node.h"
 #include "stack.h"
+#include "outbuf.h"
+#include "symtab.h"
 
 // The types of errors that can be run into while parsing
 // or evaluating the tree
@@ -13,7 +15,8 @@ typedef enum parse_error_e {
     TOO_FEW_TOKENS,             // not enough tokens in expression
     TOO_MANY_TOKENS,            // too many tokens in expression
     INVALID_ASSIGNMENT,         // assign to left hand side not a variable
-    ILLEGAL_TOKEN               // doesn't fit any other pattern
+    ILLEGAL_TOKEN,              // doesn't fit any other pattern
+    INTEGER_OUT_OF_RANGE        // integer literal does not fit in an int
 } parse_error_t;
 
 typedef enum eval_error_e {
@@ -28,25 +31,140 @@ typedef enum eval_error_e {
     SYMTAB_FULL
 } eval_error_t;
 
+// How rep() evaluates a parsed expression
+typedef enum eval_mode_e {
+    EVAL_VM,                    // compile to bytecode and run it (default)
+    EVAL_TREE,                  // walk the tree with eval_tree()
+    EVAL_COLUMNS                // run it over every row with eval_columns_r()
+} eval_mode_t;
+
+/// Selects the evaluator used by rep().  The VM and the tree walker
+/// produce the same values and errors; eval_tree() is kept as the
+/// reference implementation.  EVAL_COLUMNS prints a result column
+/// computed over the column table instead of a single value.
+/// @param ctx  the context
+/// @param mode  EVAL_VM, EVAL_TREE or EVAL_COLUMNS
+void set_eval_mode_r(interp_ctx_t *ctx, eval_mode_t mode);
+
+/// Turns constant folding and algebraic simplification on or off
+/// (see fold_tree()).  rep() still prints the expression as written.
+/// @param ctx  the context
+/// @param on  nonzero to simplify trees before evaluating them
+void set_optimize_r(interp_ctx_t *ctx, int on);
+
+/// Gives the tree to evaluate for a parsed and bound tree: the tree
+/// itself, or a simplified copy in the expression arena when
+/// set_optimize() is on.
+/// @param ctx  the context that parsed the tree
+/// @param root  the root of the tree
+/// @return the root of the tree to evaluate
+tree_node_t *optimize_tree_r(interp_ctx_t *ctx, tree_node_t *root);
+
+/// Turns common subexpression sharing on or off for the VM evaluator
+/// (see share_subtrees()).  The tree walker is not affected.
+/// @param ctx  the context
+/// @param on  nonzero to share identical side-effect-free subtrees
+void set_cse_r(interp_ctx_t *ctx, int on);
+
+/// Reports the work done by common subexpression sharing.
+/// @param ctx  the context
+/// @return the number of parse tree nodes it has removed so far
+size_t cse_removed_count_r(interp_ctx_t *ctx);
+
+/// Turns on native compilation of hot expressions: an expression in
+/// the expression cache that has been evaluated JIT_HOT_RUNS times is
+/// translated to machine code and runs natively from then on.  Builds
+/// without a code generator (see jit_available()) stay on the VM.
+/// @param ctx  the context
+/// @param on  nonzero to compile hot expressions
+void set_jit_r(interp_ctx_t *ctx, int on);
+
+/// Reports the work done by the native code generator.
+/// @param ctx  the context
+/// @return the number of expressions given machine code so far
+size_t jit_compiled_count_r(interp_ctx_t *ctx);
+
+/// Turns on live formulas (see react_update()): an assignment whose
+/// right-hand side reads other symbols is kept, and run again whenever
+/// one of those symbols is assigned.  Expressions then bypass the
+/// expression cache.  Columns mode is not affected.
+/// @param ctx  the context
+/// @param on  nonzero to keep formulas
+void set_reactive_r(interp_ctx_t *ctx, int on);
+
+struct bytecode_s;
+
+/// Compiles a parsed and bound tree for the VM, applying constant
+/// folding (set_optimize()) and subexpression sharing (set_cse()) when
+/// they are on.  The tree itself is not changed.
+/// @param ctx  the context that parsed the tree
+/// @param bc  the program to fill
+/// @param root  the root of the tree
+void compile_expr_r(interp_ctx_t *ctx, struct bytecode_s *bc, tree_node_t *root);
+
+/// Sends the messages for parse errors to a buffer instead of
+/// standard error, so a caller can hold them back and print them
+/// later.  Evaluation errors are not affected.
+/// @param ctx  the context
+/// @param ob  the buffer, or NULL for standard error
+void set_error_output_r(interp_ctx_t *ctx, outbuf_t *ob);
+
+/// Sends the results of rep_r(), print_infix_r() and dump_table_r()
+/// to a buffer instead of the context's own standard output buffer
+/// (ob_stdout() for the default context).
+/// @param ctx  the context
+/// @param ob  the buffer, or NULL for the context's own buffer
+void set_output_r(interp_ctx_t *ctx, outbuf_t *ob);
+
+/// The message printed for an evaluation error.
+/// @param e  the error
+/// @return the message, or NULL for EVAL_NONE
+const char *eval_error_message(eval_error_t e);
+
+/// Frees every tree built by make_parse_tree() since the last reset
+/// (rep() does this by itself after each expression).  Callers that
+/// keep several trees alive at once release them all with this.
+/// @param ctx  the context whose trees are freed
+void release_trees_r(interp_ctx_t *ctx);
+
 /// The main read-eval-print function that reads the expression,
 /// parses it, and evaluates the result, printing the infix expression
-/// and the resulting value to standard output.
+/// and the resulting value to the context's output (its standard
+/// output buffer unless set_output_r() says otherwise).
 /// process, using the rest of the routines defined here.
+/// The tree lives in an expression arena that is reset once the
+/// expression has been printed and evaluated, and reused by the next
+/// call, so repeated calls stop allocating once the arena has grown.
+/// With the expression cache on (see cache_init()) and the VM
+/// evaluator selected, an expression seen before is printed and run
+/// from its cache entry without being parsed again.
+/// @param ctx  the context the expression runs in
 /// @param exp The expression as a string
-void rep(char *exp);
+void rep_r(interp_ctx_t *ctx, char *exp);
+
+/// Same as rep(), for an expression that is a slice of a larger buffer
+/// (for example a memory-mapped script).  The characters are only read.
+/// @param ctx  the context the expression runs in
+/// @param exp  The first character of the expression
+/// @param len  The number of characters
+void rep_n_r(interp_ctx_t *ctx, char *exp, size_t len);
 
 /// Recursively build the parse tree from items on the stack
+/// @param ctx  the context whose arena holds the tree
 /// @param stack  the list of tokens to parse
 /// @return the root of the parse tree, or NULL on failure
 /// @exception will occur if the parse fails
-tree_node_t *parse(stack_t *stack);
+tree_node_t *parse_r(interp_ctx_t *ctx, stack_t *stack);
 
 /// Constructs the expression tree from the expression.  It
-/// must use the stack to order the tokens.  It must also
-/// deallocate the memory associated with the stack in all cases.
+/// must use the stack to order the tokens: the context's token
+/// stack, which is emptied and reused by every call.
+/// The nodes and token strings are allocated in the expression arena
+/// and stay valid until rep() resets it.
 /// If a symbol is encountered, it should be stored in the node
 /// without checking if it is in the symbol table - evaluation will
 /// resolve that issue.
+/// @param ctx  the context whose arena holds the tree
 /// @param expr the postfix expression as a C string
 /// @return the root of the expression tree
 /// @exception There are 2 error conditions that you must deal
@@ -64,15 +182,34 @@ tree_node_t *parse(stack_t *stack);
 ///     to standard error:
 ///
 ///     Invalid expression, too many tokens
-tree_node_t *make_parse_tree(char *expr);
+tree_node_t *make_parse_tree_r(interp_ctx_t *ctx, char *expr);
+
+/// Same as make_parse_tree(), for an expression that is not
+/// null-terminated.  The tree's tokens point into expr.
+/// @param ctx  the context whose arena holds the tree
+/// @param expr the first character of the postfix expression
+/// @param len the number of characters
+/// @return the root of the expression tree
+tree_node_t *make_parse_tree_n_r(interp_ctx_t *ctx, char *expr, size_t len);
+
+/// Binds every SYMBOL leaf in the tree to its slot in the context's
+/// symbol table,
+/// reserving slots for names that are not defined yet (such as
+/// assignment targets).  After binding, evaluation reads and writes
+/// symbols through the slots without searching the table.  Undefined
+/// names are still reported when the tree is evaluated.
+/// @param ctx  the context whose symbol table is used
+/// @param node  the root of the tree to bind
+void bind_tree_r(interp_ctx_t *ctx, tree_node_t * node);
 
 /// Evaluates the tree and returns the result.
+/// @param ctx  the context the tree was bound in
 /// @param node The node in the tree: either an INTERIOR or LEAF node
 /// @precondition:  This routine should not be called if there
 ///     is a parser error.
 /// @return the evaluated int.  Note:  A symbol evaluates
 ///     to the value bound to it.
-int eval_tree(tree_node_t * node);
+int eval_tree_r(interp_ctx_t *ctx, tree_node_t * node);
 
 /// Displays the infix expression for the tree, using
 /// parentheses to indicate the precedence, e.g.:
@@ -80,13 +217,97 @@ int eval_tree(tree_node_t * node);
 /// postfix expression: 10 20 + 30 *
 /// infix string: ((10+20)*30) 
 ///
+/// The text goes to the context's output (its standard output
+/// buffer, unless set_output_r() says otherwise).
+///
+/// @param ctx  the context
 /// @param node  the tree_node of the tree to print
 /// @precondition:  This routine should not be called if there
 ///     is a parser error.
-void print_infix(tree_node_t * node);
+void print_infix_r(interp_ctx_t *ctx, tree_node_t * node);
+
+/// Formats the same fully parenthesized infix string as print_infix()
+/// into caller memory.  Like snprintf, the text is cut off to fit and
+/// always null-terminated.
+///
+/// @param ctx  the context
+/// @param node  the tree_node of the tree to print
+/// @param buf  where to write the string
+/// @param size  size of buf in bytes (at least 1)
+/// @return the length of the whole string; if it is size or more,
+///     the string was cut off
+size_t print_infix_buf_r(interp_ctx_t *ctx, tree_node_t *node, char *buf, size_t size);
 
-/// Cleans up all dynamic memory associated with the expression tree.
+/// Cleans up all dynamic memory associated with an expression tree
+/// that was built on the heap (make_interior/make_leaf with no arena).
+/// Trees built by make_parse_tree() belong to the expression arena.
 /// @param node The current node in the tree
 void cleanup_tree(tree_node_t * node);
 
+// The same functions on the process's default context (default_ctx()),
+// kept for the command-line program and for existing callers.
+
+/// set_eval_mode_r() on the default context
+void set_eval_mode(eval_mode_t mode);
+
+/// set_optimize_r() on the default context
+void set_optimize(int on);
+
+/// optimize_tree_r() on the default context
+tree_node_t *optimize_tree(tree_node_t *root);
+
+/// set_cse_r() on the default context
+void set_cse(int on);
+
+/// cse_removed_count_r() on the default context
+size_t cse_removed_count(void);
+
+/// set_jit_r() on the default context
+void set_jit(int on);
+
+/// jit_compiled_count_r() on the default context
+size_t jit_compiled_count(void);
+
+/// set_reactive_r() on the default context
+void set_reactive(int on);
+
+/// compile_expr_r() on the default context
+void compile_expr(struct bytecode_s *bc, tree_node_t *root);
+
+/// set_error_output_r() on the default context
+void set_error_output(outbuf_t *ob);
+
+/// set_output_r() on the default context
+void set_output(outbuf_t *ob);
+
+/// release_trees_r() on the default context
+void release_trees(void);
+
+/// rep_r() on the default context
+void rep(char *exp);
+
+/// rep_n_r() on the default context
+void rep_n(char *exp, size_t len);
+
+/// parse_r() on the default context
+tree_node_t *parse(stack_t *stack);
+
+/// make_parse_tree_r() on the default context
+tree_node_t *make_parse_tree(char *expr);
+
+/// make_parse_tree_n_r() on the default context
+tree_node_t *make_parse_tree_n(char *expr, size_t len);
+
+/// bind_tree_r() on the default context
+void bind_tree(tree_node_t * node);
+
+/// eval_tree_r() on the default context
+int eval_tree(tree_node_t * node);
+
+/// print_infix_r() on the default context
+void print_infix(tree_node_t * node);
+
+/// print_infix_buf_r() on the default context
+size_t print_infix_buf(tree_node_t *node, char *buf, size_t size);
+
 #endif
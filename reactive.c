@@ -0,0 +1,338 @@
+// reactive.c
+// Live formulas: assignments kept in a dependency graph and run again,
+// in topological order, when a symbol they read is assigned
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reactive.h"
+#include "parser.h"
+#include "util.h"
+
+// Everything the graph knows about one symbol
+typedef struct react_node_s {
+    symbol_t *sym;              // the symbol (NULL = empty slot)
+    formula_t *formula;         // the formula that computes it, or NULL
+    formula_t **readers;        // formulas that read it
+    size_t nreaders;
+    size_t readers_cap;
+    size_t epoch;               // walk that last marked it
+} react_node_t;
+
+/// Find a symbol's node
+/// @return the node, or NULL if the symbol is not in the graph
+static react_node_t *node_find(const reactive_t *r, const symbol_t *sym)
+{
+    if (r->count == 0) return NULL;
+    size_t mask = r->cap - 1;
+    for (size_t i = hash_ptr(sym) & mask; r->nodes[i].sym; i = (i + 1) & mask) {
+        if (r->nodes[i].sym == sym) return &r->nodes[i];
+    }
+    return NULL;
+}
+
+static react_node_t *node_add(reactive_t *r, symbol_t *sym);
+
+/// Double the node table's capacity
+/// Nodes move, so pointers to them do not survive node_add()
+static void node_grow(reactive_t *r)
+{
+    react_node_t *old = r->nodes;
+    size_t old_cap = r->cap;
+
+    r->cap = old_cap ? old_cap * 2 : 64;
+    r->nodes = calloc(r->cap, sizeof(react_node_t));
+    if (!r->nodes) {
+        perror("calloc formula graph");
+        exit(EXIT_FAILURE);
+    }
+    r->count = 0;
+    for (size_t i = 0; i < old_cap; ++i) {
+        if (old[i].sym) *node_add(r, old[i].sym) = old[i];
+    }
+    free(old);
+}
+
+/// Find a symbol's node, adding an empty one if it is new
+static react_node_t *node_add(reactive_t *r, symbol_t *sym)
+{
+    if ((r->count + 1) * 2 > r->cap) node_grow(r);
+
+    size_t mask = r->cap - 1;
+    size_t i = hash_ptr(sym) & mask;
+    while (r->nodes[i].sym && r->nodes[i].sym != sym) i = (i + 1) & mask;
+    if (!r->nodes[i].sym) {
+        memset(&r->nodes[i], 0, sizeof(react_node_t));
+        r->nodes[i].sym = sym;
+        r->count++;
+    }
+    return &r->nodes[i];
+}
+
+/// Initialize an empty set of formulas
+void react_init(reactive_t *r)
+{
+    memset(r, 0, sizeof(*r));
+}
+
+/// Free one formula
+static void formula_free(formula_t *f)
+{
+    bc_free(&f->code);
+    free(f->deps);
+    free(f);
+}
+
+/// Free every formula and the graph
+void react_free(reactive_t *r)
+{
+    for (size_t i = 0; i < r->cap; ++i) {
+        if (!r->nodes[i].sym) continue;
+        if (r->nodes[i].formula) formula_free(r->nodes[i].formula);
+        free(r->nodes[i].readers);
+    }
+    free(r->nodes);
+    free(r->walk);
+    free(r->reads);
+    free(r->sets);
+    free(r->work);
+    free(r->order);
+    free(r->stack);
+    react_init(r);
+}
+
+/// Stop a formula from being run for one of its inputs
+static void remove_reader(reactive_t *r, symbol_t *sym, formula_t *f)
+{
+    react_node_t *n = node_find(r, sym);
+    if (!n) return;
+    for (size_t i = 0; i < n->nreaders; ++i) {
+        if (n->readers[i] == f) {
+            n->readers[i] = n->readers[--n->nreaders];
+            return;
+        }
+    }
+}
+
+/// Turn a symbol's formula, if it has one, back into a plain value
+static void drop_formula(reactive_t *r, symbol_t *sym)
+{
+    react_node_t *n = node_find(r, sym);
+    if (!n || !n->formula) return;
+
+    formula_t *f = n->formula;
+    n->formula = NULL;
+    for (size_t i = 0; i < f->ndeps; ++i) remove_reader(r, f->deps[i], f);
+    formula_free(f);
+    r->live--;
+}
+
+/// Collect the symbols an expression reads and those it assigns
+/// The target of an assignment is not a read
+/// @param[out] nreads number of reads (with repeats) in r->reads
+/// @param[out] nsets number of assignments in r->sets
+static void collect(reactive_t *r, tree_node_t *root, size_t *nreads, size_t *nsets)
+{
+    size_t sp = 0;
+    *nreads = 0;
+    *nsets = 0;
+
+    r->walk = reserve_work(r->walk, &r->walk_cap, 1, sizeof(tree_node_t *));
+    r->walk[sp++] = root;
+    while (sp > 0) {
+        tree_node_t *node = r->walk[--sp];
+        if (!node) continue;
+
+        if (node->type == LEAF) {
+            leaf_node_t *ln = (leaf_node_t *)node->node;
+            if (ln->exp_type == SYMBOL && ln->sym) {
+                r->reads = reserve_work(r->reads, &r->reads_cap, *nreads + 1, sizeof(symbol_t *));
+                r->reads[(*nreads)++] = ln->sym;
+            }
+            continue;
+        }
+
+        interior_node_t *in = (interior_node_t *)node->node;
+        r->walk = reserve_work(r->walk, &r->walk_cap, sp + 2, sizeof(tree_node_t *));
+        if (in->op == ASSIGN_OP && in->left && in->left->type == LEAF
+            && ((leaf_node_t *)in->left->node)->exp_type == SYMBOL) {
+            r->sets = reserve_work(r->sets, &r->sets_cap, *nsets + 1, sizeof(symbol_t *));
+            r->sets[(*nsets)++] = ((leaf_node_t *)in->left->node)->sym;
+        } else {
+            r->walk[sp++] = in->left;
+        }
+        r->walk[sp++] = in->right;
+    }
+}
+
+/// Whether a formula for target reading the marked symbols would close
+/// a cycle: some formula downstream of target computes a marked symbol
+/// @param mark epoch the inputs' nodes are marked with
+static int makes_cycle(reactive_t *r, symbol_t *target, size_t mark)
+{
+    size_t sp = 0;
+    react_node_t *n = node_find(r, target);
+    if (!n) return 0;
+
+    for (size_t i = 0; i < n->nreaders; ++i) {
+        r->work = reserve_work(r->work, &r->work_cap, sp + 1, sizeof(formula_t *));
+        r->work[sp++] = n->readers[i];
+        n->readers[i]->epoch = mark;
+    }
+    while (sp > 0) {
+        formula_t *f = r->work[--sp];
+        react_node_t *out = node_find(r, f->target);
+        if (!out) continue;
+        if (out->epoch == mark) return 1;
+        for (size_t i = 0; i < out->nreaders; ++i) {
+            formula_t *g = out->readers[i];
+            if (g->epoch == mark) continue;
+            g->epoch = mark;
+            r->work = reserve_work(r->work, &r->work_cap, sp + 1, sizeof(formula_t *));
+            r->work[sp++] = g;
+        }
+    }
+    return 0;
+}
+
+/// Keep an assignment as the formula of its target
+/// @param root the assignment
+/// @param nreads number of symbols in r->reads (with repeats)
+static void install(reactive_t *r, symbol_t *target, tree_node_t *root, size_t nreads)
+{
+    drop_formula(r, target);
+
+    formula_t *f = malloc(sizeof(formula_t));
+    if (!f) {
+        perror("malloc formula");
+        exit(EXIT_FAILURE);
+    }
+    f->target = target;
+    f->epoch = 0;
+    f->pending = 0;
+    bc_init(&f->code);
+    compile_tree(&f->code, root);
+    f->deps = malloc(nreads * sizeof(symbol_t *));
+    if (!f->deps) {
+        perror("malloc formula inputs");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t mark = ++r->epoch;
+    f->ndeps = 0;
+    for (size_t i = 0; i < nreads; ++i) {
+        react_node_t *n = node_add(r, r->reads[i]);
+        if (n->epoch == mark) continue;        // read more than once
+        n->epoch = mark;
+        f->deps[f->ndeps++] = r->reads[i];
+        n->readers = reserve_work(n->readers, &n->readers_cap, n->nreaders + 1, sizeof(formula_t *));
+        n->readers[n->nreaders++] = f;
+    }
+    node_add(r, target)->formula = f;
+    r->live++;
+}
+
+/// Run one formula, keeping its target's value if it fails
+/// The error goes to standard error, naming the formula's target
+/// @return nonzero if the formula ran without error
+static int run_formula(interp_ctx_t *ctx, reactive_t *r, formula_t *f)
+{
+    r->stack = reserve_work(r->stack, &r->stack_cap, vm_stack_size(&f->code), sizeof(int));
+    eval_error_t err;
+    vm_exec(ctx, &f->code, r->stack, &err);
+    r->recomputed++;
+    if (err == EVAL_NONE) return 1;
+
+    fprintf(stderr, "%s (recomputing %s)\n", eval_error_message(err), f->target->var_name);
+    r->failed++;
+    return 0;
+}
+
+/// Recompute every formula downstream of the assigned symbols
+/// Kahn's algorithm over the formulas reached: a formula runs once
+/// every formula computing one of its inputs has run.  A formula that
+/// fails releases none of its readers, so nothing downstream of it is
+/// recomputed from its stale value
+/// @param nsets number of assigned symbols in r->sets
+static void propagate(interp_ctx_t *ctx, reactive_t *r, size_t nsets)
+{
+    size_t mark = ++r->epoch;
+    size_t nwork = 0;
+
+    for (size_t s = 0; s < nsets; ++s) {
+        react_node_t *n = node_find(r, r->sets[s]);
+        for (size_t i = 0; n && i < n->nreaders; ++i) {
+            formula_t *f = n->readers[i];
+            if (f->epoch == mark) continue;
+            f->epoch = mark;
+            r->work = reserve_work(r->work, &r->work_cap, nwork + 1, sizeof(formula_t *));
+            r->work[nwork++] = f;
+        }
+    }
+    for (size_t w = 0; w < nwork; ++w) {
+        react_node_t *n = node_find(r, r->work[w]->target);
+        for (size_t i = 0; n && i < n->nreaders; ++i) {
+            formula_t *f = n->readers[i];
+            if (f->epoch == mark) continue;
+            f->epoch = mark;
+            r->work = reserve_work(r->work, &r->work_cap, nwork + 1, sizeof(formula_t *));
+            r->work[nwork++] = f;
+        }
+    }
+    if (nwork == 0) return;
+
+    // count the inputs that are recomputed in this pass
+    r->order = reserve_work(r->order, &r->order_cap, nwork, sizeof(formula_t *));
+    size_t head = 0, tail = 0;
+    for (size_t w = 0; w < nwork; ++w) {
+        formula_t *f = r->work[w];
+        f->pending = 0;
+        for (size_t d = 0; d < f->ndeps; ++d) {
+            react_node_t *n = node_find(r, f->deps[d]);
+            if (n && n->formula && n->formula->epoch == mark) f->pending++;
+        }
+        if (f->pending == 0) r->order[tail++] = f;
+    }
+
+    while (head < tail) {
+        formula_t *f = r->order[head++];
+        if (!run_formula(ctx, r, f)) continue;
+        react_node_t *n = node_find(r, f->target);
+        for (size_t i = 0; n && i < n->nreaders; ++i) {
+            formula_t *g = n->readers[i];
+            if (g->epoch == mark && --g->pending == 0) r->order[tail++] = g;
+        }
+    }
+}
+
+/// Update the formulas after an expression and recompute downstream
+void react_update(interp_ctx_t *ctx, reactive_t *r, tree_node_t *root)
+{
+    size_t nreads, nsets;
+    collect(r, root, &nreads, &nsets);
+
+    symbol_t *target = NULL;
+    if (root->type == INTERIOR && ((interior_node_t *)root->node)->op == ASSIGN_OP
+        && nsets == 1 && nreads > 0)
+        target = r->sets[0];                   // the root's own target
+
+    size_t mark = ++r->epoch;
+    for (size_t i = 0; target && i < nreads; ++i) {
+        if (r->reads[i] == target) target = NULL;   // x x 1 + = is a plain update
+        else node_add(r, r->reads[i])->epoch = mark;
+    }
+
+    if (target && makes_cycle(r, target, mark)) {
+        fprintf(stderr, "Formula cycle: %s keeps a plain value\n", target->var_name);
+        r->cycles++;
+        target = NULL;
+    }
+
+    if (target) {
+        install(r, target, root, nreads);
+    } else {
+        for (size_t i = 0; i < nsets; ++i) drop_formula(r, r->sets[i]);
+    }
+    propagate(ctx, r, nsets);
+}
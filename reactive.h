@@ -0,0 +1,80 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef REACTIVE_H
+#define REACTIVE_H
+
+#include <stddef.h>
+#include "tree_node.h"
+#include "bytecode.h"
+
+// A live formula: an assignment kept after it ran, and run again
+// whenever a symbol it reads is assigned
+typedef struct formula_s {
+    symbol_t *target;           // the symbol it assigns
+    bytecode_t code;            // the whole assignment, compiled
+    symbol_t **deps;            // the symbols it reads, each once
+    size_t ndeps;
+    size_t epoch;               // recompute that last reached it
+    size_t pending;             // inputs still to be recomputed first
+} formula_t;
+
+// The formulas of one interpreter and the dependency graph between
+// them: for each symbol, the formula that computes it and the
+// formulas that read it.  Symbols are looked up by address in an
+// open-addressing table, so the symbol table itself is not touched.
+typedef struct reactive_s {
+    struct react_node_s *nodes; // graph nodes by symbol (NULL sym = empty)
+    size_t cap;                 // slots (power of two)
+    size_t count;               // occupied slots
+    size_t epoch;               // bumped by every walk of the graph
+
+    tree_node_t **walk;         // scratch: nodes still to visit
+    size_t walk_cap;
+    symbol_t **reads;           // scratch: symbols the expression reads
+    size_t reads_cap;
+    symbol_t **sets;            // scratch: symbols the expression assigns
+    size_t sets_cap;
+    formula_t **work;           // scratch: formulas of one recompute
+    size_t work_cap;
+    formula_t **order;          // scratch: the same, in the order they run
+    size_t order_cap;
+    int *stack;                 // operand stack for running formulas
+    size_t stack_cap;
+
+    size_t live;                // formulas kept
+    size_t recomputed;          // formula runs caused by assignments
+    size_t failed;              // runs that raised an error
+    size_t cycles;              // formulas refused because of a cycle
+} reactive_t;
+
+/// Initializes an empty set of formulas.
+/// @param r  the formulas to initialize
+void react_init(reactive_t *r);
+
+/// Releases every formula and the graph.
+/// @param r  the formulas to free
+void react_free(reactive_t *r);
+
+/// Updates the formulas after an expression has been evaluated, then
+/// recomputes every formula that depends on a symbol the expression
+/// assigned, each once and after all of its inputs (topological
+/// order).  An expression whose root assigns a symbol from a
+/// right-hand side that reads other symbols and assigns nothing
+/// becomes that symbol's formula, replacing any earlier one.  Any
+/// other assignment to a symbol drops its formula: the symbol now
+/// holds a plain value.  A right-hand side that reads its own target
+/// (x x 1 + =) is a plain assignment too.  A formula that would make a
+/// cycle is refused with a message on standard error, and the value
+/// it just assigned stays as a plain value.  Call it only for an
+/// expression that evaluated without error; a failed expression leaves
+/// the formulas as they were.  A recomputed formula that fails
+/// (division by zero, undefined symbol) reports the error on standard
+/// error and leaves its target unchanged, and the formulas that depend
+/// on it are not recomputed.  Reading a symbol never involves the
+/// formulas.
+/// @param ctx  the context the expression ran in
+/// @param r  the context's formulas
+/// @param root  the bound tree of the expression
+void react_update(interp_ctx_t *ctx, reactive_t *r, tree_node_t *root);
+
+#endif
@@ -0,0 +1,274 @@
+// snapshot.c
+// Binary symbol table snapshots: writing one from a table, and
+// opening a mapped one so a table can be loaded without parsing
+// @author: Munkh-Orgil Jargalsaikhan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "snapshot.h"
+
+/// Round up to the 8-byte alignment of every section
+static uint64_t align8(uint64_t n)
+{
+    return (n + 7) & ~(uint64_t)7;
+}
+
+/// 64-bit FNV-1a of a byte range
+static uint64_t checksum(const void *data, size_t len)
+{
+    const unsigned char *p = data;
+    uint64_t h = 14695981039346656037u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211u;
+    }
+    return h;
+}
+
+/// Report a damaged snapshot and exit
+static void bad_snapshot(const char *why)
+{
+    fprintf(stderr, "Error loading symbol table: %s\n", why);
+    exit(EXIT_FAILURE);
+}
+
+/// Tell a snapshot from a text symbol file
+int snapshot_is(const char *map, size_t size)
+{
+    return size >= sizeof(SNAP_MAGIC) && memcmp(map, SNAP_MAGIC, sizeof(SNAP_MAGIC)) == 0;
+}
+
+/// Check that a section of n items of the given size lies in the file
+static int section_fits(uint64_t off, uint64_t n, size_t item, uint64_t file_size)
+{
+    return off % 8 == 0 && off >= sizeof(snap_header_t) && off <= file_size
+        && n <= (file_size - off) / item;
+}
+
+/// Check a mapped snapshot before it is opened
+const char *snapshot_check(const char *map, size_t size, int verify)
+{
+    if (size < sizeof(snap_header_t) || !snapshot_is(map, size)) return "snapshot is truncated";
+
+    const snap_header_t *h = (const snap_header_t *)map;
+    if (h->version != SNAP_VERSION || h->byte_order != SNAP_BYTE_ORDER)
+        return "snapshot version or byte order not supported";
+    if (h->header_check != checksum(h, offsetof(snap_header_t, header_check)))
+        return "snapshot header is damaged";
+    if (h->file_size != size) return "snapshot is truncated";
+
+    if (h->count >= UINT32_MAX || h->index_cap <= h->count
+        || (h->index_cap & (h->index_cap - 1)) != 0
+        || !section_fits(h->values_off, h->count, sizeof(int32_t), size)
+        || !section_fits(h->entries_off, h->count, sizeof(snap_entry_t), size)
+        || !section_fits(h->index_off, h->index_cap, sizeof(uint32_t), size)
+        || !section_fits(h->names_off, h->names_size, 1, size)
+        || (h->names_size > 0 && map[h->names_off + h->names_size - 1] != '\0'))
+        return "snapshot header is damaged";
+
+    if (verify && h->data_check != checksum(map + sizeof(snap_header_t), size - sizeof(snap_header_t)))
+        return "snapshot checksum does not match";
+    return NULL;
+}
+
+/// Check the header of a mapped snapshot and set up access to it
+void snapshot_open(snapshot_t *snap, const char *map, size_t size, int verify)
+{
+    const char *why = snapshot_check(map, size, verify);
+    if (why) bad_snapshot(why);
+
+    const snap_header_t *h = (const snap_header_t *)map;
+    snap->map = map;
+    snap->size = size;
+    snap->count = (size_t)h->count;
+    snap->index_cap = (size_t)h->index_cap;
+    snap->values = (const int32_t *)(map + h->values_off);
+    snap->entries = (const snap_entry_t *)(map + h->entries_off);
+    snap->index = (const uint32_t *)(map + h->index_off);
+    snap->names = map + h->names_off;
+    snap->names_size = (size_t)h->names_size;
+    snap->source_size = h->source_size;
+    snap->source_mtime = h->source_mtime;
+
+    // zeroed pages from the kernel: nothing is touched until it is used
+    snap->syms = calloc(snap->count ? snap->count : 1, sizeof(symbol_t *));
+    if (!snap->syms) {
+        perror("calloc snapshot symbols");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/// The name of an entry, checked against the string heap
+const char *snapshot_name(const snapshot_t *snap, size_t i)
+{
+    const snap_entry_t *e = &snap->entries[i];
+    if (e->name >= snap->names_size || e->len >= snap->names_size - e->name
+        || snap->names[e->name + e->len] != '\0')
+        bad_snapshot("snapshot entry is damaged");
+    return snap->names + e->name;
+}
+
+/// The current value of an entry
+int snapshot_value(const snapshot_t *snap, size_t i)
+{
+    return snap->syms[i] ? snap->syms[i]->val : (int)snap->values[i];
+}
+
+/// Find the entry that binds a name
+size_t snapshot_find(const snapshot_t *snap, const char *name, size_t len, unsigned int hash)
+{
+    size_t mask = snap->index_cap - 1;
+    size_t i = hash & mask;
+    for (size_t probes = 0; probes < snap->index_cap; ++probes) {
+        uint32_t slot = snap->index[i];
+        if (slot == 0) return SNAP_NONE;
+        if (slot > snap->count) bad_snapshot("snapshot index is damaged");
+
+        const snap_entry_t *e = &snap->entries[slot - 1];
+        if (e->hash == hash && e->len == len
+            && memcmp(snapshot_name(snap, slot - 1), name, len) == 0)
+            return slot - 1;
+        i = (i + 1) & mask;
+    }
+    return SNAP_NONE;
+}
+
+/// Sections of a snapshot being built in memory
+typedef struct snap_build_s {
+    char *buf;                  // the whole file
+    int32_t *values;
+    snap_entry_t *entries;
+    uint32_t *index;
+    char *names;
+    size_t count;               // entries added so far
+    size_t names_used;
+    size_t mask;
+} snap_build_t;
+
+/// Add one symbol; the index keeps the first entry for each name
+static void add_entry(snap_build_t *b, const char *name, size_t len, unsigned int hash, int val)
+{
+    size_t n = b->count++;
+    b->values[n] = val;
+    b->entries[n].name = b->names_used;
+    b->entries[n].len = (uint32_t)len;
+    b->entries[n].hash = hash;
+    memcpy(b->names + b->names_used, name, len);
+    b->names[b->names_used + len] = '\0';
+    b->names_used += len + 1;
+
+    size_t i = hash & b->mask;
+    while (b->index[i] != 0) {
+        const snap_entry_t *e = &b->entries[b->index[i] - 1];
+        if (e->hash == hash && e->len == len && memcmp(b->names + e->name, name, len) == 0)
+            return;                     // shadowed by a newer binding
+        i = (i + 1) & b->mask;
+    }
+    b->index[i] = (uint32_t)(n + 1);
+}
+
+/// Write a symbol table to a snapshot file
+int snapshot_write(const symtab_t *tab, const char *filename,
+                   uint64_t source_size, uint64_t source_mtime)
+{
+    const snapshot_t *snap = tab->snap;
+    uint64_t count = 0, heap = 0;
+    for (const symbol_t *s = tab->head; s != NULL; s = s->next) {
+        count++;
+        heap += strlen(s->var_name) + 1;
+    }
+    if (snap) {
+        count += snap->count;
+        for (size_t i = 0; i < snap->count; ++i) heap += snap->entries[i].len + 1;
+    }
+    if (count >= UINT32_MAX) {
+        errno = EFBIG;
+        return -1;
+    }
+
+    uint64_t cap = 1;                   // load factor at most 1/2
+    while (cap < count * 2 || cap <= count) cap *= 2;
+
+    snap_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, sizeof(SNAP_MAGIC));
+    h.version = SNAP_VERSION;
+    h.byte_order = SNAP_BYTE_ORDER;
+    h.count = count;
+    h.index_cap = cap;
+    h.values_off = align8(sizeof(snap_header_t));
+    h.entries_off = align8(h.values_off + count * sizeof(int32_t));
+    h.index_off = align8(h.entries_off + count * sizeof(snap_entry_t));
+    h.names_off = align8(h.index_off + cap * sizeof(uint32_t));
+    h.names_size = heap;
+    h.file_size = h.names_off + heap;
+    h.source_size = source_size;
+    h.source_mtime = source_mtime;
+
+    snap_build_t b;
+    b.buf = calloc(1, (size_t)h.file_size);
+    if (!b.buf) {
+        perror("calloc snapshot");
+        exit(EXIT_FAILURE);
+    }
+    b.values = (int32_t *)(b.buf + h.values_off);
+    b.entries = (snap_entry_t *)(b.buf + h.entries_off);
+    b.index = (uint32_t *)(b.buf + h.index_off);
+    b.names = b.buf + h.names_off;
+    b.count = 0;
+    b.names_used = 0;
+    b.mask = (size_t)cap - 1;
+
+    for (const symbol_t *s = tab->head; s != NULL; s = s->next)
+        add_entry(&b, s->var_name, strlen(s->var_name), s->hash, s->val);
+    if (snap) {
+        for (size_t i = 0; i < snap->count; ++i)
+            add_entry(&b, snapshot_name(snap, i), snap->entries[i].len,
+                      snap->entries[i].hash, snapshot_value(snap, i));
+    }
+
+    h.data_check = checksum(b.buf + sizeof(h), (size_t)h.file_size - sizeof(h));
+    h.header_check = checksum(&h, offsetof(snap_header_t, header_check));
+    memcpy(b.buf, &h, sizeof(h));
+
+    // write beside the target and rename, so no reader sees half a file
+    size_t name_len = strlen(filename);
+    char *tmp = malloc(name_len + 32);
+    if (!tmp) {
+        perror("malloc snapshot name");
+        exit(EXIT_FAILURE);
+    }
+    sprintf(tmp, "%s.%ld.tmp", filename, (long)getpid());
+
+    int ok = 0;
+    FILE *f = fopen(tmp, "wb");
+    if (f) {
+        ok = fwrite(b.buf, 1, (size_t)h.file_size, f) == h.file_size;
+        ok = fclose(f) == 0 && ok;
+        ok = ok && rename(tmp, filename) == 0;
+        if (!ok) {
+            int err = errno;
+            remove(tmp);
+            errno = err;
+        }
+    }
+    free(tmp);
+    free(b.buf);
+    return ok ? 0 : -1;
+}
+
+/// Unmap the snapshot
+void snapshot_close(snapshot_t *snap)
+{
+    munmap((void *)snap->map, snap->size);
+    free(snap->syms);
+    snap->map = NULL;
+    snap->syms = NULL;
+    snap->count = 0;
+}
@@ -0,0 +1,129 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "symtab.h"
+
+#define SNAP_MAGIC "SYMSNAP"        // first 8 bytes of a snapshot (with the NUL)
+#define SNAP_VERSION 2              // layout written by this build
+#define SNAP_BYTE_ORDER 0x01020304u // as stored by the host that wrote it
+#define SNAP_NONE ((size_t)-1)      // snapshot_find(): no such name
+
+// Fixed-size header at the start of a snapshot file.  Every section
+// offset is from the start of the file and aligned to 8 bytes.  The
+// numbers are in the byte order of the host that wrote the file.
+typedef struct snap_header_s {
+    char magic[8];              // SNAP_MAGIC
+    uint32_t version;           // SNAP_VERSION
+    uint32_t byte_order;        // SNAP_BYTE_ORDER
+    uint64_t count;             // number of symbols
+    uint64_t index_cap;         // hash index slots (power of two, > count)
+    uint64_t values_off;        // int32_t value per symbol
+    uint64_t entries_off;       // snap_entry_t per symbol
+    uint64_t index_off;         // uint32_t per slot: symbol + 1, 0 = empty
+    uint64_t names_off;         // null-terminated names
+    uint64_t names_size;
+    uint64_t file_size;         // length of the whole file
+    uint64_t source_size;       // size of the text file it indexes, or 0
+    uint64_t source_mtime;      // its modification time in ns, or 0
+    uint64_t data_check;        // FNV-1a of every byte after the header
+    uint64_t header_check;      // FNV-1a of the header up to this field
+} snap_header_t;
+
+// One symbol of a snapshot, in dump_table() order
+typedef struct snap_entry_s {
+    uint64_t name;              // offset of the name in the string heap
+    uint32_t len;               // length of the name
+    uint32_t hash;              // the symbol table's hash of the name
+} snap_entry_t;
+
+// A snapshot mapped under a symbol table.  Its names and values are
+// read from the mapping; a symbol gets a symbol_t of its own only when
+// an expression first binds it, and the value is copied then.
+typedef struct snapshot_s {
+    const char *map;            // the whole file
+    size_t size;
+    size_t count;
+    size_t index_cap;
+    const int32_t *values;
+    const snap_entry_t *entries;
+    const uint32_t *index;
+    const char *names;
+    size_t names_size;
+    uint64_t source_size;       // text file the snapshot was made from
+    uint64_t source_mtime;
+    symbol_t **syms;            // symbol given to each entry, or NULL
+} snapshot_t;
+
+/// Tells whether a file is a snapshot rather than a text symbol file.
+/// @param map  the file contents
+/// @param size  its length
+/// @return nonzero if it starts with SNAP_MAGIC
+int snapshot_is(const char *map, size_t size);
+
+/// Checks the header and section bounds of a mapped snapshot, and
+/// with verify set the data checksum too.
+/// @param map  the file contents
+/// @param size  its length
+/// @param verify  nonzero to check the data checksum
+/// @return NULL if the snapshot can be opened, otherwise what is wrong
+const char *snapshot_check(const char *map, size_t size, int verify);
+
+/// Checks the header of a mapped snapshot and sets up access to it.
+/// Only the header is read, so opening takes the same time for any
+/// number of symbols; with verify set the data checksum is checked
+/// too, which reads the whole file.  The snapshot owns the mapping.
+/// @param snap  the snapshot to set up
+/// @param map  the file contents, mapped with mmap()
+/// @param size  its length
+/// @param verify  nonzero to check the data checksum
+/// @exception a file that is damaged, truncated, or written by another
+/// version or byte order gets an error message on standard error and
+/// the program exits with EXIT_FAILURE.
+void snapshot_open(snapshot_t *snap, const char *map, size_t size, int verify);
+
+/// Finds a name in the snapshot's hash index.
+/// @param snap  the snapshot
+/// @param name  the name (not necessarily null-terminated)
+/// @param len  its length
+/// @param hash  the symbol table's hash of the name
+/// @return the entry that binds the name, or SNAP_NONE
+size_t snapshot_find(const snapshot_t *snap, const char *name, size_t len, unsigned int hash);
+
+/// The name of an entry.
+/// @param snap  the snapshot
+/// @param i  the entry
+/// @return its null-terminated name, inside the mapping
+const char *snapshot_name(const snapshot_t *snap, size_t i);
+
+/// The current value of an entry: its symbol's value once it has one,
+/// the value in the file before that.
+/// @param snap  the snapshot
+/// @param i  the entry
+/// @return the value
+int snapshot_value(const snapshot_t *snap, size_t i);
+
+/// Writes a symbol table to a snapshot file: the symbols in its list,
+/// then those of the snapshot it was loaded from, in dump_table()
+/// order and with their current values.  A name that appears more
+/// than once is bound to its first appearance, as in the table.
+/// The file is written under a temporary name and renamed into place,
+/// so a reader never maps a partly written snapshot.
+/// @param tab  the table
+/// @param filename  the file to write
+/// @param source_size  size of the text file the table was read from,
+///     kept so a sidecar index can tell it is stale (0 for none)
+/// @param source_mtime  its modification time in nanoseconds (0 for none)
+/// @return 0 on success, -1 with errno set if the file can't be written
+int snapshot_write(const symtab_t *tab, const char *filename,
+                   uint64_t source_size, uint64_t source_mtime);
+
+/// Unmaps the snapshot and frees its entry table.  Symbols it handed
+/// out belong to the symbol table's arena.
+/// @param snap  the snapshot
+void snapshot_close(snapshot_t *snap);
+
+#endif
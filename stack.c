@@ -1,13 +1,10 @@
 // stack.c
-// Generic LIFO stack for holding owned string tokens
-// Memory-safe: every pushed string is duplicated with strdup()
+// LIFO stack of token slices kept in one growable array (the parser
+// pushes slices of the input line; the characters are not copied)
 // @author: Munkh-Orgil Jargalsaikhan
 
-#define _POSIX_C_SOURCE 200809L   // must be first for strdup() with -pedantic
-
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 #include "stack.h"                 // only include once!
 
 /// Create and initialize a new empty stack
@@ -19,66 +16,66 @@ stack_t *make_stack(void)
         perror("malloc");
         exit(EXIT_FAILURE);
     }
-    s->top = NULL;
+    init_stack(s);
     return s;
 }
 
-/// Push a copy of data onto the stack
-/// If data is non-NULL, it is duplicated with strdup() - stack owns the copy
-/// @param stack target stack
-/// @param data pointer to data (expected to be a string)
-void push(stack_t *stack, void *data)
+/// Initialize an empty stack with no array yet
+/// @param stack the stack
+void init_stack(stack_t *stack)
 {
-    if (!stack) return;
+    stack->items = NULL;
+    stack->count = 0;
+    stack->cap = 0;
+}
 
-    stack_node_t *node = malloc(sizeof(stack_node_t));
-    if (!node) {
-        perror("malloc node");
+/// Double the room in the stack's array
+/// @param stack the stack
+static void grow_stack(stack_t *stack)
+{
+    size_t cap = stack->cap ? stack->cap * 2 : 64;
+    token_t *items = realloc(stack->items, cap * sizeof(token_t));
+    if (!items) {
+        perror("realloc stack");
         exit(EXIT_FAILURE);
     }
+    stack->items = items;
+    stack->cap = cap;
+}
 
-    if (data) {
-        node->data = strdup((char *)data);
-        if (!node->data) {
-            perror("strdup");
-            free(node);
-            exit(EXIT_FAILURE);
-        }
-    } else {
-        node->data = NULL;
-    }
+/// Push a token onto the stack
+/// The slice is copied - the caller owns the characters
+/// @param stack target stack
+/// @param token the token
+void push(stack_t *stack, token_t token)
+{
+    if (!stack) return;
 
-    node->next = stack->top;
-    stack->top = node;
+    if (stack->count == stack->cap) grow_stack(stack);
+    stack->items[stack->count++] = token;
 }
 
-/// Return pointer to data at top of stack (does not remove it)
+/// Return pointer to the token at top of stack (does not remove it)
 /// @param stack the stack
-/// @return pointer to top data, exits on empty stack
-void *top(stack_t *stack)
+/// @return pointer to top token, exits on empty stack
+token_t *top(stack_t *stack)
 {
-    if (!stack || !stack->top) {
+    if (!stack || stack->count == 0) {
         fprintf(stderr, "attempt to retrieve the top of an empty stack\n");
         exit(EXIT_FAILURE);
     }
-    return stack->top->data;
+    return &stack->items[stack->count - 1];
 }
 
-/// Remove and free the top element of the stack
-/// Also frees the duplicated string stored in data
+/// Remove the top element of the stack
 /// @param stack the stack
 void pop(stack_t *stack)
 {
-    if (!stack || !stack->top) {
+    if (!stack || stack->count == 0) {
         fprintf(stderr, "attempt to pop from an empty stack\n");
         exit(EXIT_FAILURE);
     }
-
-    stack_node_t *node = stack->top;
-    stack->top = node->next;
-
-    if (node->data) free(node->data);   // free owned token
-    free(node);
+    stack->count--;
 }
 
 /// Check if stack is empty
@@ -87,20 +84,30 @@ void pop(stack_t *stack)
 int empty_stack(stack_t *stack)
 {
     if (!stack) return 1;
-    return (stack->top == NULL) ? 1 : 0;
+    return (stack->count == 0) ? 1 : 0;
+}
+
+/// Empty the stack, keeping its array
+/// @param stack the stack
+void reset_stack(stack_t *stack)
+{
+    if (stack) stack->count = 0;
+}
+
+/// Free the array of an embedded stack
+/// @param stack the stack (left empty and usable)
+void release_stack(stack_t *stack)
+{
+    if (!stack) return;
+    free(stack->items);
+    init_stack(stack);
 }
 
-/// Free entire stack and all owned data
+/// Free entire stack (the token characters are not freed)
 /// @param stack stack to free (also frees the stack_t itself)
 void free_stack(stack_t *stack)
 {
     if (!stack) return;
-
-    while (stack->top) {
-        stack_node_t *node = stack->top;
-        stack->top = node->next;
-        if (node->data) free(node->data);
-        free(node);
-    }
+    release_stack(stack);
     free(stack);
-}
\ No newline at end of file
+}
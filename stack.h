@@ -3,31 +3,39 @@
 #ifndef STACK_H
 #define STACK_H
 
-#include "stack_node.h"
+#include <stddef.h>
+#include "tree_node.h"
 
 typedef struct stack_s {
-    stack_node_t *top;             // linked list of stack_nodes
+    token_t *items;                // the tokens, bottom first
+    size_t count;                  // number of tokens on the stack
+    size_t cap;                    // room in items before it must grow
 } stack_t;
 
 /// make a new stack
-/// @return  a new stack structure with a NULL top pointer
+/// @return  a new empty stack structure
 stack_t *make_stack(void);
 
-/// Add an element to the top of the stack (stack is changed).
-/// This routine should dynamically allocate a new node.
+/// Initialize a stack that lives inside another structure
+/// @param stack Points to the stack
+void init_stack(stack_t *stack);
+
+/// Add a token to the top of the stack (stack is changed).
+/// The slice is copied into the stack's array, which doubles when it
+/// is full; the characters it points to still belong to the caller.
 /// @param stack Points to the stack 
-/// @param data The token (C String)
-void push(stack_t *stack, void *data);
+/// @param token The token
+void push(stack_t *stack, token_t token);
 
 /// Return the top element from the stack (stack is unchanged)
 /// @param stack points to the stack
-/// @return the top element on the stack (a pointer to something)
+/// @return the top token, valid until the next push
 /// @exception If the stack is empty, the program should 
 ///     exit with EXIT_FAILURE
-void *top(stack_t * stack);
+token_t *top(stack_t * stack);
 
 /// Removes the top element from the stack (stack is changed).
-/// This routine should free the memory associated with the top node.
+/// The array keeps its room for later pushes.
 /// @param stack points to the stack
 /// @exception If the stack is empty, the program should 
 ///     exit with EXIT_FAILURE
@@ -38,7 +46,17 @@ void pop(stack_t *stack);
 /// @return 0 if not empty, any other value otherwise
 int empty_stack(stack_t * stack);
 
-/// Frees all of the stack nodes, including the stack structure
+/// Removes every element at once, keeping the array for reuse
+/// @param stack Points to the stack
+void reset_stack(stack_t *stack);
+
+/// Frees the array of a stack set up with init_stack(); the stack
+/// is empty and can be used again afterwards
+/// @param stack Points to the stack
+void release_stack(stack_t *stack);
+
+/// Frees the array and the stack structure of a stack from
+/// make_stack() (the characters of the tokens belong to the caller)
 /// @param stk  Points to the stack to free
 void free_stack(stack_t * stack);
 
@@ -0,0 +1,82 @@
+// stats.c
+// Hot-path counters and the report printed by --stats
+// @author: Munkh-Orgil Jargalsaikhan
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>
+#include "stats.h"
+#include "interp_ctx.h"
+
+#ifndef NO_STATS
+
+/// Monotonic clock in nanoseconds
+uint64_t stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/// Add one timed call to a timer
+void stats_stop(stat_timer_t *timer, uint64_t start)
+{
+    timer->calls++;
+    timer->ns += stats_now() - start;
+}
+
+/// Print one timer line: calls, total milliseconds, average nanoseconds
+static void report_timer(FILE *out, const char *name, const stat_timer_t *t)
+{
+    fprintf(out, "  %-16s %12llu calls %12.3f ms %10.1f ns/call\n", name,
+            (unsigned long long)t->calls, t->ns / 1e6,
+            t->calls ? (double)t->ns / t->calls : 0.0);
+}
+
+#endif
+
+/// Turn the timers on
+void stats_enable(interp_stats_t *st)
+{
+    st->on = 1;
+}
+
+/// Write the --stats report
+void stats_report(interp_ctx_t *ctx, FILE *out)
+{
+#ifndef NO_STATS
+    interp_stats_t *st = &ctx->stats;
+    outbuf_t *ob = ob_stdout();
+
+    fprintf(out, "Stats:\n");
+    if (st->on) {
+        report_timer(out, "make_parse_tree", &st->make_parse_tree);
+        report_timer(out, "tokenize", &st->tokenize);
+        report_timer(out, "parse", &st->parse);
+        report_timer(out, "bind", &st->bind);
+        report_timer(out, "eval_tree", &st->eval_tree);
+        report_timer(out, "vm", &st->vm);
+        report_timer(out, "print", &st->print);
+        report_timer(out, "lookup_table", &st->lookup);
+        report_timer(out, "create_symbol", &st->create);
+    }
+    fprintf(out, "  tokens           %12llu\n", (unsigned long long)st->tokens);
+    fprintf(out, "  nodes built      %12llu\n", (unsigned long long)st->nodes);
+    fprintf(out, "  nodes evaluated  %12llu\n", (unsigned long long)st->evaluated);
+    fprintf(out, "  expr arena       %12zu allocs %6zu blocks\n",
+            ctx->expr_arena_ready ? ctx->expr_arena.allocs : 0,
+            ctx->expr_arena_ready ? ctx->expr_arena.blocks : 0);
+    fprintf(out, "  symbol arena     %12zu allocs %6zu blocks\n",
+            ctx->symtab.arena_ready ? ctx->symtab.arena.allocs : 0,
+            ctx->symtab.arena_ready ? ctx->symtab.arena.blocks : 0);
+    fprintf(out, "  index searches   %12llu (%.2f probes avg, %llu max)\n",
+            (unsigned long long)st->lookups,
+            st->lookups ? (double)st->probes / st->lookups : 0.0,
+            (unsigned long long)st->max_probe);
+    fprintf(out, "  output writes    %12llu (%llu bytes, %.3f ms)\n",
+            ob->writes, ob->written, ob->write_ns / 1e6);
+#else
+    (void)ctx;
+    fprintf(out, "Stats: not available in this build\n");
+#endif
+}
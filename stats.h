@@ -0,0 +1,81 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "symtab.h"
+
+// Time spent in one instrumented function
+typedef struct stat_timer_s {
+    uint64_t calls;             // completed calls while timing was on
+    uint64_t ns;                // total wall time of those calls
+} stat_timer_t;
+
+// Hot-path counters of one interpreter context.  Counters are always
+// kept; the timers only run once stats_enable() has been called, since
+// reading the clock costs more than most of the calls it would time.
+typedef struct interp_stats_s {
+    int on;                     // timers running
+
+    stat_timer_t make_parse_tree;   // tokenizing and parsing a line
+    stat_timer_t tokenize;          // slicing a line into tokens
+    stat_timer_t parse;             // building the tree from the tokens
+    stat_timer_t bind;              // binding SYMBOL leaves to slots
+    stat_timer_t eval_tree;         // the tree walker
+    stat_timer_t vm;                // compiled code (VM or native)
+    stat_timer_t print;             // formatting the infix text
+    stat_timer_t lookup;            // lookup_table()
+    stat_timer_t create;            // create_symbol()
+
+    uint64_t tokens;            // tokens sliced
+    uint64_t nodes;             // tree nodes built by the parser
+    uint64_t evaluated;         // tree nodes evaluated by eval_tree()
+    uint64_t lookups;           // searches of the symbol index
+    uint64_t probes;            // index slots examined by those searches
+    uint64_t max_probe;         // longest single search
+} interp_stats_t;
+
+#ifndef NO_STATS
+
+/// Monotonic clock in nanoseconds.
+/// @return the current time
+uint64_t stats_now(void);
+
+/// Adds one timed call to a timer.
+/// @param timer  the timer
+/// @param start  stats_now() when the call began
+void stats_stop(stat_timer_t *timer, uint64_t start);
+
+// Counters and timers.  With -DNO_STATS every one of these expands to
+// nothing, so the instrumented code is exactly the uninstrumented code.
+#define STAT_ADD(st, field, n)  ((st)->field += (n))
+#define STAT_MAX(st, field, n)  ((st)->field < (n) ? (void)((st)->field = (n)) : (void)0)
+#define STAT_START(st, var)     uint64_t var = (st)->on ? stats_now() : 0
+#define STAT_STOP(st, timer, var) \
+        ((st)->on ? stats_stop(&(st)->timer, var) : (void)0)
+
+#else
+
+#define STAT_ADD(st, field, n)  ((void)(st))
+#define STAT_MAX(st, field, n)  ((void)(st))
+#define STAT_START(st, var)     ((void)(st))
+#define STAT_STOP(st, timer, var) ((void)(st))
+
+#endif
+
+/// Turns the timers on.
+/// @param st  the counters of a context
+void stats_enable(interp_stats_t *st);
+
+/// Writes the report printed by --stats: each timer's calls, total and
+/// average time, then the node, allocation, probe and output counts
+/// (output is counted on the stdout buffer).  Builds with -DNO_STATS
+/// print a single line saying so.
+/// @param ctx  the context
+/// @param out  where the report goes
+void stats_report(interp_ctx_t *ctx, FILE *out);
+
+#endif
@@ -1,36 +1,100 @@
 // symtab.c
-// Simple linked-list symbol table with load-from-file support
+// Hash-indexed symbol table with load-from-file support
+// Symbols and their names live in one arena; an open-addressing
+// index maps names to symbols, and a linked list keeps dump order
 // @author: Munkh-Orgil Jargalsaikhan
 
-#define _POSIX_C_SOURCE 200809L   // for strdup() under strict C99
+#define _POSIX_C_SOURCE 200809L   // POSIX interfaces under strict C99
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "symtab.h"
+#include "arena.h"
+#include "outbuf.h"
+#include "interp_ctx.h"
+#include "stats.h"
+#include "snapshot.h"
+#include "util.h"
 
-/// Head of the symbol table linked list (most recently added first)
-static symbol_t *sym_head = NULL;
 
-
-/// Load symbol table from file (or create empty table if filename is NULL)
-/// Each valid line must be: <name> <integer_value>
-/// Lines starting with # or empty lines are ignored
-/// Malformed lines cause immediate exit with error message
-/// @param filename path to symbol file, or NULL for empty table
-void build_table(char *filename)
+/// Find the index slot for a name: either the slot holding the
+/// symbol with that name, or the empty slot where it would go
+/// @param st counters of the searches and their probes
+/// @param name the name (need not be null-terminated)
+/// @param len length of the name
+/// @param hash hash_name(name, len)
+/// @return slot position in tab->index
+static size_t find_slot(interp_stats_t *st, const symtab_t *tab,
+                        const char *name, size_t len, unsigned int hash)
 {
-    if (!filename) {
-        sym_head = NULL;  // ensure empty table
-        return;
+    size_t mask = tab->index_cap - 1;
+    size_t i = hash & mask;
+    size_t probes = 1;
+    while (tab->index[i] != NULL) {
+        symbol_t *s = tab->index[i];
+        if (s->hash == hash && strncmp(s->var_name, name, len) == 0
+            && s->var_name[len] == '\0') break;
+        i = (i + 1) & mask;
+        probes++;
     }
+    STAT_ADD(st, lookups, 1);
+    STAT_ADD(st, probes, probes);
+    STAT_MAX(st, max_probe, probes);
+    (void)probes;
+    return i;
+}
 
-    FILE *f = fopen(filename, "r");
-    if (!f) {
-        perror(filename);
+/// Double the index (or create it) until it holds count symbols at a
+/// load factor of 1/2, and re-insert every symbol
+/// Stored hashes mean no name is rehashed
+/// @param count number of symbols the index must hold
+static void grow_index(symtab_t *tab, size_t count)
+{
+    size_t old_cap = tab->index_cap;
+    symbol_t **old = tab->index;
+
+    tab->index_cap = old_cap ? old_cap * 2 : SYMTAB_MIN_CAP;
+    while (tab->index_cap < count * 2) tab->index_cap *= 2;
+    tab->index = calloc(tab->index_cap, sizeof(symbol_t *));
+    if (!tab->index) {
+        perror("calloc symbol index");
         exit(EXIT_FAILURE);
     }
 
+    size_t mask = tab->index_cap - 1;
+    for (size_t j = 0; j < old_cap; ++j) {
+        symbol_t *s = old[j];
+        if (!s) continue;
+        size_t i = s->hash & mask;
+        while (tab->index[i] != NULL) i = (i + 1) & mask;
+        tab->index[i] = s;
+    }
+    free(old);
+}
+
+
+static symbol_t *new_symbol(interp_ctx_t *ctx, const char *name, size_t len, int val,
+                            symbol_t **old, symbol_t *spare);
+static void link_symbol(symtab_t *tab, symbol_t *sym);
+
+/// Report a malformed symbol file line and exit
+static void malformed_line(void)
+{
+    fprintf(stderr, "Error loading symbol table: malformed line\n");
+    exit(EXIT_FAILURE);
+}
+
+/// Load symbols from a stream, one fgets() line at a time
+/// Used for files that cannot be mapped (pipes, empty files)
+/// @param f the open symbol file
+static void load_stream(interp_ctx_t *ctx, FILE *f)
+{
     char buf[BUFLEN];
     while (fgets(buf, BUFLEN, f)) {
         char *p = buf;
@@ -44,84 +108,627 @@ void build_table(char *filename)
         int matched = sscanf(buf, " %1023s %d", name, &value);
 
         if (matched == 2) {
-            create_symbol(name, value);  // ignore return value as per spec
+            create_symbol_r(ctx, name, value);  // ignore return value as per spec
         } else {
-            fprintf(stderr, "Error loading symbol table: malformed line\n");
             fclose(f);
+            malformed_line();
+        }
+    }
+}
+
+/// Whitespace as isspace() sees it in the C locale
+static int is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+/// Read an integer the way sscanf's %d does: optional sign, then
+/// decimal digits converted with strtol() rules (saturating at the
+/// long range) and stored into an int
+/// @param p first character
+/// @param end end of the text
+/// @param[out] value the integer
+/// @return the character after the digits, or NULL if there are none
+static const char *scan_int(const char *p, const char *end, int *value)
+{
+    int neg = 0;
+    if (p < end && (*p == '+' || *p == '-')) neg = *p++ == '-';
+    if (p == end || *p < '0' || *p > '9') return NULL;
+
+    unsigned long limit = neg ? (unsigned long)LONG_MAX + 1 : (unsigned long)LONG_MAX;
+    unsigned long mag = 0;
+    int over = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+        unsigned int d = (unsigned int)(*p - '0');
+        if (mag > (limit - d) / 10) over = 1;
+        else if (!over) mag = mag * 10 + d;
+    }
+
+    long l;
+    if (over) l = neg ? LONG_MIN : LONG_MAX;
+    else if (neg) l = mag ? -(long)(mag - 1) - 1 : 0;
+    else l = (long)mag;
+    *value = (int)l;                  // what %d stores for a long value
+    return p;
+}
+
+/// Load symbols from a mapped file
+/// The text is cut into the same pieces fgets() with a BUFLEN buffer
+/// would return and each piece is scanned as sscanf(" %1023s %d")
+/// scans it, so comments, blank lines and malformed lines are treated
+/// as load_stream() treats them.  The table is sized for the file up
+/// front: one index resize, one array of symbols, and every name
+/// copied into one contiguous block.
+/// @param map the file contents
+/// @param size its length in bytes
+static void load_mapped(interp_ctx_t *ctx, const char *map, size_t size)
+{
+    symtab_t *tab = &ctx->symtab;
+    const char *end = map + size;
+
+    size_t lines = 1;
+    for (const char *p = map; (p = memchr(p, '\n', (size_t)(end - p))) != NULL; ++p)
+        lines++;
+    // a line longer than BUFLEN-1 characters is cut into several
+    // pieces, and each piece can hold a symbol
+    size_t pieces = lines + size / (BUFLEN - 1) + 1;
+
+    if (!tab->arena_ready) {
+        arena_init(&tab->arena, 0);
+        tab->arena_ready = 1;
+    }
+    if ((tab->count + pieces) * 2 > tab->index_cap) grow_index(tab, tab->count + pieces);
+
+    // a stored name and its terminator fit in the line that held it
+    symbol_t *pool = arena_alloc(&tab->arena, pieces * sizeof(symbol_t));
+    char *names = arena_alloc(&tab->arena, size);
+    size_t used = 0;
+
+    const char *p = map;
+    while (p < end) {
+        size_t room = (size_t)(end - p) < BUFLEN - 1 ? (size_t)(end - p) : BUFLEN - 1;
+        const char *nl = memchr(p, '\n', room);
+        const char *e = nl ? nl + 1 : p + room;
+        const char *s = p;
+        p = e;
+
+        // skip leading whitespace
+        while (s < e && (*s == ' ' || *s == '\t')) s++;
+        if (s == e || *s == '#' || *s == '\0' || *s == '\n') continue;
+
+        while (s < e && is_space(*s)) s++;
+        const char *name = s;
+        while (s < e && *s != '\0' && !is_space(*s)) s++;
+        size_t len = (size_t)(s - name);
+        while (s < e && is_space(*s)) s++;
+
+        int value;
+        if (len == 0 || !scan_int(s, e, &value)) {
+            munmap((void *)map, size);
+            malformed_line();
+        }
+
+        symbol_t *spare = pool;
+        spare->var_name = memcpy(names + used, name, len);
+        spare->var_name[len] = '\0';
+
+        symbol_t *old;
+        symbol_t *sym = new_symbol(ctx, spare->var_name, len, value, &old, spare);
+        if (sym == spare) {
+            pool++;
+            if (!old) used += len + 1;
+        }
+        sym->val = value;
+        link_symbol(tab, sym);
+    }
+}
+
+
+/// Put a mapped snapshot under the table
+/// Symbols already in the table are newer and stay in front of it
+/// @param map the snapshot file
+/// @param size its length
+static void open_snapshot(interp_ctx_t *ctx, char *map, size_t size)
+{
+    symtab_t *tab = &ctx->symtab;
+    if (tab->snap) {
+        fprintf(stderr, "Error loading symbol table: a snapshot is already loaded\n");
+        exit(EXIT_FAILURE);
+    }
+
+    tab->snap = malloc(sizeof(snapshot_t));
+    if (!tab->snap) {
+        perror("malloc snapshot");
+        exit(EXIT_FAILURE);
+    }
+    posix_madvise(map, size, POSIX_MADV_RANDOM);
+    snapshot_open(tab->snap, map, size, tab->verify_snapshot);
+}
+
+/// Map a whole file, if it exists and is not empty
+/// @param path the file
+/// @param[out] size its length
+/// @return the mapping, or NULL
+static char *map_file(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+    *size = (size_t)st.st_size;
+    return map;
+}
+
+/// Load a mapped text file through its sidecar index
+/// A current index is put under the table like any snapshot; a missing
+/// or stale one is rebuilt from the table after a normal load
+/// @param filename the text file
+/// @param map its contents (unmapped here)
+/// @param st its status
+static void load_lazy(interp_ctx_t *ctx, const char *filename, char *map, const struct stat *st)
+{
+    size_t size = (size_t)st->st_size;
+    uint64_t mtime = (uint64_t)st->st_mtim.tv_sec * 1000000000u + (uint64_t)st->st_mtim.tv_nsec;
+
+    char *idx = malloc(strlen(filename) + sizeof(SYMTAB_INDEX_SUFFIX));
+    if (!idx) {
+        perror("malloc index name");
+        exit(EXIT_FAILURE);
+    }
+    strcpy(idx, filename);
+    strcat(idx, SYMTAB_INDEX_SUFFIX);
+
+    size_t idx_size;
+    char *idx_map = map_file(idx, &idx_size);
+    if (idx_map) {
+        const snap_header_t *h = (const snap_header_t *)idx_map;
+        if (!snapshot_check(idx_map, idx_size, ctx->symtab.verify_snapshot)
+            && h->source_size == size && h->source_mtime == mtime) {
+            munmap(map, size);
+            free(idx);
+            open_snapshot(ctx, idx_map, idx_size);
+            return;
+        }
+        munmap(idx_map, idx_size);
+    }
+
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+    load_mapped(ctx, map, size);
+    munmap(map, size);
+    snapshot_write(&ctx->symtab, idx, size, mtime);    // best effort
+    free(idx);
+}
+
+
+/// Load symbol table from file (or create empty table if filename is NULL)
+/// Each valid line must be: <name> <integer_value>
+/// Lines starting with # or empty lines are ignored
+/// Malformed lines cause immediate exit with error message
+/// Regular files are mapped and scanned in place; anything else is
+/// read line by line
+/// @param ctx the context whose table is built
+/// @param filename path to symbol file, or NULL for empty table
+void build_table_r(interp_ctx_t *ctx, char *filename)
+{
+    if (!filename) {
+        ctx->symtab.head = NULL;  // ensure empty table
+        return;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+
+    if (map == MAP_FAILED) {
+        FILE *f = fdopen(fd, "r");
+        if (!f) {
+            perror(filename);
             exit(EXIT_FAILURE);
         }
+        load_stream(ctx, f);
+        fclose(f);
+        return;
+    }
+    close(fd);
+
+    size_t size = (size_t)st.st_size;
+    if (snapshot_is(map, size)) {
+        open_snapshot(ctx, map, size);
+        return;
+    }
+    if (ctx->symtab.lazy && !ctx->symtab.head && !ctx->symtab.snap) {
+        load_lazy(ctx, filename, map, &st);
+        return;
+    }
+    posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+    load_mapped(ctx, map, size);
+    munmap(map, size);
+}
+
+
+/// Write the table to a binary snapshot
+void save_table_r(interp_ctx_t *ctx, const char *filename)
+{
+    if (snapshot_write(&ctx->symtab, filename, 0, 0) != 0) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+}
+
+
+/// Check whole snapshots when loading them
+void set_verify_snapshot_r(interp_ctx_t *ctx, int on)
+{
+    ctx->symtab.verify_snapshot = on;
+}
+
+
+/// Load text files through a sidecar index
+void set_lazy_r(interp_ctx_t *ctx, int on)
+{
+    ctx->symtab.lazy = on;
+}
+
+
+/// Write one dump line, "\tName: <name>, Value: <value>\n", with a
+/// single copy into the output buffer when it fits in DUMP_LINE bytes
+/// @param name the name (need not be null-terminated)
+/// @param len length of the name
+/// @param val the value
+static void dump_line(outbuf_t *out, const char *name, size_t len, int val)
+{
+    static const char name_tag[] = "\tName: ";
+    static const char value_tag[] = ", Value: ";
+    char line[DUMP_LINE];
+
+    if (len > DUMP_LINE - sizeof(name_tag) - sizeof(value_tag) - 16) {
+        ob_write(out, name_tag, sizeof(name_tag) - 1);
+        ob_write(out, name, len);
+        ob_write(out, value_tag, sizeof(value_tag) - 1);
+        ob_int(out, val);
+        ob_putc(out, '\n');
+        return;
+    }
+
+    char *p = line;
+    memcpy(p, name_tag, sizeof(name_tag) - 1);
+    p += sizeof(name_tag) - 1;
+    memcpy(p, name, len);
+    p += len;
+    memcpy(p, value_tag, sizeof(value_tag) - 1);
+    p += sizeof(value_tag) - 1;
+
+    char digits[16];
+    char *d = digits + sizeof(digits);
+    unsigned int mag = val < 0 ? 0u - (unsigned int)val : (unsigned int)val;
+    do {
+        *--d = (char)('0' + mag % 10);
+        mag /= 10;
+    } while (mag);
+    if (val < 0) *--d = '-';
+    size_t n = (size_t)(digits + sizeof(digits) - d);
+    memcpy(p, d, n);
+    p += n;
+    *p++ = '\n';
+
+    ob_write(out, line, (size_t)(p - line));
+}
+
+/// Print the whole table, or only the symbols assigned since loading
+/// The header is written before the first line, so a dump with no
+/// lines prints nothing
+/// @param changed_only nonzero to skip symbols that were not assigned
+static void dump_symbols(interp_ctx_t *ctx, int changed_only)
+{
+    const snapshot_t *snap = ctx->symtab.snap;
+    outbuf_t *out = ctx_output(ctx);
+    int header = 0;
+
+    for (symbol_t *cur = ctx->symtab.head; cur != NULL; cur = cur->next) {
+        if (changed_only && !cur->changed) continue;
+        if (!header++) ob_write(out, "SYMBOL TABLE:\n", 14);
+        dump_line(out, cur->var_name, strlen(cur->var_name), cur->val);
+    }
+
+    // the snapshot's symbols come after everything defined since;
+    // only those an expression has used can have changed
+    for (size_t i = 0; snap && i < snap->count; ++i) {
+        if (changed_only && !(snap->syms[i] && snap->syms[i]->changed)) continue;
+        if (!header++) ob_write(out, "SYMBOL TABLE:\n", 14);
+        dump_line(out, snapshot_name(snap, i), snap->entries[i].len, snapshot_value(snap, i));
     }
-    fclose(f);
 }
 
 
 /// Print entire symbol table in required format
 /// Only prints if table is non-empty
-void dump_table(void)
+void dump_table_r(interp_ctx_t *ctx)
 {
-    if (!sym_head) return;
+    dump_symbols(ctx, 0);
+}
+
+
+/// Print the symbols assigned since the table was loaded
+void dump_changed_r(interp_ctx_t *ctx)
+{
+    dump_symbols(ctx, 1);
+}
+
 
-    printf("SYMBOL TABLE:\n");
-    for (symbol_t *cur = sym_head; cur != NULL; cur = cur->next) {
-        printf("\tName: %s, Value: %d\n", cur->var_name, cur->val);
+/// Give a snapshot symbol a symbol_t of its own the first time it is
+/// used, and put it in the index so it is not searched for again
+/// It stays in its place in the snapshot's dump order
+/// @param name the name (need not be null-terminated)
+/// @param len length of the name
+/// @param hash hash_name(name, len)
+/// @return the symbol, or NULL if the snapshot does not have the name
+static symbol_t *snapshot_symbol(interp_ctx_t *ctx, const char *name, size_t len, unsigned int hash)
+{
+    symtab_t *tab = &ctx->symtab;
+    size_t i = snapshot_find(tab->snap, name, len, hash);
+    if (i == SNAP_NONE) return NULL;
+
+    if ((tab->count + 1) * 2 > tab->index_cap) grow_index(tab, tab->count + 1);
+    if (!tab->arena_ready) {
+        arena_init(&tab->arena, 0);
+        tab->arena_ready = 1;
     }
+
+    symbol_t *sym = arena_alloc(&tab->arena, sizeof(symbol_t));
+    sym->var_name = (char *)snapshot_name(tab->snap, i);
+    sym->val = snapshot_value(tab->snap, i);
+    sym->hash = hash;
+    sym->defined = 1;                  // defined, but not in the list
+    sym->changed = 0;
+    sym->next = NULL;
+
+    tab->index[find_slot(&ctx->stats, tab, name, len, hash)] = sym;
+    tab->count++;
+    tab->snap->syms[i] = sym;
+    return sym;
 }
 
 
 /// Search symbol table for variable name
 /// @param variable name to look up
 /// @return pointer to symbol if found, NULL otherwise
-symbol_t *lookup_table(char *variable)
+symbol_t *lookup_table_r(interp_ctx_t *ctx, char *variable)
 {
-    if (!variable) return NULL;
+    symtab_t *tab = &ctx->symtab;
+    if (!variable || (tab->count == 0 && !tab->snap)) return NULL;
 
-    for (symbol_t *cur = sym_head; cur != NULL; cur = cur->next) {
-        if (strcmp(cur->var_name, variable) == 0) {
-            return cur;
-        }
+    STAT_START(&ctx->stats, start);
+    size_t len = strlen(variable);
+    unsigned int hash = hash_name(variable, len);
+    symbol_t *s = tab->count ? tab->index[find_slot(&ctx->stats, tab, variable, len, hash)] : NULL;
+    if (!s && tab->snap) s = snapshot_symbol(ctx, variable, len, hash);
+    STAT_STOP(&ctx->stats, lookup, start);
+    return (s && s->defined) ? s : NULL;
+}
+
+
+/// Put a symbol at the head of the dump list
+static void link_symbol(symtab_t *tab, symbol_t *sym)
+{
+    sym->defined = 1;
+    sym->next = tab->head;
+    tab->head = sym;
+}
+
+/// Allocate a symbol for name and make it own its index slot
+/// The name is interned: a repeated name shares the stored string
+/// @param name variable name (copied into the table's arena)
+/// @param len length of the name
+/// @param val initial integer value
+/// @param[out] old previous occupant of the slot, or NULL
+/// @param spare storage for the symbol with var_name already set to a
+///     stored copy of the name, or NULL to allocate both in the arena
+/// @return the new (not yet linked) symbol
+static symbol_t *new_symbol(interp_ctx_t *ctx, const char *name, size_t len, int val,
+                            symbol_t **old, symbol_t *spare)
+{
+    symtab_t *tab = &ctx->symtab;
+    if (!tab->arena_ready) {
+        arena_init(&tab->arena, 0);
+        tab->arena_ready = 1;
     }
-    return NULL;
+
+    /* keep the load factor at or below 1/2 */
+    if ((tab->count + 1) * 2 > tab->index_cap) grow_index(tab, tab->count + 1);
+
+    unsigned int hash = hash_name(name, len);
+    size_t slot = find_slot(&ctx->stats, tab, name, len, hash);
+    *old = tab->index[slot];
+    if (*old && !(*old)->defined) return *old;   // reuse the reservation
+
+    symbol_t *new_sym = spare ? spare : arena_alloc(&tab->arena, sizeof(symbol_t));
+    if (*old) new_sym->var_name = (*old)->var_name;
+    else if (!spare) new_sym->var_name = arena_strndup(&tab->arena, name, len);
+    new_sym->val = val;
+    new_sym->hash = hash;
+    new_sym->defined = 0;
+    new_sym->changed = 0;
+    new_sym->next = NULL;
+
+    if (!*old) tab->count++;
+    tab->index[slot] = new_sym;
+    return new_sym;
 }
 
 
 /// Create a new symbol and insert at head of list
-/// @param name variable name (will be duplicated)
+/// A reserved slot for the same name is defined in place so that
+/// trees already bound to it see the value; otherwise the new symbol
+/// takes over the index slot from any earlier binding of the name
+/// @param ctx the context whose table gets the symbol
+/// @param name variable name (copied into the table's arena)
 /// @param val initial integer value
-/// @return pointer to new symbol, or NULL on allocation failure
-symbol_t *create_symbol(char *name, int val)
+/// @return pointer to new symbol
+symbol_t *create_symbol_r(interp_ctx_t *ctx, char *name, int val)
 {
     if (!name) return NULL;
 
-    symbol_t *new_sym = malloc(sizeof(symbol_t));
-    if (!new_sym) {
-        perror("malloc");
-        return NULL;
-    }
+    STAT_START(&ctx->stats, start);
+    symbol_t *old;
+    symbol_t *sym = new_symbol(ctx, name, strlen(name), val, &old, NULL);
+    sym->val = val;
+    link_symbol(&ctx->symtab, sym);
+    STAT_STOP(&ctx->stats, create, start);
+    return sym;
+}
+
+
+/// Find or reserve the slot for a name
+/// Only a name seen for the first time is copied
+/// @param ctx the context whose table holds the slot
+/// @param name variable name (need not be null-terminated)
+/// @param len length of the name
+/// @return existing symbol, or a new undefined slot
+symbol_t *reserve_symbol_r(interp_ctx_t *ctx, const char *name, size_t len)
+{
+    symtab_t *tab = &ctx->symtab;
+    if (!name) return NULL;
 
-    new_sym->var_name = strdup(name);
-    if (!new_sym->var_name) {
-        perror("strdup");
-        free(new_sym);
-        return NULL;
+    if (tab->count > 0) {
+        symbol_t *s = tab->index[find_slot(&ctx->stats, tab, name, len,
+                                           hash_name(name, len))];
+        if (s) return s;
+    }
+    if (tab->snap) {
+        symbol_t *s = snapshot_symbol(ctx, name, len, hash_name(name, len));
+        if (s) return s;
     }
 
-    new_sym->val = val;
-    new_sym->next = sym_head;
-    sym_head = new_sym;
+    symbol_t *old;
+    return new_symbol(ctx, name, len, 0, &old, NULL);
+}
 
-    return new_sym;
+
+/// Assign through a slot, defining it on first use
+/// @param ctx the context whose table holds the slot
+/// @param sym slot to assign
+/// @param val new value
+void define_symbol_r(interp_ctx_t *ctx, symbol_t *sym, int val)
+{
+    sym->val = val;
+    sym->changed = 1;
+    if (!sym->defined) link_symbol(&ctx->symtab, sym);
+}
+
+
+/// Link a slot defined elsewhere into the dump list
+/// @param ctx the context whose table holds the slot
+/// @param sym defined slot not yet in the list
+void attach_symbol_r(interp_ctx_t *ctx, symbol_t *sym)
+{
+    link_symbol(&ctx->symtab, sym);
 }
 
 
 /// Free all memory used by the symbol table
-void free_table(void)
+/// @param ctx the context whose table is freed
+void free_table_r(interp_ctx_t *ctx)
 {
-    symbol_t *cur = sym_head;
-    while (cur != NULL) {
-        symbol_t *next = cur->next;
-        if (cur->var_name) free(cur->var_name);
-        free(cur);
-        cur = next;
+    symtab_t *tab = &ctx->symtab;
+    if (tab->snap) {
+        snapshot_close(tab->snap);
+        free(tab->snap);
+        tab->snap = NULL;
     }
-    sym_head = NULL;
-}
\ No newline at end of file
+    if (tab->arena_ready) arena_free(&tab->arena);
+    tab->arena_ready = 0;
+    free(tab->index);
+    tab->index = NULL;
+    tab->index_cap = 0;
+    tab->count = 0;
+    tab->head = NULL;
+}
+
+
+/* ---- the same operations on the default context ---- */
+
+/// build_table_r() on the default context
+void build_table(char *filename)
+{
+    build_table_r(default_ctx(), filename);
+}
+
+/// save_table_r() on the default context
+void save_table(const char *filename)
+{
+    save_table_r(default_ctx(), filename);
+}
+
+/// set_verify_snapshot_r() on the default context
+void set_verify_snapshot(int on)
+{
+    set_verify_snapshot_r(default_ctx(), on);
+}
+
+/// set_lazy_r() on the default context
+void set_lazy(int on)
+{
+    set_lazy_r(default_ctx(), on);
+}
+
+/// dump_table_r() on the default context
+void dump_table(void)
+{
+    dump_table_r(default_ctx());
+}
+
+/// dump_changed_r() on the default context
+void dump_changed(void)
+{
+    dump_changed_r(default_ctx());
+}
+
+/// lookup_table_r() on the default context
+symbol_t *lookup_table(char *variable)
+{
+    return lookup_table_r(default_ctx(), variable);
+}
+
+/// create_symbol_r() on the default context
+symbol_t *create_symbol(char *name, int val)
+{
+    return create_symbol_r(default_ctx(), name, val);
+}
+
+/// reserve_symbol_r() on the default context
+symbol_t *reserve_symbol(const char *name, size_t len)
+{
+    return reserve_symbol_r(default_ctx(), name, len);
+}
+
+/// define_symbol_r() on the default context
+void define_symbol(symbol_t *sym, int val)
+{
+    define_symbol_r(default_ctx(), sym, val);
+}
+
+/// attach_symbol_r() on the default context
+void attach_symbol(symbol_t *sym)
+{
+    attach_symbol_r(default_ctx(), sym);
+}
+
+/// free_table_r() on the default context
+void free_table(void)
+{
+    free_table_r(default_ctx());
+}
@@ -3,15 +3,46 @@
 #ifndef SYMTAB_H
 #define SYMTAB_H
 
+#include <stddef.h>
+#include "arena.h"
+
 #define BUFLEN 1024             // input buffer length for initial symbols
 
+#define SYMTAB_MIN_CAP 64       // initial number of hash index slots
+
+#define DUMP_LINE 256           // dump lines up to this long are copied once
+
+#define SYMTAB_INDEX_SUFFIX ".idx"  // sidecar index of a lazily loaded file
+
 // A single symbol definition
 typedef struct symbol_s {
-    char *var_name;             // the name of the symbol
+    char *var_name;             // the name of the symbol (interned)
     int val;                    // the value currently bound to this symbol
+    unsigned int hash;          // hash of var_name, kept for index resizes
+    int defined;                // 0 while the slot is only reserved
+    int changed;                // assigned by an expression since loading
     struct symbol_s *next;      // the next item in the list
 } symbol_t;
 
+// The symbol table of one interpreter context
+typedef struct symtab_s {
+    symbol_t *head;             // dump list, most recently added first
+    symbol_t **index;           // open-addressing index (NULL = empty slot)
+    size_t index_cap;           // number of index slots (power of two)
+    size_t count;               // number of occupied slots
+    arena_t arena;              // every symbol_t and interned name
+    int arena_ready;
+    struct snapshot_s *snap;    // snapshot the table was loaded from, or NULL
+    int verify_snapshot;        // check the data checksum when loading one
+    int lazy;                   // load text files through a sidecar index
+} symtab_t;
+
+// An interpreter: its symbol table, error state, allocators and
+// output (see interp_ctx.h).  Every function below works on the table
+// of the context it is given, so separate contexts can be used from
+// separate threads.
+typedef struct interp_ctx_s interp_ctx_t;
+
 /// Constructs the table by reading the file.  The format is
 /// one symbol per line in the format:
 ///
@@ -22,6 +53,7 @@ typedef struct symbol_s {
 /// unique, and the format of the file is error free.
 /// You are allowed to create it statically or
 /// dynamically and store it locally.
+/// @param ctx  the context whose table is built
 /// @param filename The name of the file containing the symbols
 /// @exception If the file can't be opened, an error message should
 /// be displayed to standard error and the program should exit
@@ -30,7 +62,36 @@ typedef struct symbol_s {
 ///
 /// Error loading symbol table
 ///
-void build_table(char *filename);
+/// The file may also be a snapshot written by save_table().  It is
+/// mapped rather than read: its symbols show up in lookup_table() and
+/// dump_table() right away, and each gets a symbol_t of its own only
+/// when an expression first uses it.
+void build_table_r(interp_ctx_t *ctx, char *filename);
+
+/// Writes the symbol table, as dump_table() would show it, to a binary
+/// snapshot (see snapshot.h) that build_table() can load.
+/// @param ctx  the context whose table is saved
+/// @param filename  the file to write
+/// @exception If the file can't be written, an error message is
+/// displayed to standard error and the program exits with EXIT_FAILURE.
+void save_table_r(interp_ctx_t *ctx, const char *filename);
+
+/// Makes build_table() check the checksum of a snapshot's data, not
+/// just its header.  This reads the whole file, so it is off by default.
+/// @param ctx  the context
+/// @param on  nonzero to check snapshots in full
+void set_verify_snapshot_r(interp_ctx_t *ctx, int on);
+
+/// Makes build_table() load a text symbol file through a sidecar index
+/// (the file's name followed by SYMTAB_INDEX_SUFFIX): a snapshot of the
+/// file that remembers the file's size and modification time.  When
+/// the index is current it is mapped instead of reading the file, so
+/// startup and memory follow the symbols a script uses.  Otherwise the
+/// file is read as usual and the index is written for the next run; a
+/// directory that can't be written to just means no index.
+/// @param ctx  the context
+/// @param on  nonzero to load lazily
+void set_lazy_r(interp_ctx_t *ctx, int on);
 
 /// Displays the contents of the symbol table in the following format:
 ///
@@ -38,25 +99,106 @@ void build_table(char *filename);
 ///     Name: variable-name, Value: variable-value
 ///     ...
 ///
-/// Each symbol should be printed one per line, tab-indented.
-void dump_table(void);
+/// Each symbol should be printed one per line, tab-indented, to the
+/// context's output (see set_output_r()).
+/// @param ctx  the context whose table is shown
+void dump_table_r(interp_ctx_t *ctx);
+
+/// Displays only the symbols created or assigned by expressions since
+/// the table was loaded, in the format and order of dump_table().
+/// Every store marks its symbol, so this costs nothing until the dump
+/// itself; nothing is printed if no symbol changed.
+/// @param ctx  the context whose table is shown
+void dump_changed_r(interp_ctx_t *ctx);
 
 /// Returns the symtab_t object in the symbol table associated
-///     with the variable name
+///     with the variable name.  Symbols are found through an
+///     open-addressing hash index, so the cost does not grow
+///     with the size of the table.
+/// @param ctx  the context whose table is searched
 /// @param variable The name of the variable (a C string)
 /// @return The symbol_t object containing the binding,
 ///     or NULL if not found
-symbol_t *lookup_table(char *variable);
+symbol_t *lookup_table_r(interp_ctx_t *ctx, char *variable);
 
 /// Adds a binding to the symbol table
+/// @param ctx  the context whose table gets the binding
 /// @param name  The name of the variable (a C string)
 /// @param val  The value associated with the variable
 /// @return the new symbol_t object added to the table,
 ///     or NULL if no space is available
-/// No check is done to see if the symbol is already in the table
-symbol_t *create_symbol(char *name, int val);
+/// No check is done to see if the symbol is already in the table;
+/// a repeated name shadows the earlier binding in lookup_table()
+/// but both stay in the list shown by dump_table().
+symbol_t *create_symbol_r(interp_ctx_t *ctx, char *name, int val);
+
+/// Returns the slot for a name, reserving an undefined one if the
+/// name is not in the table yet.  Parse trees bind their SYMBOL
+/// leaves to these slots once, so evaluation never searches by name.
+/// A reserved slot is invisible to lookup_table() and dump_table()
+/// until define_symbol() gives it a value.
+/// @param ctx  the context whose table holds the slot
+/// @param name  The name of the variable (not necessarily null-terminated)
+/// @param len  The length of the name
+/// @return the symbol_t slot for the name
+symbol_t *reserve_symbol_r(interp_ctx_t *ctx, const char *name, size_t len);
+
+/// Binds a value to a slot, defining it if it was only reserved.
+/// A newly defined slot joins the table exactly as create_symbol()
+/// would have added it at this point.
+/// @param ctx  the context whose table holds the slot
+/// @param sym  a slot returned by reserve_symbol() or lookup_table()
+/// @param val  the value to bind
+void define_symbol_r(interp_ctx_t *ctx, symbol_t *sym, int val);
+
+/// Links a slot that was already given a value without joining the
+/// table (see vm_exec_log()) into the table, as define_symbol() would
+/// have at the time.  Slots must be attached in definition order.
+/// @param ctx  the context whose table holds the slot
+/// @param sym  a defined slot that is not yet in the table
+void attach_symbol_r(interp_ctx_t *ctx, symbol_t *sym);
 
 /// Destroys the symbol table
+/// @param ctx  the context whose table is freed
+void free_table_r(interp_ctx_t *ctx);
+
+// The same functions on the process's default context (default_ctx()),
+// kept for the command-line program and for existing callers.
+
+/// build_table_r() on the default context
+void build_table(char *filename);
+
+/// save_table_r() on the default context
+void save_table(const char *filename);
+
+/// set_verify_snapshot_r() on the default context
+void set_verify_snapshot(int on);
+
+/// set_lazy_r() on the default context
+void set_lazy(int on);
+
+/// dump_table_r() on the default context
+void dump_table(void);
+
+/// dump_changed_r() on the default context
+void dump_changed(void);
+
+/// lookup_table_r() on the default context
+symbol_t *lookup_table(char *variable);
+
+/// create_symbol_r() on the default context
+symbol_t *create_symbol(char *name, int val);
+
+/// reserve_symbol_r() on the default context
+symbol_t *reserve_symbol(const char *name, size_t len);
+
+/// define_symbol_r() on the default context
+void define_symbol(symbol_t *sym, int val);
+
+/// attach_symbol_r() on the default context
+void attach_symbol(symbol_t *sym);
+
+/// free_table_r() on the default context
 void free_table(void);
 
 #endif
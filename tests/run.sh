@@ -0,0 +1,422 @@
+#!/bin/sh
+# run.sh
+# Regression tests: each case runs the interpreter on a small input
+# and compares its standard output with the expected text
+# usage: tests/run.sh [path-to-interp]
+# @author: Munkh-Orgil Jargalsaikhan
+
+INTERP=${1:-./interp}
+TMP=${TMPDIR:-/tmp}/interp-tests.$$
+mkdir -p "$TMP" || exit 1
+trap 'rm -rf "$TMP"' EXIT
+
+failed=0
+passed=0
+
+# check NAME ARGS...: run the interpreter on $TMP/in with ARGS and
+# compare standard output with $TMP/expected
+check()
+{
+    name=$1
+    shift
+    "$INTERP" "$@" < "$TMP/in" > "$TMP/out" 2> "$TMP/err"
+    status=$?
+    if [ $status -ne 0 ]; then
+        echo "FAIL $name: exit status $status"
+        cat "$TMP/err"
+        failed=$((failed + 1))
+    elif ! diff -u "$TMP/expected" "$TMP/out" > "$TMP/diff"; then
+        echo "FAIL $name"
+        cat "$TMP/diff"
+        failed=$((failed + 1))
+    else
+        passed=$((passed + 1))
+    fi
+}
+
+# check_fails NAME ARGS...: running the interpreter on $TMP/in with
+# ARGS exits with a failure status
+check_fails()
+{
+    name=$1
+    shift
+    if "$INTERP" "$@" < "$TMP/in" > "$TMP/out" 2> "$TMP/err"; then
+        echo "FAIL $name: exit status 0"
+        failed=$((failed + 1))
+    else
+        passed=$((passed + 1))
+    fi
+}
+
+# check_err NAME TEXT: the last check wrote TEXT to standard error
+check_err()
+{
+    if grep -F -q -- "$2" "$TMP/err"; then
+        passed=$((passed + 1))
+    else
+        echo "FAIL $1: no \"$2\" on standard error"
+        cat "$TMP/err"
+        failed=$((failed + 1))
+    fi
+}
+
+# Shared subexpressions must not change the cached infix text: literals
+# are shared by value, and folded leaves carry an operator's token
+cat > "$TMP/in" <<'IN'
+z 5 =
+z 007 % z 7 % +
+z 7 0 + % 1 z 7 % / +
+z 007 % z 7 % +
+z 7 0 + % 1 z 7 % / +
+IN
+cat > "$TMP/expected" <<'OUT'
+Enter postfix expressions (CTRL-D to exit):
+> (z=5) = 5
+> ((z%007)+(z%7)) = 10
+> ((z%(7+0))+(1/(z%7))) = 5
+> ((z%007)+(z%7)) = 10
+> ((z%(7+0))+(1/(z%7))) = 5
+> 
+SYMBOL TABLE:
+	Name: z, Value: 5
+OUT
+check cse-cached-infix --cache=8 --cse
+check cse-cached-infix-folded --cache=8 --cse -O
+
+# A symbol file line longer than the load buffer is read in pieces, as
+# fgets() would read it, and every piece can define a symbol
+printf '%-1023s%-1023s%-1023s%-1023s' 'a 1' 'b 2' 'c 3' 'd 4' > "$TMP/long.sym"
+: > "$TMP/in"
+cat > "$TMP/expected" <<'OUT'
+SYMBOL TABLE:
+	Name: d, Value: 4
+	Name: c, Value: 3
+	Name: b, Value: 2
+	Name: a, Value: 1
+Enter postfix expressions (CTRL-D to exit):
+> 
+SYMBOL TABLE:
+	Name: d, Value: 4
+	Name: c, Value: 3
+	Name: b, Value: 2
+	Name: a, Value: 1
+OUT
+check long-symbol-line "$TMP/long.sym"
+printf '\ne 5\n' >> "$TMP/long.sym"
+cat > "$TMP/expected" <<'OUT'
+SYMBOL TABLE:
+	Name: e, Value: 5
+	Name: d, Value: 4
+	Name: c, Value: 3
+	Name: b, Value: 2
+	Name: a, Value: 1
+Enter postfix expressions (CTRL-D to exit):
+> 
+SYMBOL TABLE:
+	Name: e, Value: 5
+	Name: d, Value: 4
+	Name: c, Value: 3
+	Name: b, Value: 2
+	Name: a, Value: 1
+OUT
+check long-symbol-line-then-short "$TMP/long.sym"
+
+# Constant folding gives the same results and errors as evaluating
+# the tree as written: a constant division by zero still fails, and a
+# product with 0 still needs its other operand
+cat > "$TMP/in" <<'IN'
+x 2 3 * 4 + =
+y x 1 0 / + =
+z 0 x * =
+x 1 1 - /
+w 0 q * =
+x 0 + 1 *
+IN
+cat > "$TMP/expected" <<'OUT'
+Enter postfix expressions (CTRL-D to exit):
+> (x=((2*3)+4)) = 10
+> (y=(x+(1/0)))
+> (z=(0*x)) = 0
+> (x/(1-1))
+> (w=(0*q))
+> ((x+0)*1) = 10
+> 
+SYMBOL TABLE:
+	Name: z, Value: 0
+	Name: x, Value: 10
+OUT
+check optimize-keeps-errors -O
+check_err optimize-keeps-errors "Division by zero"
+check_err optimize-keeps-errors "Undefined symbol"
+
+# A saved snapshot loads back, checksum and all, as the table it was
+# saved from; a changed byte in its names fails the checksum
+printf 'a 1\nb 2\n' > "$TMP/snap.sym"
+cat > "$TMP/in" <<'IN'
+c a b + =
+IN
+cat > "$TMP/expected" <<'OUT'
+SYMBOL TABLE:
+	Name: b, Value: 2
+	Name: a, Value: 1
+Enter postfix expressions (CTRL-D to exit):
+> (c=(a+b)) = 3
+> 
+SYMBOL TABLE:
+	Name: c, Value: 3
+	Name: b, Value: 2
+	Name: a, Value: 1
+OUT
+check snapshot-save --save="$TMP/snap" "$TMP/snap.sym"
+cat > "$TMP/in" <<'IN'
+c a -
+IN
+cat > "$TMP/expected" <<'OUT'
+SYMBOL TABLE:
+	Name: c, Value: 3
+	Name: b, Value: 2
+	Name: a, Value: 1
+Enter postfix expressions (CTRL-D to exit):
+> (c-a) = 2
+> 
+SYMBOL TABLE:
+	Name: c, Value: 3
+	Name: b, Value: 2
+	Name: a, Value: 1
+OUT
+check snapshot-verify --verify-snapshot "$TMP/snap"
+size=$(wc -c < "$TMP/snap")
+printf 'Z' | dd of="$TMP/snap" bs=1 seek=$((size - 2)) conv=notrunc 2> /dev/null
+check_fails snapshot-corrupt --verify-snapshot "$TMP/snap"
+check_err snapshot-corrupt "snapshot checksum does not match"
+
+# Lazy loading: with no index the file is read and the index written;
+# an index left behind by an older version of the file, or one that is
+# not an index at all, is not trusted
+printf 'a 1\nb 2\n' > "$TMP/lazy.sym"
+rm -f "$TMP/lazy.sym.idx"
+cat > "$TMP/in" <<'IN'
+a b +
+IN
+cat > "$TMP/expected" <<'OUT'
+SYMBOL TABLE:
+	Name: b, Value: 2
+	Name: a, Value: 1
+Enter postfix expressions (CTRL-D to exit):
+> (a+b) = 3
+> 
+SYMBOL TABLE:
+	Name: b, Value: 2
+	Name: a, Value: 1
+OUT
+check lazy-no-index --lazy "$TMP/lazy.sym"
+if [ -f "$TMP/lazy.sym.idx" ]; then
+    passed=$((passed + 1))
+else
+    echo "FAIL lazy-no-index: no index written"
+    failed=$((failed + 1))
+fi
+check lazy-index --lazy "$TMP/lazy.sym"
+printf 'a 5\nb 2\nc 7\n' > "$TMP/lazy.sym"
+cat > "$TMP/in" <<'IN'
+a b + c +
+IN
+cat > "$TMP/expected" <<'OUT'
+SYMBOL TABLE:
+	Name: c, Value: 7
+	Name: b, Value: 2
+	Name: a, Value: 5
+Enter postfix expressions (CTRL-D to exit):
+> ((a+b)+c) = 14
+> 
+SYMBOL TABLE:
+	Name: c, Value: 7
+	Name: b, Value: 2
+	Name: a, Value: 5
+OUT
+check lazy-stale-index --lazy "$TMP/lazy.sym"
+echo garbage > "$TMP/lazy.sym.idx"
+check lazy-bad-index --lazy "$TMP/lazy.sym"
+
+# --dump=changed ends with only the symbols an expression assigned,
+# even to the value they had; reads and failed assignments do not count
+printf 'a 1\nb 2\nc 3\n' > "$TMP/dump.sym"
+cat > "$TMP/in" <<'IN'
+b 5 =
+d a c + =
+a
+q 1 0 / =
+c 3 =
+IN
+cat > "$TMP/expected" <<'OUT'
+SYMBOL TABLE:
+	Name: c, Value: 3
+	Name: b, Value: 2
+	Name: a, Value: 1
+Enter postfix expressions (CTRL-D to exit):
+> (b=5) = 5
+> (d=(a+c)) = 4
+> a = 1
+> (q=(1/0))
+> (c=3) = 3
+> 
+SYMBOL TABLE:
+	Name: d, Value: 4
+	Name: c, Value: 3
+	Name: b, Value: 5
+OUT
+check dump-changed --dump=changed "$TMP/dump.sym"
+cp "$TMP/in" "$TMP/dump.script"
+cat > "$TMP/expected" <<'OUT'
+SYMBOL TABLE:
+	Name: c, Value: 3
+	Name: b, Value: 2
+	Name: a, Value: 1
+(b=5) = 5
+(d=(a+c)) = 4
+a = 1
+(q=(1/0))
+(c=3) = 3
+SYMBOL TABLE:
+	Name: d, Value: 4
+	Name: c, Value: 3
+	Name: b, Value: 5
+OUT
+check dump-changed-jobs --dump=changed -f "$TMP/dump.script" --jobs=2 "$TMP/dump.sym"
+cat > "$TMP/in" <<'IN'
+a b +
+IN
+cat > "$TMP/expected" <<'OUT'
+SYMBOL TABLE:
+	Name: c, Value: 3
+	Name: b, Value: 2
+	Name: a, Value: 1
+Enter postfix expressions (CTRL-D to exit):
+> (a+b) = 3
+> 
+OUT
+check dump-changed-none --dump=changed "$TMP/dump.sym"
+
+# Columns: every row gets the value, or the error, that evaluating the
+# expression with that row's symbols alone gives; a name given twice
+# in the column file keeps its later values
+cat > "$TMP/cols" <<'COLS'
+x 1 2 0 4
+y 4 0 6 1
+# x again
+x 3 2 0 5
+COLS
+cat > "$TMP/in" <<'IN'
+x y +
+y x /
+x y x / 9 ?
+z x 1 - =
+v y x / =
+v 1 +
+IN
+cat > "$TMP/expected" <<'OUT'
+COLUMNS:
+	Name: x, Values: 3 2 0 5
+	Name: y, Values: 4 0 6 1
+Enter postfix expressions (CTRL-D to exit):
+> (x+y) = 7 2 6 6
+> (y/x) = 1 0 error 0
+> (x?((y/x):9)) = 1 0 9 0
+> (z=(x-1)) = 2 1 -1 4
+> (v=(y/x)) = 1 0 error 0
+> (v+1) = 2 1 error 1
+> 
+COLUMNS:
+	Name: x, Values: 3 2 0 5
+	Name: y, Values: 4 0 6 1
+	Name: z, Values: 2 1 -1 4
+	Name: v, Values: 1 0 - 0
+OUT
+check columns --columns="$TMP/cols"
+check_err columns "Division by zero in 1 of 4 rows"
+check_err columns "Undefined symbol in 1 of 4 rows"
+
+# Reactive formulas: a line that fails to evaluate neither installs a
+# formula nor drops one
+cat > "$TMP/in" <<'IN'
+a 10 =
+y a c / =
+c 1 =
+b 2 =
+t a b + =
+t 1 0 / =
+a 5 =
+IN
+cat > "$TMP/expected" <<'OUT'
+Enter postfix expressions (CTRL-D to exit):
+> (a=10) = 10
+> (y=(a/c))
+> (c=1) = 1
+> (b=2) = 2
+> (t=(a+b)) = 12
+> (t=(1/0))
+> (a=5) = 5
+> 
+SYMBOL TABLE:
+	Name: t, Value: 7
+	Name: b, Value: 2
+	Name: c, Value: 1
+	Name: a, Value: 5
+OUT
+check reactive-failed-line --reactive
+
+# A formula that fails while recomputing is reported, and the formulas
+# reading its target are not recomputed from the stale value
+cat > "$TMP/in" <<'IN'
+a 6 =
+b 2 =
+q a b / =
+r q a + =
+b 0 =
+a 8 =
+r
+b 4 =
+IN
+cat > "$TMP/expected" <<'OUT'
+Enter postfix expressions (CTRL-D to exit):
+> (a=6) = 6
+> (b=2) = 2
+> (q=(a/b)) = 3
+> (r=(q+a)) = 9
+> (b=0) = 0
+> (a=8) = 8
+> r = 9
+> (b=4) = 4
+> 
+SYMBOL TABLE:
+	Name: r, Value: 10
+	Name: q, Value: 2
+	Name: b, Value: 4
+	Name: a, Value: 8
+OUT
+check reactive-failed-recompute --reactive
+check_err reactive-failed-recompute "Division by zero (recomputing q)"
+
+# A formula that would close a cycle keeps its value as a plain one
+cat > "$TMP/in" <<'IN'
+a 1 =
+b a 1 + =
+a b 1 + =
+a 10 =
+IN
+cat > "$TMP/expected" <<'OUT'
+Enter postfix expressions (CTRL-D to exit):
+> (a=1) = 1
+> (b=(a+1)) = 2
+> (a=(b+1)) = 3
+> (a=10) = 10
+> 
+SYMBOL TABLE:
+	Name: b, Value: 11
+	Name: a, Value: 10
+OUT
+check reactive-cycle --reactive
+check_err reactive-cycle "Formula cycle: a keeps a plain value"
+
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
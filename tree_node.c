@@ -1,42 +1,77 @@
 // tree_node.c
 // Parse tree node creation and cleanup
-// FIXED: All nodes now own their token strings via strdup()
+// Nodes come from a per-expression arena and point into the input
+// line, or come from the heap when no arena is given (heap nodes own
+// null-terminated copies of their tokens)
 // @author: Munkh-Orgil Jargalsaikhan
 
-#define _POSIX_C_SOURCE 200809L   // for strdup()
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "tree_node.h"
 
+/// An interior node and its payload allocated together in an arena
+typedef struct interior_block_s {
+    tree_node_t tn;
+    interior_node_t in;
+} interior_block_t;
+
+/// A leaf node and its payload allocated together in an arena
+typedef struct leaf_block_s {
+    tree_node_t tn;
+    leaf_node_t ln;
+} leaf_block_t;
+
+/// Null-terminated heap copy of a token
+/// @param token the token slice
+/// @return the copy, or NULL if allocation fails
+static char *copy_token(token_t token)
+{
+    char *copy = malloc(token.len + 1);
+    if (!copy) return NULL;
+    memcpy(copy, token.str, token.len);
+    copy[token.len] = '\0';
+    return copy;
+}
+
 /// Create an interior node (operator)
-/// Now duplicates the token so tree owns it independently of stack
-tree_node_t *make_interior(op_type_t op, char *token,
+/// One arena allocation, or three heap allocations (node, payload, token)
+tree_node_t *make_interior(arena_t *arena, op_type_t op, token_t token,
                            tree_node_t *left, tree_node_t *right)
 {
-    tree_node_t *tn = malloc(sizeof(tree_node_t));
-    if (!tn) {
-        perror("malloc tree_node_t");
-        return NULL;
-    }
+    tree_node_t *tn;
+    interior_node_t *in;
 
-    tn->type = INTERIOR;
-    tn->token = token ? strdup(token) : NULL;  // OWN COPY
-    if (token && !tn->token) {
-        perror("strdup token");
-        free(tn);
-        return NULL;
-    }
+    if (arena) {
+        interior_block_t *blk = arena_alloc(arena, sizeof(interior_block_t));
+        tn = &blk->tn;
+        in = &blk->in;
+        tn->token = token.str;                 // slice of the input line
+    } else {
+        tn = malloc(sizeof(tree_node_t));
+        if (!tn) {
+            perror("malloc tree_node_t");
+            return NULL;
+        }
+
+        tn->token = copy_token(token);         // OWN COPY
+        if (!tn->token) {
+            perror("malloc token");
+            free(tn);
+            return NULL;
+        }
 
-    interior_node_t *in = malloc(sizeof(interior_node_t));
-    if (!in) {
-        perror("malloc interior_node_t");
-        if (tn->token) free(tn->token);
-        free(tn);
-        return NULL;
+        in = malloc(sizeof(interior_node_t));
+        if (!in) {
+            perror("malloc interior_node_t");
+            if (tn->token) free(tn->token);
+            free(tn);
+            return NULL;
+        }
     }
 
+    tn->type  = INTERIOR;
+    tn->token_len = token.len;
     in->op    = op;
     in->left  = left;
     in->right = right;
@@ -46,55 +81,102 @@ tree_node_t *make_interior(op_type_t op, char *token,
 }
 
 /// Create a leaf node (integer or symbol)
-/// Now duplicates the token so tree owns it
-tree_node_t *make_leaf(exp_type_t exp_type, char *token)
+/// One arena allocation, or three heap allocations (node, payload, token)
+tree_node_t *make_leaf(arena_t *arena, exp_type_t exp_type, token_t token)
 {
-    tree_node_t *tn = malloc(sizeof(tree_node_t));
-    if (!tn) {
-        perror("malloc tree_node_t");
-        return NULL;
-    }
+    tree_node_t *tn;
+    leaf_node_t *ln;
 
-    tn->type = LEAF;
-    tn->token = token ? strdup(token) : NULL;  // OWN COPY
-    if (token && !tn->token) {
-        perror("strdup token");
-        free(tn);
-        return NULL;
-    }
+    if (arena) {
+        leaf_block_t *blk = arena_alloc(arena, sizeof(leaf_block_t));
+        tn = &blk->tn;
+        ln = &blk->ln;
+        tn->token = token.str;                 // slice of the input line
+    } else {
+        tn = malloc(sizeof(tree_node_t));
+        if (!tn) {
+            perror("malloc tree_node_t");
+            return NULL;
+        }
+
+        tn->token = copy_token(token);         // OWN COPY
+        if (!tn->token) {
+            perror("malloc token");
+            free(tn);
+            return NULL;
+        }
 
-    leaf_node_t *ln = malloc(sizeof(leaf_node_t));
-    if (!ln) {
-        perror("malloc leaf_node_t");
-        if (tn->token) free(tn->token);
-        free(tn);
-        return NULL;
+        ln = malloc(sizeof(leaf_node_t));
+        if (!ln) {
+            perror("malloc leaf_node_t");
+            if (tn->token) free(tn->token);
+            free(tn);
+            return NULL;
+        }
     }
 
+    tn->type = LEAF;
+    tn->token_len = token.len;
     ln->exp_type = exp_type;
+    ln->value = 0;              // set by the parser for INTEGER leaves
+    ln->sym = NULL;             // bound later by bind_tree()
     tn->node = (void *)ln;
 
     return tn;
 }
 
-/// Recursively free a parse tree
-void cleanup_tree(tree_node_t *node)
+/// Pending nodes of one cleanup_tree() call
+typedef struct free_work_s {
+    tree_node_t **nodes;
+    size_t cap;
+} free_work_t;
+
+/// Push a node onto the cleanup work stack
+/// @return the new stack size, exits on allocation failure
+static size_t push_free(free_work_t *w, size_t sp, tree_node_t *node)
 {
-    if (!node) return;
-
-    if (node->type == INTERIOR) {
-        interior_node_t *in = (interior_node_t *)node->node;
-        if (in) {
-            cleanup_tree(in->left);
-            cleanup_tree(in->right);
-            free(in);
+    if (sp == w->cap) {
+        size_t cap = w->cap ? w->cap * 2 : 64;
+        tree_node_t **grown = realloc(w->nodes, cap * sizeof(tree_node_t *));
+        if (!grown) {
+            perror("realloc cleanup stack");
+            exit(EXIT_FAILURE);
         }
-    } else if (node->type == LEAF) {
-        leaf_node_t *ln = (leaf_node_t *)node->node;
-        if (ln) free(ln);
+        w->nodes = grown;
+        w->cap = cap;
     }
+    w->nodes[sp] = node;
+    return sp + 1;
+}
 
-    // Now safe: token was duplicated → we own it
-    if (node->token) free(node->token);
-    free(node);
-}
\ No newline at end of file
+/// Free a parse tree built on the heap, without recursion
+/// (arena trees are released by resetting their arena instead)
+/// The work stack belongs to the call, so threads can free their own
+/// trees at the same time
+void cleanup_tree(tree_node_t *node)
+{
+    free_work_t w = { NULL, 0 };
+    size_t sp = push_free(&w, 0, node);
+    while (sp > 0) {
+        tree_node_t *cur = w.nodes[--sp];
+        if (!cur) continue;
+
+        if (cur->type == INTERIOR) {
+            interior_node_t *in = (interior_node_t *)cur->node;
+            if (in) {
+                // children are saved on the stack before the parent goes
+                sp = push_free(&w, sp, in->left);
+                sp = push_free(&w, sp, in->right);
+                free(in);
+            }
+        } else if (cur->type == LEAF) {
+            leaf_node_t *ln = (leaf_node_t *)cur->node;
+            if (ln) free(ln);
+        }
+
+        // Now safe: token was duplicated → we own it
+        if (cur->token) free(cur->token);
+        free(cur);
+    }
+    free(w.nodes);
+}
@@ -4,6 +4,7 @@
 #define TREE_NODE_H
 
 #include "symtab.h"
+#include "arena.h"
 
 // Operation tokens
 #define ADD_OP_STR	"+"
@@ -39,10 +40,17 @@ typedef enum node_type_e {
     LEAF
 } node_type_t;
 
+// A token: a slice of the input line, not null-terminated
+typedef struct token_s {
+    char *str;                  // first character of the token
+    size_t len;                 // number of characters
+} token_t;
+
 // Represents a node in the parse tree
 typedef struct tree_node_s {
     node_type_t type;           // the type of the node
     char *token;                // the token that derived this node
+    size_t token_len;           // length of token (it is not null-terminated)
     void *node;                 // either an interiorNode or leafNode
 } tree_node_t;
 
@@ -54,21 +62,31 @@ typedef struct interior_node_s {
 
 typedef struct leaf_node_s {
     exp_type_t exp_type;        // INTEGER or SYMBOL
+    int value;                  // decoded literal (INTEGER only)
+    symbol_t *sym;              // bound symbol slot (SYMBOL only, else NULL)
 } leaf_node_t;
 
-// Construct an interior node dynamically on the heap.
+// Construct an interior node in an arena, or dynamically on the heap.
+// With an arena the node keeps the token slice as given, so the
+// characters must live as long as the arena's contents (normally the
+// input line); the node goes away when the arena is reset.  Without
+// one the token is duplicated and the tree must be released with
+// cleanup_tree().
+// @param arena  the arena to allocate from, or NULL for the heap
 // @param op  the operation (add, subtract, etc.)
 // @param token  the token that derives this node
 // @param left  pointer to the left child of this node
 // @param right pointer to the right child of this node
 // @return the new TreeNode, or NULL if error
-tree_node_t *make_interior(op_type_t op, char *token,
+tree_node_t *make_interior(arena_t *arena, op_type_t op, token_t token,
                        tree_node_t *left, tree_node_t *right);
 
-// Construct a leaf node dynamically on the heap.
+// Construct a leaf node in an arena, or dynamically on the heap.
+// Token ownership follows the same rules as make_interior().
+// @param arena  the arena to allocate from, or NULL for the heap
 // @param expType  the operation token type (INTEGER or SYMBOL)
 // @param token  the token that derives this node
 // @return the new TreeNode, or NULL if error
-tree_node_t *make_leaf(exp_type_t exp_type, char *token);
+tree_node_t *make_leaf(arena_t *arena, exp_type_t exp_type, token_t token);
 
 #endif
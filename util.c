@@ -0,0 +1,52 @@
+// util.c
+// Helpers shared by the interpreter modules: growable work arrays,
+// checked allocation and the hashes of the name and pointer tables
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "util.h"
+
+/// Make sure an array can hold need elements
+void *reserve_work(void *buf, size_t *cap, size_t need, size_t elem)
+{
+    if (need <= *cap) return buf;
+    size_t n = *cap ? *cap : 64;
+    while (n < need) n *= 2;
+    void *grown = realloc(buf, n * elem);
+    if (!grown) {
+        perror("realloc work storage");
+        exit(EXIT_FAILURE);
+    }
+    *cap = n;
+    return grown;
+}
+
+/// Allocate zeroed memory or exit
+void *alloc_or_die(size_t size, const char *what)
+{
+    void *p = calloc(size ? size : 1, 1);
+    if (!p) {
+        perror(what);
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/// 32-bit FNV-1a
+unsigned int hash_name(const char *name, size_t len)
+{
+    unsigned int h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/// Multiplicative hash of an address (its low bits are alignment)
+size_t hash_ptr(const void *p)
+{
+    return (size_t)(((uintptr_t)p >> 4) * 2654435761u);
+}
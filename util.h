@@ -0,0 +1,38 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef UTIL_H
+#define UTIL_H
+
+#include <stddef.h>
+
+/// Makes sure a growable array can hold need elements, doubling its
+/// capacity (from 64) until it does.  New elements are not cleared.
+/// @param buf  the array, or NULL for none yet
+/// @param cap  its capacity in elements, updated when it grows
+/// @param need  the number of elements it must hold
+/// @param elem  the size of one element
+/// @return the (possibly moved) array
+/// @exception on allocation failure the program prints the reason
+///     and exits with EXIT_FAILURE
+void *reserve_work(void *buf, size_t *cap, size_t need, size_t elem);
+
+/// Allocates zeroed memory.
+/// @param size  the number of bytes (0 is allowed)
+/// @param what  what the memory is for, printed by perror() on failure
+/// @return the memory
+/// @exception on allocation failure the program exits with EXIT_FAILURE
+void *alloc_or_die(size_t size, const char *what);
+
+/// 32-bit FNV-1a hash of a name: the hash of the symbol table, the
+/// expression cache and the column table.
+/// @param name  the characters (not necessarily null-terminated)
+/// @param len  how many
+/// @return the hash
+unsigned int hash_name(const char *name, size_t len);
+
+/// Hash of a pointer, for tables keyed by address.
+/// @param p  the pointer
+/// @return the hash
+size_t hash_ptr(const void *p);
+
+#endif
@@ -0,0 +1,409 @@
+// vector.c
+// Columnar evaluation: one parse tree run over every row of the column
+// table a block at a time, with SIMD kernels for the arithmetic, masked
+// branches for ternaries and per-row error codes
+// @author: Munkh-Orgil Jargalsaikhan
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vector.h"
+#include "columns.h"
+#include "parser.h"
+#include "symtab.h"
+#include "util.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/// One pending node of the block walk
+typedef struct vec_frame_s {
+    tree_node_t *node;          ///< subtree being evaluated
+    int state;                  ///< how many of its children are done
+    const int *mask;            ///< rows it runs for (-1) or skips (0)
+} vec_frame_t;
+
+/// Work storage of one eval_columns_r() call, so calls never share it
+typedef struct vec_work_s {
+    interp_ctx_t *ctx;          ///< whose columns are read and written
+    vec_frame_t *frames;
+    size_t frames_cap;
+    int **values;               ///< value stack: one block per depth
+    size_t values_cap;
+    int **masks;                ///< then/else masks: two blocks per frame
+    size_t masks_cap;
+    int all_rows[VEC_BLOCK];    ///< mask with every row on
+    int row_error[VEC_BLOCK];   ///< first eval_error_t of each row
+} vec_work_t;
+
+/// Block i of a block list, allocating it on first use
+/// Blocks never move, so pointers to them stay valid
+static int *block(int ***list, size_t *cap, size_t i)
+{
+    size_t old_cap = *cap;
+    *list = reserve_work(*list, cap, i + 1, sizeof(int *));
+    if (*cap > old_cap) memset(*list + old_cap, 0, (*cap - old_cap) * sizeof(int *));
+    if (!(*list)[i]) {
+        (*list)[i] = malloc(VEC_BLOCK * sizeof(int));
+        if (!(*list)[i]) {
+            perror("malloc vector block");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return (*list)[i];
+}
+
+/// Free a block list and its blocks
+static void free_blocks(int **list, size_t cap)
+{
+    for (size_t i = 0; i < cap; ++i) free(list[i]);
+    free(list);
+}
+
+/// Push a subtree onto the frame stack
+static size_t push_node(vec_work_t *w, size_t sp, tree_node_t *node, const int *mask)
+{
+    w->frames = reserve_work(w->frames, &w->frames_cap, sp + 1, sizeof(vec_frame_t));
+    w->frames[sp].node = node;
+    w->frames[sp].state = 0;
+    w->frames[sp].mask = mask;
+    return sp + 1;
+}
+
+/// Whether a row still runs: its mask is on and it has not failed
+/// (row_error is the caller's per-row error array)
+#define LIVE(mask, i) ((mask)[i] && !row_error[i])
+
+/* ---- kernels: n rows at a time, SIMD body and scalar tail ---- */
+
+/// dst = a + b (wrapping)
+static void vec_add(int *dst, const int *a, const int *b, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi32(x, y));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi32(x, y));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = (int)((unsigned int)a[i] + (unsigned int)b[i]);
+}
+
+/// dst = a - b (wrapping)
+static void vec_sub(int *dst, const int *a, const int *b, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_sub_epi32(x, y));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_sub_epi32(x, y));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = (int)((unsigned int)a[i] - (unsigned int)b[i]);
+}
+
+/// dst = a * b (low 32 bits)
+/// SSE2 has no 32-bit multiply, so even and odd lanes go through
+/// pmuludq and are put back together
+static void vec_mul(int *dst, const int *a, const int *b, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_mullo_epi32(x, y));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i even = _mm_mul_epu32(x, y);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(x, 32), _mm_srli_epi64(y, 32));
+        __m128i lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                                        _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+        _mm_storeu_si128((__m128i *)(dst + i), lo);
+    }
+#endif
+    for (; i < n; ++i) dst[i] = (int)((unsigned int)a[i] * (unsigned int)b[i]);
+}
+
+/// dst = test ? a : b, as a blend on test == 0
+static void vec_select(int *dst, const int *test, const int *a, const int *b, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256i t = _mm256_loadu_si256((const __m256i *)(test + i));
+        __m256i x = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i y = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i zero = _mm256_cmpeq_epi32(t, _mm256_setzero_si256());
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_blendv_epi8(x, y, zero));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128i t = _mm_loadu_si128((const __m128i *)(test + i));
+        __m128i x = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i zero = _mm_cmpeq_epi32(t, _mm_setzero_si128());
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_or_si128(_mm_and_si128(zero, y), _mm_andnot_si128(zero, x)));
+    }
+#endif
+    for (; i < n; ++i) dst[i] = test[i] ? a[i] : b[i];
+}
+
+/// Split a mask on a ternary's test: then_mask = mask && test,
+/// else_mask = mask && !test
+static void vec_branch(int *then_mask, int *else_mask, const int *mask,
+                       const int *test, size_t n)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= n; i += 8) {
+        __m256i m = _mm256_loadu_si256((const __m256i *)(mask + i));
+        __m256i t = _mm256_loadu_si256((const __m256i *)(test + i));
+        __m256i zero = _mm256_cmpeq_epi32(t, _mm256_setzero_si256());
+        _mm256_storeu_si256((__m256i *)(then_mask + i), _mm256_andnot_si256(zero, m));
+        _mm256_storeu_si256((__m256i *)(else_mask + i), _mm256_and_si256(zero, m));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= n; i += 4) {
+        __m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+        __m128i t = _mm_loadu_si128((const __m128i *)(test + i));
+        __m128i zero = _mm_cmpeq_epi32(t, _mm_setzero_si128());
+        _mm_storeu_si128((__m128i *)(then_mask + i), _mm_andnot_si128(zero, m));
+        _mm_storeu_si128((__m128i *)(else_mask + i), _mm_and_si128(zero, m));
+    }
+#endif
+    for (; i < n; ++i) {
+        then_mask[i] = mask[i] && test[i] ? -1 : 0;
+        else_mask[i] = mask[i] && !test[i] ? -1 : 0;
+    }
+}
+
+/// dst = a / b or a % b in live rows; a zero divisor fails its row only
+/// There is no SIMD integer division, so each live row divides alone
+static void vec_divide(int *dst, const int *a, const int *b, const int *mask,
+                       int *row_error, size_t n, op_type_t op)
+{
+    eval_error_t err = op == DIV_OP ? DIVISION_BY_ZERO : INVALID_MODULUS;
+    for (size_t i = 0; i < n; ++i) {
+        if (!LIVE(mask, i)) continue;
+        if (b[i] == 0) row_error[i] = err;
+        else dst[i] = op == DIV_OP ? a[i] / b[i] : a[i] % b[i];
+    }
+}
+
+/// dst = value in every row
+static void vec_fill(int *dst, int value, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) dst[i] = value;
+}
+
+/// Fail every live row with an error
+static void vec_fail(const int *mask, int *row_error, eval_error_t err, size_t n)
+{
+    for (size_t i = 0; i < n; ++i) {
+        if (LIVE(mask, i)) row_error[i] = err;
+    }
+}
+
+/* ---- the walk ---- */
+
+/// Slot of a SYMBOL leaf, or NULL if bind_tree() never saw it
+static symbol_t *leaf_slot(tree_node_t *node)
+{
+    return ((leaf_node_t *)node->node)->sym;
+}
+
+/// Value of a SYMBOL leaf for rows [row, row + n): its column, or the
+/// symbol table value; rows with no value fail
+static void load_symbol(interp_ctx_t *ctx, int *dst, tree_node_t *node, const int *mask, int *row_error,
+                        size_t row, size_t n)
+{
+    column_t *col = lookup_column_r(ctx, node->token, node->token_len);
+    if (col) {
+        memcpy(dst, col->values + row, n * sizeof(int));   // a later store must not change it
+        if (col->defined) {
+            for (size_t i = 0; i < n; ++i) {
+                if (LIVE(mask, i) && !col->defined[row + i]) row_error[i] = UNDEFINED_SYMBOL;
+            }
+        }
+        return;
+    }
+
+    symbol_t *sym = leaf_slot(node);
+    if (sym && sym->defined) vec_fill(dst, sym->val, n);
+    else vec_fail(mask, row_error, UNDEFINED_SYMBOL, n);
+}
+
+/// Assign a value to the live rows of a symbol's column
+static void store_symbol(interp_ctx_t *ctx, tree_node_t *target, const int *src, const int *mask,
+                         const int *row_error, size_t row, size_t n)
+{
+    column_t *col = lookup_column_r(ctx, target->token, target->token_len);
+    if (!col) col = add_column_r(ctx, target->token, target->token_len, leaf_slot(target));
+
+    for (size_t i = 0; i < n; ++i) {
+        if (!LIVE(mask, i)) continue;
+        col->values[row + i] = src[i];
+        if (col->defined) col->defined[row + i] = 1;
+    }
+}
+
+/// Evaluate a tree for rows [row, row + n) without recursion
+/// Each finished subtree leaves a block of values on the value stack;
+/// rows a subtree does not run for (or that failed) hold junk there
+/// @return the result block
+static const int *eval_block(vec_work_t *w, tree_node_t *root, size_t row, size_t n)
+{
+    int *row_error = w->row_error;
+    memset(row_error, 0, n * sizeof(int));
+    size_t vp = 0;
+    size_t sp = push_node(w, 0, root, w->all_rows);
+
+    while (sp > 0) {
+        vec_frame_t *f = &w->frames[sp - 1];
+        tree_node_t *node = f->node;
+        const int *mask = f->mask;
+
+        if (!node) {
+            vec_fail(mask, row_error, UNKNOWN_OPERATION, n);
+            block(&w->values, &w->values_cap, vp++);
+            sp--;
+            continue;
+        }
+
+        if (node->type == LEAF) {
+            leaf_node_t *ln = (leaf_node_t *)node->node;
+            int *dst = block(&w->values, &w->values_cap, vp++);
+            if (ln->exp_type == INTEGER) vec_fill(dst, ln->value, n);
+            else load_symbol(w->ctx, dst, node, mask, row_error, row, n);
+            sp--;
+            continue;
+        }
+
+        interior_node_t *in = (interior_node_t *)node->node;
+
+        if (in->op == ASSIGN_OP) {
+            if (f->state == 0) {
+                if (in->left->type != LEAF || ((leaf_node_t *)in->left->node)->exp_type != SYMBOL) {
+                    vec_fail(mask, row_error, INVALID_LVALUE, n);
+                    block(&w->values, &w->values_cap, vp++);
+                    sp--;
+                    continue;
+                }
+                f->state = 1;
+                sp = push_node(w, sp, in->right, mask);
+            } else {
+                store_symbol(w->ctx, in->left, w->values[vp - 1], mask, row_error, row, n);
+                sp--;              // the assigned value stays on the stack
+            }
+            continue;
+        }
+
+        if (in->op == Q_OP) {
+            interior_node_t *alt = (interior_node_t *)in->right->node;
+            int *then_mask = block(&w->masks, &w->masks_cap, 2 * (sp - 1));
+            int *else_mask = block(&w->masks, &w->masks_cap, 2 * (sp - 1) + 1);
+            switch (f->state++) {
+                case 0:
+                    sp = push_node(w, sp, in->left, mask);
+                    break;
+                case 1:
+                    vec_branch(then_mask, else_mask, mask, w->values[vp - 1], n);
+                    sp = push_node(w, sp, alt->left, then_mask);
+                    break;
+                case 2:
+                    sp = push_node(w, sp, alt->right, else_mask);
+                    break;
+                default:
+                    vec_select(w->values[vp - 3], w->values[vp - 3], w->values[vp - 2], w->values[vp - 1], n);
+                    vp -= 2;
+                    sp--;
+                    break;
+            }
+            continue;
+        }
+
+        if (f->state == 0) {
+            f->state = 1;
+            sp = push_node(w, sp, in->left, mask);
+            continue;
+        }
+        if (f->state == 1) {
+            f->state = 2;
+            sp = push_node(w, sp, in->right, mask);
+            continue;
+        }
+
+        int *left = w->values[vp - 2];
+        const int *right = w->values[vp - 1];
+        switch (in->op) {
+            case ADD_OP: vec_add(left, left, right, n); break;
+            case SUB_OP: vec_sub(left, left, right, n); break;
+            case MUL_OP: vec_mul(left, left, right, n); break;
+            case DIV_OP:
+            case MOD_OP: vec_divide(left, left, right, mask, row_error, n, in->op); break;
+            default: vec_fail(mask, row_error, UNKNOWN_OPERATION, n); break;
+        }
+        vp--;
+        sp--;
+    }
+    return w->values[0];
+}
+
+/// Evaluate a tree over every row and write the result column
+void eval_columns_r(interp_ctx_t *ctx, tree_node_t *root, outbuf_t *out)
+{
+    size_t rows = column_rows_r(ctx);
+    size_t failed[SYMTAB_FULL + 1] = { 0 };
+
+    vec_work_t *w = alloc_or_die(sizeof(vec_work_t), "malloc vector work");
+    w->ctx = ctx;
+    vec_fill(w->all_rows, -1, VEC_BLOCK);
+
+    ob_write(out, " =", 2);
+    for (size_t row = 0; row < rows; row += VEC_BLOCK) {
+        size_t n = rows - row < VEC_BLOCK ? rows - row : VEC_BLOCK;
+        const int *result = eval_block(w, root, row, n);
+        for (size_t i = 0; i < n; ++i) {
+            ob_putc(out, ' ');
+            if (w->row_error[i]) {
+                ob_puts(out, "error");
+                failed[w->row_error[i]]++;
+            } else {
+                ob_int(out, result[i]);
+            }
+        }
+    }
+    ob_putc(out, '\n');
+
+    free(w->frames);
+    free_blocks(w->values, w->values_cap);
+    free_blocks(w->masks, w->masks_cap);
+    free(w);
+
+    for (int e = DIVISION_BY_ZERO; e <= SYMTAB_FULL; ++e) {
+        if (failed[e])
+            fprintf(stderr, "%s in %zu of %zu rows\n", eval_error_message((eval_error_t)e), failed[e], rows);
+    }
+}
@@ -0,0 +1,31 @@
+/// @author: Munkh-Orgil Jargalsaikhan
+
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include "tree_node.h"
+#include "outbuf.h"
+#include "symtab.h"
+
+#define VEC_BLOCK 1024          // rows evaluated together (a multiple of 8)
+
+/// Evaluates a bound tree once for every row of a context's column
+/// table (see build_columns_r()) and writes the result column:
+///
+///     " = " row-1-value row-2-value ...
+///
+/// A SYMBOL leaf reads its column, or the symbol table value when it
+/// has none; an assignment stores into its column, creating it if
+/// needed.  Rows are evaluated in blocks of VEC_BLOCK with SIMD
+/// kernels (SSE2, or AVX2 when compiled for it): both branches of a
+/// ternary run under per-row masks and are blended, and division or
+/// modulus by zero marks only its own row as failed.  Each row sees
+/// exactly the values, assignments and first error eval_tree() would
+/// produce for it.  A failed row is written as "error", and every
+/// kind of error is reported once on standard error with its count.
+/// @param ctx  the context whose columns are read and written
+/// @param root  the root of the tree (already bound by bind_tree())
+/// @param out  where the result column goes
+void eval_columns_r(interp_ctx_t *ctx, tree_node_t *root, outbuf_t *out);
+
+#endif